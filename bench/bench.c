@@ -0,0 +1,403 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gmodule.h>
+
+#include <weechat-plugin.h>
+
+#include "record.h"
+#include "bench.h"
+
+/*
+ * Replays a corpus of print lines through the plugin print callback,
+ * against a stand-in eventd, and reports:
+ *  - ns/line: time spent in the print callbacks
+ *  - allocs/line: malloc(), calloc() and realloc() calls in them
+ *  - events/s: events received by eventd, until the queue is drained
+ *
+ * Corpus lines are tab-separated:
+ * buffer  tags  highlight  prefix  message
+ * where buffer is plugin:type:server:channel and tags are comma-separated
+ *
+ * A trace recorded with /eventc record can be used as corpus too
+ */
+
+/* Lines printed between two main loop iterations */
+#define WEC_BENCH_BATCH 64
+
+typedef struct {
+    struct t_gui_buffer *buffer;
+    gchar **tags;
+    gint tags_count;
+    gboolean displayed;
+    gboolean highlight;
+    /* How old the line was when recorded (in seconds), -1 if it had no date */
+    gint64 age;
+    gchar *prefix;
+    gchar *message;
+} WecBenchLine;
+
+typedef gint (*WecBenchPluginInit)(struct t_weechat_plugin *plugin, gint argc, gchar *argv[]);
+typedef gint (*WecBenchPluginEnd)(struct t_weechat_plugin *plugin);
+
+#ifdef WEC_BENCH_COUNT_ALLOCS
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static __thread gboolean _wec_bench_allocs_counting = FALSE;
+static guint64 _wec_bench_allocs = 0;
+
+void *
+malloc(size_t size)
+{
+    if ( _wec_bench_allocs_counting )
+        ++_wec_bench_allocs;
+    return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+    if ( _wec_bench_allocs_counting )
+        ++_wec_bench_allocs;
+    return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+    if ( _wec_bench_allocs_counting )
+        ++_wec_bench_allocs;
+    return __libc_realloc(ptr, size);
+}
+
+void
+free(void *ptr)
+{
+    __libc_free(ptr);
+}
+
+void
+wec_bench_allocs_count(gboolean count)
+{
+    _wec_bench_allocs_counting = count;
+}
+
+guint64
+wec_bench_allocs_get(void)
+{
+    return _wec_bench_allocs;
+}
+#else /* ! WEC_BENCH_COUNT_ALLOCS */
+void
+wec_bench_allocs_count(gboolean count)
+{
+}
+
+guint64
+wec_bench_allocs_get(void)
+{
+    return 0;
+}
+#endif /* ! WEC_BENCH_COUNT_ALLOCS */
+
+static gint64
+_wec_bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (gint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+_wec_bench_line_free(gpointer data)
+{
+    WecBenchLine *line = data;
+
+    g_strfreev(line->tags);
+    g_free(line->prefix);
+    g_free(line->message);
+    g_free(line);
+}
+
+static GPtrArray *
+_wec_bench_trace_load(const gchar *path)
+{
+    WecRecordReader *reader = wec_record_reader_new(path);
+    if ( reader == NULL )
+        return NULL;
+
+    GPtrArray *corpus = g_ptr_array_new_with_free_func(_wec_bench_line_free);
+    WecRecordLine record;
+    while ( wec_record_reader_next(reader, &record) )
+    {
+        WecBenchLine *line = g_new0(WecBenchLine, 1);
+        gint i;
+
+        line->buffer = wec_bench_weechat_buffer(record.buffer);
+        line->tags = g_new(gchar *, record.tags_count + 1);
+        for ( i = 0 ; i < record.tags_count ; ++i )
+            line->tags[i] = g_strdup(record.tags[i]);
+        line->tags[i] = NULL;
+        line->tags_count = record.tags_count;
+        line->displayed = record.displayed;
+        line->highlight = record.highlight;
+        line->age = ( record.date > 0 ) ? MAX(record.time / G_USEC_PER_SEC - record.date, 0) : -1;
+        line->prefix = g_strdup(record.prefix);
+        line->message = g_strdup(record.message);
+        g_ptr_array_add(corpus, line);
+    }
+    wec_record_reader_free(reader);
+
+    return corpus;
+}
+
+static GPtrArray *
+_wec_bench_corpus_load(const gchar *path)
+{
+    if ( wec_record_is_trace(path) )
+        return _wec_bench_trace_load(path);
+
+    GError *error = NULL;
+    gchar *contents;
+
+    if ( ! g_file_get_contents(path, &contents, NULL, &error) )
+    {
+        g_printerr("Could not read corpus: %s\n", error->message);
+        g_error_free(error);
+        return NULL;
+    }
+
+    GPtrArray *corpus = g_ptr_array_new_with_free_func(_wec_bench_line_free);
+    gchar **lines = g_strsplit(contents, "\n", -1);
+    gchar **l;
+    for ( l = lines ; *l != NULL ; ++l )
+    {
+        if ( ( **l == '\0' ) || ( **l == '#' ) )
+            continue;
+
+        gchar **fields = g_strsplit(*l, "\t", 5);
+        if ( g_strv_length(fields) != 5 )
+        {
+            g_printerr("Invalid corpus line: %s\n", *l);
+            g_strfreev(fields);
+            continue;
+        }
+
+        WecBenchLine *line = g_new0(WecBenchLine, 1);
+        line->buffer = wec_bench_weechat_buffer(fields[0]);
+        line->tags = g_strsplit(fields[1], ",", -1);
+        line->tags_count = g_strv_length(line->tags);
+        line->displayed = TRUE;
+        line->highlight = ( g_strcmp0(fields[2], "1") == 0 );
+        line->age = -1;
+        line->prefix = g_strdup(fields[3]);
+        line->message = g_strdup(fields[4]);
+        g_ptr_array_add(corpus, line);
+
+        g_strfreev(fields);
+    }
+    g_strfreev(lines);
+    g_free(contents);
+
+    return corpus;
+}
+
+int
+main(int argc, char *argv[])
+{
+    gint iterations = 200;
+    gint64 expect_events = -1;
+    gchar **options = NULL;
+    GError *error = NULL;
+    int r = 1;
+
+    GOptionEntry entries[] = {
+        { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations, "Replay the corpus N times", "N" },
+        { "option", 'o', 0, G_OPTION_ARG_STRING_ARRAY, &options, "Set a plugin option", "section.option=value" },
+        { "expect-events", 'e', 0, G_OPTION_ARG_INT64, &expect_events, "Fail unless eventd received exactly N events", "N" },
+        { .long_name = NULL }
+    };
+
+    GOptionContext *option_context = g_option_context_new("<plugin> <corpus> - replay benchmark");
+    g_option_context_add_main_entries(option_context, entries, NULL);
+    if ( ! g_option_context_parse(option_context, &argc, &argv, &error) )
+    {
+        g_printerr("Option parsing failed: %s\n", error->message);
+        g_error_free(error);
+        g_option_context_free(option_context);
+        return 1;
+    }
+    g_option_context_free(option_context);
+
+    if ( argc < 3 )
+    {
+        g_printerr("Usage: %s <plugin> <corpus>\n", argv[0]);
+        return 1;
+    }
+
+    gchar *home = g_dir_make_tmp("eventc-bench-XXXXXX", &error);
+    if ( home == NULL )
+    {
+        g_printerr("Could not create temporary directory: %s\n", error->message);
+        g_error_free(error);
+        return 1;
+    }
+
+    /* The plugin default address is $XDG_RUNTIME_DIR/eventd/evp */
+    gchar *runtime_dir = g_build_filename(home, "eventd", NULL);
+    gchar *socket_path = g_build_filename(runtime_dir, "evp", NULL);
+    g_mkdir(runtime_dir, 0700);
+    g_setenv("XDG_RUNTIME_DIR", home, TRUE);
+
+    WecBenchEventd *eventd = wec_bench_eventd_new(socket_path);
+    if ( eventd == NULL )
+        goto cleanup;
+
+    struct t_weechat_plugin *plugin = wec_bench_weechat_new(home, options);
+
+    GPtrArray *corpus = _wec_bench_corpus_load(argv[2]);
+    if ( ( corpus == NULL ) || ( corpus->len == 0 ) )
+    {
+        g_printerr("Empty corpus\n");
+        goto cleanup_corpus;
+    }
+
+    WecBenchPluginInit plugin_init;
+    WecBenchPluginEnd plugin_end;
+    GModule *module = g_module_open(argv[1], G_MODULE_BIND_LOCAL);
+    if ( module == NULL )
+    {
+        g_printerr("Could not load plugin: %s\n", g_module_error());
+        goto cleanup_corpus;
+    }
+    if ( ( ! g_module_symbol(module, "weechat_plugin_init", (gpointer *) &plugin_init) ) || ( ! g_module_symbol(module, "weechat_plugin_end", (gpointer *) &plugin_end) ) )
+    {
+        g_printerr("Not a WeeChat plugin: %s\n", g_module_error());
+        goto cleanup_corpus;
+    }
+    /*
+     * The plugin installs GLib log handlers, which cannot all be removed,
+     * so it stays loaded
+     */
+    g_module_make_resident(module);
+
+    plugin_init(plugin, 0, NULL);
+
+    /* Let it connect */
+    gint i;
+    for ( i = 0 ; i < 10 ; ++i )
+        wec_bench_weechat_iterate(10);
+
+    guint64 lines = 0;
+    gint64 print_time = 0;
+    guint64 allocs = wec_bench_allocs_get();
+    gint64 start = _wec_bench_now();
+
+    for ( i = 0 ; i < iterations ; ++i )
+    {
+        guint j;
+        for ( j = 0 ; j < corpus->len ; )
+        {
+            guint end = MIN(j + WEC_BENCH_BATCH, corpus->len);
+            /* Lines keep their age, so playback is detected as it was */
+            time_t now = time(NULL);
+
+            wec_bench_allocs_count(TRUE);
+            gint64 batch_start = _wec_bench_now();
+            for ( ; j < end ; ++j )
+            {
+                WecBenchLine *line = g_ptr_array_index(corpus, j);
+                time_t date = ( line->age >= 0 ) ? ( now - line->age ) : 0;
+                wec_bench_weechat_print(line->buffer, date, line->tags_count, (const gchar **) line->tags, line->displayed, line->highlight, line->prefix, line->message);
+            }
+            print_time += _wec_bench_now() - batch_start;
+            wec_bench_allocs_count(FALSE);
+
+            wec_bench_weechat_iterate(0);
+        }
+        lines += corpus->len;
+    }
+    allocs = wec_bench_allocs_get() - allocs;
+
+    /* Wait for the queue to be drained and eventd to be done reading */
+    guint64 events = wec_bench_eventd_get_events(eventd);
+    gint64 deadline = _wec_bench_now() + (gint64) 10 * 1000000000;
+    gint64 stable = _wec_bench_now();
+    gint64 end = stable;
+    while ( _wec_bench_now() < deadline )
+    {
+        wec_bench_weechat_iterate(10);
+        guint64 e = wec_bench_eventd_get_events(eventd);
+        if ( e != events )
+        {
+            events = e;
+            stable = end = _wec_bench_now();
+        }
+        else if ( ( ! wec_bench_weechat_is_writing() ) && ( ( _wec_bench_now() - stable ) > 100000000 ) )
+            break;
+    }
+
+    g_print("lines: %" G_GUINT64_FORMAT "\n", lines);
+    g_print("events: %" G_GUINT64_FORMAT " (%" G_GUINT64_FORMAT " bytes)\n", events, wec_bench_eventd_get_bytes(eventd));
+    g_print("ns/line: %.1f\n", (gdouble) print_time / lines);
+#ifdef WEC_BENCH_COUNT_ALLOCS
+    g_print("allocs/line: %.2f\n", (gdouble) allocs / lines);
+#else /* ! WEC_BENCH_COUNT_ALLOCS */
+    g_print("allocs/line: n/a\n");
+#endif /* ! WEC_BENCH_COUNT_ALLOCS */
+    g_print("events/s: %.0f\n", (gdouble) events * 1000000000 / ( end - start ));
+
+    plugin_end(plugin);
+    r = 0;
+    if ( ( expect_events >= 0 ) && ( events != (guint64) expect_events ) )
+    {
+        g_printerr("Expected %" G_GINT64_FORMAT " events, got %" G_GUINT64_FORMAT "\n", expect_events, events);
+        r = 1;
+    }
+
+cleanup_corpus:
+    if ( corpus != NULL )
+        g_ptr_array_unref(corpus);
+    wec_bench_weechat_free(plugin);
+    wec_bench_eventd_free(eventd);
+cleanup:
+    g_rmdir(runtime_dir);
+    g_rmdir(home);
+    g_free(socket_path);
+    g_free(runtime_dir);
+    g_free(home);
+    g_strfreev(options);
+
+    return r;
+}
@@ -0,0 +1,49 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __WEECHAT_EVENTC_BENCH_H__
+#define __WEECHAT_EVENTC_BENCH_H__
+
+#include <weechat-plugin.h>
+
+/* Stub WeeChat */
+struct t_weechat_plugin *wec_bench_weechat_new(const gchar *home, gchar **options);
+void wec_bench_weechat_free(struct t_weechat_plugin *plugin);
+
+struct t_gui_buffer *wec_bench_weechat_buffer(const gchar *spec);
+void wec_bench_weechat_print(struct t_gui_buffer *buffer, time_t date, gint tags_count, const gchar **tags, gboolean displayed, gboolean highlight, const gchar *prefix, const gchar *message);
+void wec_bench_weechat_iterate(gint timeout);
+gboolean wec_bench_weechat_is_writing(void);
+
+/* Stand-in eventd */
+typedef struct _WecBenchEventd WecBenchEventd;
+
+WecBenchEventd *wec_bench_eventd_new(const gchar *path);
+void wec_bench_eventd_free(WecBenchEventd *eventd);
+guint64 wec_bench_eventd_get_events(WecBenchEventd *eventd);
+guint64 wec_bench_eventd_get_bytes(WecBenchEventd *eventd);
+
+/* Allocations of the main thread */
+void wec_bench_allocs_count(gboolean count);
+guint64 wec_bench_allocs_get(void);
+
+#endif /* __WEECHAT_EVENTC_BENCH_H__ */
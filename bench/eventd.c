@@ -0,0 +1,186 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <glib.h>
+
+#include "bench.h"
+
+/*
+ * Accepts connections on a Unix socket and counts the events received,
+ * an event being terminated by a line with a single dot
+ */
+
+struct _WecBenchEventd {
+    gchar *path;
+    gint fd;
+    GThread *thread;
+    volatile gint stop;
+    guint64 events;
+    guint64 bytes;
+    GMutex lock;
+};
+
+static void
+_wec_bench_eventd_read(WecBenchEventd *self, gint fd)
+{
+    gchar buffer[65536];
+    /* 0: line start, 1: dot at line start, 2: anywhere else */
+    gint state = 0;
+    gssize r;
+
+    while ( ( r = read(fd, buffer, sizeof(buffer)) ) != 0 )
+    {
+        if ( r < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            break;
+        }
+
+        guint64 events = 0;
+        gssize i;
+        for ( i = 0 ; i < r ; ++i )
+        {
+            switch ( buffer[i] )
+            {
+            case '\n':
+                if ( state == 1 )
+                    ++events;
+                state = 0;
+            break;
+            case '.':
+                state = ( state == 0 ) ? 1 : 2;
+            break;
+            default:
+                state = 2;
+            break;
+            }
+        }
+
+        g_mutex_lock(&self->lock);
+        self->events += events;
+        self->bytes += r;
+        g_mutex_unlock(&self->lock);
+    }
+}
+
+static gpointer
+_wec_bench_eventd_thread(gpointer user_data)
+{
+    WecBenchEventd *self = user_data;
+
+    while ( ! g_atomic_int_get(&self->stop) )
+    {
+        gint fd = accept(self->fd, NULL, NULL);
+        if ( fd < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            break;
+        }
+
+        _wec_bench_eventd_read(self, fd);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+WecBenchEventd *
+wec_bench_eventd_new(const gchar *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    gint fd;
+
+    if ( strlen(path) >= sizeof(addr.sun_path) )
+    {
+        g_warning("Socket path too long: %s", path);
+        return NULL;
+    }
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if ( fd < 0 )
+    {
+        g_warning("Could not create socket: %s", g_strerror(errno));
+        return NULL;
+    }
+
+    if ( ( bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ) || ( listen(fd, 4) < 0 ) )
+    {
+        g_warning("Could not listen on %s: %s", path, g_strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    WecBenchEventd *self;
+
+    self = g_new0(WecBenchEventd, 1);
+    self->path = g_strdup(path);
+    self->fd = fd;
+    g_mutex_init(&self->lock);
+    self->thread = g_thread_new("eventd", _wec_bench_eventd_thread, self);
+
+    return self;
+}
+
+void
+wec_bench_eventd_free(WecBenchEventd *self)
+{
+    g_atomic_int_set(&self->stop, 1);
+    /* Wakes accept() up */
+    shutdown(self->fd, SHUT_RDWR);
+    g_thread_join(self->thread);
+
+    close(self->fd);
+    unlink(self->path);
+    g_mutex_clear(&self->lock);
+    g_free(self->path);
+    g_free(self);
+}
+
+guint64
+wec_bench_eventd_get_events(WecBenchEventd *self)
+{
+    guint64 r;
+    g_mutex_lock(&self->lock);
+    r = self->events;
+    g_mutex_unlock(&self->lock);
+    return r;
+}
+
+guint64
+wec_bench_eventd_get_bytes(WecBenchEventd *self)
+{
+    guint64 r;
+    g_mutex_lock(&self->lock);
+    r = self->bytes;
+    g_mutex_unlock(&self->lock);
+    return r;
+}
@@ -0,0 +1,662 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <glib.h>
+
+#include <weechat-plugin.h>
+
+#include "bench.h"
+
+/*
+ * Just enough of WeeChat to load the plugin: the functions it uses, its
+ * buffers local variables, its options and a tiny main loop for fd and
+ * timer hooks
+ */
+
+typedef enum {
+    WEC_BENCH_HOOK_PRINT,
+    WEC_BENCH_HOOK_SIGNAL,
+    WEC_BENCH_HOOK_FD,
+    WEC_BENCH_HOOK_TIMER,
+    WEC_BENCH_HOOK_COMMAND,
+} WecBenchHookType;
+
+struct t_hook {
+    WecBenchHookType type;
+    gboolean dead;
+    const void *pointer;
+    void *data;
+    union {
+        struct {
+            /* OR of AND groups, NULL for every line */
+            gchar ***tags;
+            gint (*callback)(const void *pointer, void *data, struct t_gui_buffer *buffer, time_t date, gint tags_count, const gchar **tags, gint displayed, gint highlight, const gchar *prefix, const gchar *message);
+        } print;
+        struct {
+            gchar *signal;
+            gint (*callback)(const void *pointer, void *data, const gchar *signal, const gchar *type_data, void *signal_data);
+        } signal;
+        struct {
+            gint fd;
+            gboolean read;
+            gboolean write;
+            gint (*callback)(const void *pointer, void *data, gint fd);
+        } fd;
+        struct {
+            gint64 interval;
+            gint64 next;
+            gint remaining;
+            gint (*callback)(const void *pointer, void *data, gint remaining_calls);
+        } timer;
+    };
+};
+
+struct t_gui_buffer {
+    gchar *plugin;
+    gchar *type;
+    gchar *server;
+    gchar *channel;
+};
+
+struct t_config_file {
+    gchar *name;
+};
+
+struct t_config_section {
+    gchar *name;
+    struct t_config_file *file;
+};
+
+struct t_config_option {
+    gchar *value;
+    gint integer;
+    gboolean boolean;
+};
+
+static struct {
+    struct t_weechat_plugin plugin;
+    gchar *home;
+    gchar **options;
+    GPtrArray *hooks;
+    GHashTable *buffers;
+    GPtrArray *config;
+    gboolean iterating;
+} _wec_bench_weechat;
+
+static void
+_wec_bench_weechat_hook_free(gpointer data)
+{
+    struct t_hook *hook = data;
+
+    switch ( hook->type )
+    {
+    case WEC_BENCH_HOOK_PRINT:
+        if ( hook->print.tags != NULL )
+        {
+            gchar ***group;
+            for ( group = hook->print.tags ; *group != NULL ; ++group )
+                g_strfreev(*group);
+            g_free(hook->print.tags);
+        }
+    break;
+    case WEC_BENCH_HOOK_SIGNAL:
+        g_free(hook->signal.signal);
+    break;
+    default:
+    break;
+    }
+    g_free(hook);
+}
+
+static void
+_wec_bench_weechat_collect(void)
+{
+    guint i;
+    for ( i = 0 ; i < _wec_bench_weechat.hooks->len ; )
+    {
+        struct t_hook *hook = g_ptr_array_index(_wec_bench_weechat.hooks, i);
+        if ( hook->dead )
+            g_ptr_array_remove_index(_wec_bench_weechat.hooks, i);
+        else
+            ++i;
+    }
+}
+
+static struct t_hook *
+_wec_bench_weechat_hook_new(WecBenchHookType type, const void *pointer, void *data)
+{
+    struct t_hook *hook;
+
+    hook = g_new0(struct t_hook, 1);
+    hook->type = type;
+    hook->pointer = pointer;
+    hook->data = data;
+    g_ptr_array_add(_wec_bench_weechat.hooks, hook);
+
+    return hook;
+}
+
+static void
+_wec_bench_weechat_unhook(struct t_hook *hook)
+{
+    if ( hook == NULL )
+        return;
+
+    hook->dead = TRUE;
+    if ( ! _wec_bench_weechat.iterating )
+        _wec_bench_weechat_collect();
+}
+
+static struct t_hook *
+_wec_bench_weechat_hook_print(struct t_weechat_plugin *plugin, struct t_gui_buffer *buffer, const char *tags, const char *message, int strip_colors, int (*callback)(const void *pointer, void *data, struct t_gui_buffer *buffer, time_t date, int tags_count, const char **tags, int displayed, int highlight, const char *prefix, const char *message), const void *pointer, void *data)
+{
+    struct t_hook *hook = _wec_bench_weechat_hook_new(WEC_BENCH_HOOK_PRINT, pointer, data);
+    hook->print.callback = callback;
+
+    /* Like WeeChat, "," is OR and "+" is AND */
+    if ( ( tags != NULL ) && ( *tags != '\0' ) )
+    {
+        gchar **groups = g_strsplit(tags, ",", -1);
+        guint i, length = g_strv_length(groups);
+        hook->print.tags = g_new0(gchar **, length + 1);
+        for ( i = 0 ; i < length ; ++i )
+            hook->print.tags[i] = g_strsplit(groups[i], "+", -1);
+        g_strfreev(groups);
+    }
+
+    return hook;
+}
+
+static struct t_hook *
+_wec_bench_weechat_hook_signal(struct t_weechat_plugin *plugin, const char *signal, int (*callback)(const void *pointer, void *data, const char *signal, const char *type_data, void *signal_data), const void *pointer, void *data)
+{
+    struct t_hook *hook = _wec_bench_weechat_hook_new(WEC_BENCH_HOOK_SIGNAL, pointer, data);
+    hook->signal.signal = g_strdup(signal);
+    hook->signal.callback = callback;
+    return hook;
+}
+
+static struct t_hook *
+_wec_bench_weechat_hook_fd(struct t_weechat_plugin *plugin, int fd, int flag_read, int flag_write, int flag_exception, int (*callback)(const void *pointer, void *data, int fd), const void *pointer, void *data)
+{
+    struct t_hook *hook = _wec_bench_weechat_hook_new(WEC_BENCH_HOOK_FD, pointer, data);
+    hook->fd.fd = fd;
+    hook->fd.read = flag_read;
+    hook->fd.write = flag_write;
+    hook->fd.callback = callback;
+    return hook;
+}
+
+static struct t_hook *
+_wec_bench_weechat_hook_timer(struct t_weechat_plugin *plugin, long interval, int align_second, int max_calls, int (*callback)(const void *pointer, void *data, int remaining_calls), const void *pointer, void *data)
+{
+    struct t_hook *hook = _wec_bench_weechat_hook_new(WEC_BENCH_HOOK_TIMER, pointer, data);
+    hook->timer.interval = (gint64) interval * 1000;
+    hook->timer.next = g_get_monotonic_time() + hook->timer.interval;
+    hook->timer.remaining = ( max_calls > 0 ) ? max_calls : -1;
+    hook->timer.callback = callback;
+    return hook;
+}
+
+static struct t_hook *
+_wec_bench_weechat_hook_command(struct t_weechat_plugin *plugin, const char *command, const char *description, const char *args, const char *args_description, const char *completion, int (*callback)(const void *pointer, void *data, struct t_gui_buffer *buffer, int argc, char **argv, char **argv_eol), const void *pointer, void *data)
+{
+    return _wec_bench_weechat_hook_new(WEC_BENCH_HOOK_COMMAND, pointer, data);
+}
+
+static const char *
+_wec_bench_weechat_prefix(const char *prefix)
+{
+    return "";
+}
+
+static void
+_wec_bench_weechat_vprintf(const char *message, va_list args)
+{
+    fputs("weechat: ", stderr);
+    vfprintf(stderr, message, args);
+    fputc('\n', stderr);
+}
+
+#ifdef WEC_BENCH_PRINTF_DATETIME_TAGS
+static void
+_wec_bench_weechat_printf_datetime_tags(struct t_gui_buffer *buffer, time_t date, int date_usec, const char *tags, const char *message, ...)
+{
+    va_list args;
+    va_start(args, message);
+    _wec_bench_weechat_vprintf(message, args);
+    va_end(args);
+}
+#endif /* WEC_BENCH_PRINTF_DATETIME_TAGS */
+
+#ifdef WEC_BENCH_PRINTF_DATE_TAGS
+static void
+_wec_bench_weechat_printf_date_tags(struct t_gui_buffer *buffer, time_t date, const char *tags, const char *message, ...)
+{
+    va_list args;
+    va_start(args, message);
+    _wec_bench_weechat_vprintf(message, args);
+    va_end(args);
+}
+#endif /* WEC_BENCH_PRINTF_DATE_TAGS */
+
+static struct t_gui_buffer *
+_wec_bench_weechat_buffer_search(const char *plugin, const char *name)
+{
+    return NULL;
+}
+
+static const char *
+_wec_bench_weechat_buffer_get_string(struct t_gui_buffer *buffer, const char *property)
+{
+    if ( strcmp(property, "plugin") == 0 )
+        return buffer->plugin;
+    if ( strcmp(property, "localvar_type") == 0 )
+        return buffer->type;
+    if ( strcmp(property, "localvar_server") == 0 )
+        return buffer->server;
+    if ( strcmp(property, "localvar_channel") == 0 )
+        return buffer->channel;
+    return NULL;
+}
+
+static struct t_hdata *
+_wec_bench_weechat_hdata_get(struct t_weechat_plugin *plugin, const char *hdata_name)
+{
+    return NULL;
+}
+
+static char *
+_wec_bench_weechat_string_eval_path_home(const char *path, struct t_hashtable *pointers, struct t_hashtable *extra_vars, struct t_hashtable *options)
+{
+    const gchar *home = "";
+    if ( strncmp(path, "%h", strlen("%h")) == 0 )
+    {
+        home = _wec_bench_weechat.home;
+        path += strlen("%h");
+    }
+
+    /* The plugin frees it with free() */
+    gsize size = strlen(home) + strlen(path) + 1;
+    char *r = malloc(size);
+    snprintf(r, size, "%s%s", home, path);
+    return r;
+}
+
+static struct t_config_file *
+_wec_bench_weechat_config_new(struct t_weechat_plugin *plugin, const char *name, int (*callback_reload)(const void *pointer, void *data, struct t_config_file *config_file), const void *callback_reload_pointer, void *callback_reload_data)
+{
+    struct t_config_file *file;
+
+    file = g_new0(struct t_config_file, 1);
+    file->name = g_strdup(name);
+    g_ptr_array_add(_wec_bench_weechat.config, file);
+
+    return file;
+}
+
+static struct t_config_section *
+_wec_bench_weechat_config_new_section(struct t_config_file *config_file, const char *name, int user_can_add_options, int user_can_delete_options, int (*callback_read)(const void *pointer, void *data, struct t_config_file *config_file, struct t_config_section *section, const char *option_name, const char *value), const void *callback_read_pointer, void *callback_read_data, int (*callback_write)(const void *pointer, void *data, struct t_config_file *config_file, const char *section_name), const void *callback_write_pointer, void *callback_write_data, int (*callback_write_default)(const void *pointer, void *data, struct t_config_file *config_file, const char *section_name), const void *callback_write_default_pointer, void *callback_write_default_data, int (*callback_create_option)(const void *pointer, void *data, struct t_config_file *config_file, struct t_config_section *section, const char *option_name, const char *value), const void *callback_create_option_pointer, void *callback_create_option_data, int (*callback_delete_option)(const void *pointer, void *data, struct t_config_file *config_file, struct t_config_section *section, struct t_config_option *option), const void *callback_delete_option_pointer, void *callback_delete_option_data)
+{
+    struct t_config_section *section;
+
+    section = g_new0(struct t_config_section, 1);
+    section->file = config_file;
+    section->name = g_strdup(name);
+    g_ptr_array_add(_wec_bench_weechat.config, section);
+
+    return section;
+}
+
+static struct t_config_option *
+_wec_bench_weechat_config_new_option(struct t_config_file *config_file, struct t_config_section *section, const char *name, const char *type, const char *description, const char *string_values, int min, int max, const char *default_value, const char *value, int null_value_allowed, int (*callback_check_value)(const void *pointer, void *data, struct t_config_option *option, const char *value), const void *callback_check_value_pointer, void *callback_check_value_data, void (*callback_change)(const void *pointer, void *data, struct t_config_option *option), const void *callback_change_pointer, void *callback_change_data, void (*callback_delete)(const void *pointer, void *data, struct t_config_option *option), const void *callback_delete_pointer, void *callback_delete_data)
+{
+    struct t_config_option *option;
+
+    option = g_new0(struct t_config_option, 1);
+    g_ptr_array_add(_wec_bench_weechat.config, option);
+
+    if ( value == NULL )
+        value = default_value;
+
+    /* Options from the command line, as section.option=value */
+    gchar *full_name = g_strdup_printf("%s.%s=", section->name, name);
+    gchar **o;
+    for ( o = _wec_bench_weechat.options ; ( o != NULL ) && ( *o != NULL ) ; ++o )
+    {
+        if ( g_str_has_prefix(*o, full_name) )
+            value = *o + strlen(full_name);
+    }
+    g_free(full_name);
+
+    option->value = g_strdup(value);
+    option->boolean = ( g_strcmp0(value, "on") == 0 ) || ( g_strcmp0(value, "true") == 0 );
+    option->integer = ( value != NULL ) ? strtol(value, NULL, 10) : 0;
+    if ( ( string_values != NULL ) && ( *string_values != '\0' ) )
+    {
+        gchar **values = g_strsplit(string_values, "|", -1);
+        gint i;
+        for ( i = 0 ; values[i] != NULL ; ++i )
+        {
+            if ( g_strcmp0(values[i], value) == 0 )
+                option->integer = i;
+        }
+        g_strfreev(values);
+    }
+
+    return option;
+}
+
+/* No callback, the plugin processes its options after reading them */
+static int
+_wec_bench_weechat_config_option_set(struct t_config_option *option, const char *value, int run_callback)
+{
+    g_free(option->value);
+    option->value = g_strdup(value);
+    option->boolean = ( g_strcmp0(value, "on") == 0 ) || ( g_strcmp0(value, "true") == 0 );
+    option->integer = ( value != NULL ) ? strtol(value, NULL, 10) : 0;
+
+    return WEECHAT_CONFIG_OPTION_SET_OK_CHANGED;
+}
+
+static int
+_wec_bench_weechat_config_read(struct t_config_file *config_file)
+{
+    return WEECHAT_CONFIG_READ_OK;
+}
+
+static int
+_wec_bench_weechat_config_write(struct t_config_file *config_file)
+{
+    return WEECHAT_CONFIG_WRITE_OK;
+}
+
+static void
+_wec_bench_weechat_config_free(struct t_config_file *config_file)
+{
+}
+
+static int
+_wec_bench_weechat_config_boolean(struct t_config_option *option)
+{
+    return option->boolean;
+}
+
+static int
+_wec_bench_weechat_config_integer(struct t_config_option *option)
+{
+    return option->integer;
+}
+
+static const char *
+_wec_bench_weechat_config_string(struct t_config_option *option)
+{
+    return option->value;
+}
+
+static void
+_wec_bench_weechat_config_item_free(gpointer data)
+{
+    /* Files, sections and options all start with their string */
+    gchar **item = data;
+    g_free(*item);
+    g_free(item);
+}
+
+static void
+_wec_bench_weechat_buffer_free(gpointer data)
+{
+    struct t_gui_buffer *buffer = data;
+
+    g_free(buffer->plugin);
+    g_free(buffer->type);
+    g_free(buffer->server);
+    g_free(buffer->channel);
+    g_free(buffer);
+}
+
+struct t_weechat_plugin *
+wec_bench_weechat_new(const gchar *home, gchar **options)
+{
+    struct t_weechat_plugin *plugin = &_wec_bench_weechat.plugin;
+
+    _wec_bench_weechat.home = g_strdup(home);
+    _wec_bench_weechat.options = g_strdupv(options);
+    _wec_bench_weechat.hooks = g_ptr_array_new_with_free_func(_wec_bench_weechat_hook_free);
+    _wec_bench_weechat.buffers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, _wec_bench_weechat_buffer_free);
+    _wec_bench_weechat.config = g_ptr_array_new_with_free_func(_wec_bench_weechat_config_item_free);
+
+    plugin->hook_print = _wec_bench_weechat_hook_print;
+    plugin->hook_signal = _wec_bench_weechat_hook_signal;
+    plugin->hook_fd = _wec_bench_weechat_hook_fd;
+    plugin->hook_timer = _wec_bench_weechat_hook_timer;
+    plugin->hook_command = _wec_bench_weechat_hook_command;
+    plugin->unhook = _wec_bench_weechat_unhook;
+    plugin->prefix = _wec_bench_weechat_prefix;
+#ifdef WEC_BENCH_PRINTF_DATETIME_TAGS
+    plugin->printf_datetime_tags = _wec_bench_weechat_printf_datetime_tags;
+#endif /* WEC_BENCH_PRINTF_DATETIME_TAGS */
+#ifdef WEC_BENCH_PRINTF_DATE_TAGS
+    plugin->printf_date_tags = _wec_bench_weechat_printf_date_tags;
+#endif /* WEC_BENCH_PRINTF_DATE_TAGS */
+    plugin->buffer_search = _wec_bench_weechat_buffer_search;
+    plugin->buffer_get_string = _wec_bench_weechat_buffer_get_string;
+    plugin->hdata_get = _wec_bench_weechat_hdata_get;
+    plugin->string_eval_path_home = _wec_bench_weechat_string_eval_path_home;
+    plugin->config_new = _wec_bench_weechat_config_new;
+    plugin->config_new_section = _wec_bench_weechat_config_new_section;
+    plugin->config_new_option = _wec_bench_weechat_config_new_option;
+    plugin->config_option_set = _wec_bench_weechat_config_option_set;
+    plugin->config_read = _wec_bench_weechat_config_read;
+    plugin->config_write = _wec_bench_weechat_config_write;
+    plugin->config_free = _wec_bench_weechat_config_free;
+    plugin->config_boolean = _wec_bench_weechat_config_boolean;
+    plugin->config_integer = _wec_bench_weechat_config_integer;
+    plugin->config_string = _wec_bench_weechat_config_string;
+
+    return plugin;
+}
+
+void
+wec_bench_weechat_free(struct t_weechat_plugin *plugin)
+{
+    g_ptr_array_unref(_wec_bench_weechat.config);
+    g_hash_table_unref(_wec_bench_weechat.buffers);
+    g_ptr_array_unref(_wec_bench_weechat.hooks);
+    g_strfreev(_wec_bench_weechat.options);
+    g_free(_wec_bench_weechat.home);
+}
+
+/*
+ * spec is plugin:type:server:channel, e.g. irc:channel:libera:#weechat
+ */
+struct t_gui_buffer *
+wec_bench_weechat_buffer(const gchar *spec)
+{
+    struct t_gui_buffer *buffer;
+
+    buffer = g_hash_table_lookup(_wec_bench_weechat.buffers, spec);
+    if ( buffer != NULL )
+        return buffer;
+
+    gchar **s = g_strsplit(spec, ":", 4);
+    buffer = g_new0(struct t_gui_buffer, 1);
+    if ( s[0] != NULL )
+    {
+        buffer->plugin = g_strdup(s[0]);
+        if ( s[1] != NULL )
+        {
+            buffer->type = g_strdup(s[1]);
+            if ( s[2] != NULL )
+            {
+                buffer->server = g_strdup(s[2]);
+                buffer->channel = g_strdup(s[3]);
+            }
+        }
+    }
+    g_strfreev(s);
+
+    g_hash_table_insert(_wec_bench_weechat.buffers, g_strdup(spec), buffer);
+
+    return buffer;
+}
+
+static gboolean
+_wec_bench_weechat_print_match(struct t_hook *hook, gint tags_count, const gchar **tags)
+{
+    if ( hook->print.tags == NULL )
+        return TRUE;
+
+    gchar ***group;
+    for ( group = hook->print.tags ; *group != NULL ; ++group )
+    {
+        gboolean match = TRUE;
+        gchar **tag;
+        for ( tag = *group ; match && ( *tag != NULL ) ; ++tag )
+        {
+            gint i;
+            match = FALSE;
+            for ( i = 0 ; ( ! match ) && ( i < tags_count ) ; ++i )
+                match = g_pattern_match_simple(*tag, tags[i]);
+        }
+        if ( match )
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+void
+wec_bench_weechat_print(struct t_gui_buffer *buffer, time_t date, gint tags_count, const gchar **tags, gboolean displayed, gboolean highlight, const gchar *prefix, const gchar *message)
+{
+    guint i, length = _wec_bench_weechat.hooks->len;
+
+    _wec_bench_weechat.iterating = TRUE;
+    for ( i = 0 ; i < length ; ++i )
+    {
+        struct t_hook *hook = g_ptr_array_index(_wec_bench_weechat.hooks, i);
+        if ( ( hook->type != WEC_BENCH_HOOK_PRINT ) || hook->dead || ( ! _wec_bench_weechat_print_match(hook, tags_count, tags) ) )
+            continue;
+
+        hook->print.callback(hook->pointer, hook->data, buffer, date, tags_count, tags, displayed, highlight, prefix, message);
+    }
+    _wec_bench_weechat.iterating = FALSE;
+    _wec_bench_weechat_collect();
+}
+
+void
+wec_bench_weechat_iterate(gint timeout)
+{
+    GArray *fds = g_array_new(FALSE, FALSE, sizeof(struct pollfd));
+    GPtrArray *fd_hooks = g_ptr_array_new();
+    gint64 now = g_get_monotonic_time();
+    guint i, length = _wec_bench_weechat.hooks->len;
+
+    _wec_bench_weechat.iterating = TRUE;
+
+    for ( i = 0 ; i < length ; ++i )
+    {
+        struct t_hook *hook = g_ptr_array_index(_wec_bench_weechat.hooks, i);
+        if ( hook->dead )
+            continue;
+
+        switch ( hook->type )
+        {
+        case WEC_BENCH_HOOK_FD:
+        {
+            struct pollfd pfd = { .fd = hook->fd.fd };
+            if ( hook->fd.read )
+                pfd.events |= POLLIN;
+            if ( hook->fd.write )
+                pfd.events |= POLLOUT;
+            g_array_append_val(fds, pfd);
+            g_ptr_array_add(fd_hooks, hook);
+        }
+        break;
+        case WEC_BENCH_HOOK_TIMER:
+        {
+            gint64 delay = ( hook->timer.next - now ) / 1000;
+            if ( delay < 0 )
+                delay = 0;
+            if ( ( timeout < 0 ) || ( delay < timeout ) )
+                timeout = delay;
+        }
+        break;
+        default:
+        break;
+        }
+    }
+
+    if ( ( poll((struct pollfd *) fds->data, fds->len, timeout) > 0 ) )
+    {
+        for ( i = 0 ; i < fds->len ; ++i )
+        {
+            struct pollfd *pfd = &g_array_index(fds, struct pollfd, i);
+            struct t_hook *hook = g_ptr_array_index(fd_hooks, i);
+            if ( ( pfd->revents != 0 ) && ( ! hook->dead ) )
+                hook->fd.callback(hook->pointer, hook->data, hook->fd.fd);
+        }
+    }
+
+    now = g_get_monotonic_time();
+    for ( i = 0 ; i < length ; ++i )
+    {
+        struct t_hook *hook = g_ptr_array_index(_wec_bench_weechat.hooks, i);
+        if ( ( hook->type != WEC_BENCH_HOOK_TIMER ) || hook->dead || ( hook->timer.next > now ) )
+            continue;
+
+        if ( hook->timer.remaining > 0 )
+            --hook->timer.remaining;
+        hook->timer.next = now + hook->timer.interval;
+        hook->timer.callback(hook->pointer, hook->data, hook->timer.remaining);
+
+        /* Like WeeChat, the last call removes the hook */
+        if ( hook->timer.remaining == 0 )
+            hook->dead = TRUE;
+    }
+
+    _wec_bench_weechat.iterating = FALSE;
+    _wec_bench_weechat_collect();
+
+    g_ptr_array_free(fd_hooks, TRUE);
+    g_array_free(fds, TRUE);
+}
+
+gboolean
+wec_bench_weechat_is_writing(void)
+{
+    guint i;
+    for ( i = 0 ; i < _wec_bench_weechat.hooks->len ; ++i )
+    {
+        struct t_hook *hook = g_ptr_array_index(_wec_bench_weechat.hooks, i);
+        if ( ( hook->type == WEC_BENCH_HOOK_FD ) && hook->fd.write && ( ! hook->dead ) )
+            return TRUE;
+    }
+    return FALSE;
+}
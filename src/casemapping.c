@@ -0,0 +1,89 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include "casemapping.h"
+
+static guchar _wec_casemapping_tables[_WEC_CASEMAPPING_SIZE][256];
+static gboolean _wec_casemapping_tables_ready = FALSE;
+
+static void
+_wec_casemapping_init(void)
+{
+    guint m, c;
+
+    for ( m = 0 ; m < _WEC_CASEMAPPING_SIZE ; ++m )
+    {
+        guchar *table = _wec_casemapping_tables[m];
+        for ( c = 0 ; c < 256 ; ++c )
+            table[c] = ( ( c >= 'A' ) && ( c <= 'Z' ) ) ? ( c - 'A' + 'a' ) : c;
+
+        switch ( (WecCasemapping) m )
+        {
+        case WEC_CASEMAPPING_RFC1459:
+            table['~'] = '^';
+            /* fallthrough */
+        case WEC_CASEMAPPING_STRICT_RFC1459:
+            table['['] = '{';
+            table[']'] = '}';
+            table['\\'] = '|';
+        break;
+        case WEC_CASEMAPPING_ASCII:
+        case _WEC_CASEMAPPING_SIZE:
+        break;
+        }
+    }
+
+    _wec_casemapping_tables_ready = TRUE;
+}
+
+/*
+ * A byte to byte table, so a string is folded in a single pass,
+ * possibly while matching it
+ */
+const guchar *
+wec_casemapping_get_table(WecCasemapping casemapping)
+{
+    if ( G_UNLIKELY(! _wec_casemapping_tables_ready) )
+        _wec_casemapping_init();
+
+    if ( casemapping >= _WEC_CASEMAPPING_SIZE )
+        casemapping = WEC_CASEMAPPING_RFC1459;
+
+    return _wec_casemapping_tables[casemapping];
+}
+
+gchar *
+wec_casemapping_fold(WecCasemapping casemapping, const gchar *string)
+{
+    const guchar *table = wec_casemapping_get_table(casemapping);
+    gchar *folded, *c;
+
+    folded = g_strdup(string);
+    for ( c = folded ; *c != '\0' ; ++c )
+        *c = table[(guchar) *c];
+
+    return folded;
+}
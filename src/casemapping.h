@@ -0,0 +1,37 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __WEECHAT_EVENTC_CASEMAPPING_H__
+#define __WEECHAT_EVENTC_CASEMAPPING_H__
+
+/* Same values as the irc plugin "casemapping" server variable */
+typedef enum {
+    WEC_CASEMAPPING_RFC1459,
+    WEC_CASEMAPPING_STRICT_RFC1459,
+    WEC_CASEMAPPING_ASCII,
+    _WEC_CASEMAPPING_SIZE
+} WecCasemapping;
+
+const guchar *wec_casemapping_get_table(WecCasemapping casemapping);
+gchar *wec_casemapping_fold(WecCasemapping casemapping, const gchar *string);
+
+#endif /* __WEECHAT_EVENTC_CASEMAPPING_H__ */
@@ -0,0 +1,536 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <glib.h>
+
+#include <libeventd-event.h>
+#include <libeventd-protocol.h>
+
+#include "queue.h"
+#include "encoder.h"
+
+/*
+ * Events are written straight to a scratch buffer, in the same format
+ * libeventd generates, and copied once in the outbound message.
+ * We check at creation that we agree with libeventd on a few probes and
+ * go through it otherwise.
+ */
+
+#define WEC_ENCODER_UUID_SIZE 36
+
+struct _WecEncoder {
+    EventdProtocol *protocol;
+    gboolean direct;
+    GString *buffer;
+    EventdEvent *event;
+};
+
+static const gchar * const _wec_encoder_probes[] = {
+    "",
+    "probe",
+    "it's",
+    "say \"hi\" and 'bye'",
+    "back\\slash\ttab\nnew line\r\a\b\f\v",
+    "caf\xc3\xa9 \xe2\x98\x83 \x01 \xf0\x9f\x98\x80 \xc2\x85",
+};
+
+static const gchar _wec_encoder_hex[] = "0123456789abcdef";
+
+static void
+_wec_encoder_append_hex(GString *buffer, guint32 value, guint digits)
+{
+    while ( digits-- > 0 )
+        g_string_append_c(buffer, _wec_encoder_hex[( value >> ( digits * 4 ) ) & 0xf]);
+}
+
+static void
+_wec_encoder_append_uuid(GString *buffer)
+{
+    guint32 r[4] = { g_random_int(), g_random_int(), g_random_int(), g_random_int() };
+
+    /* Version 4, variant 1 */
+    r[1] = ( r[1] & 0xffff0fff ) | 0x00004000;
+    r[2] = ( r[2] & 0x3fffffff ) | 0x80000000;
+
+    _wec_encoder_append_hex(buffer, r[0], 8);
+    g_string_append_c(buffer, '-');
+    _wec_encoder_append_hex(buffer, r[1] >> 16, 4);
+    g_string_append_c(buffer, '-');
+    _wec_encoder_append_hex(buffer, r[1], 4);
+    g_string_append_c(buffer, '-');
+    _wec_encoder_append_hex(buffer, r[2] >> 16, 4);
+    g_string_append_c(buffer, '-');
+    _wec_encoder_append_hex(buffer, r[2], 4);
+    _wec_encoder_append_hex(buffer, r[3], 8);
+}
+
+#define WEC_ENCODER_ELLIPSIS "\xe2\x80\xa6"
+#define WEC_ENCODER_ELLIPSIS_SIZE ( sizeof(WEC_ENCODER_ELLIPSIS) - 1 )
+
+/*
+ * Eight bytes at a time tests, see "Bit Twiddling Hacks"
+ * These only tell whether a byte matches, not which one
+ */
+#define WEC_ENCODER_ONES G_GUINT64_CONSTANT(0x0101010101010101)
+#define WEC_ENCODER_HIGHS G_GUINT64_CONSTANT(0x8080808080808080)
+#define _wec_encoder_has_below(v, n) ( ( (v) - WEC_ENCODER_ONES * (n) ) & ~(v) & WEC_ENCODER_HIGHS )
+#define _wec_encoder_has_byte(v, c) _wec_encoder_has_below((v) ^ ( WEC_ENCODER_ONES * (guchar) (c) ), 1)
+
+/*
+ * Printable ASCII needing no escaping, nor stripping
+ */
+static inline gboolean
+_wec_encoder_is_plain(guint64 v, gchar quote)
+{
+    return ! ( ( v & WEC_ENCODER_HIGHS ) | _wec_encoder_has_below(v, 0x20) | _wec_encoder_has_byte(v, 0x7f) | _wec_encoder_has_byte(v, '\\') | _wec_encoder_has_byte(v, quote) );
+}
+
+static gboolean
+_wec_encoder_is_digits(const gchar *p, const gchar *end, gsize n, gboolean hex)
+{
+    if ( (gsize) ( end - p ) < n )
+        return FALSE;
+    while ( n-- > 0 )
+    {
+        if ( ! ( hex ? g_ascii_isxdigit(p[n]) : g_ascii_isdigit(p[n]) ) )
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+ * WeeChat color number, after optional attributes: "NN" or "@NNNNN"
+ */
+static const gchar *
+_wec_encoder_skip_color(const gchar *p, const gchar *end)
+{
+    while ( ( p < end ) && ( memchr("*!/_|", *p, 5) != NULL ) )
+        ++p;
+    if ( ( p < end ) && ( *p == '@' ) )
+        return _wec_encoder_is_digits(p + 1, end, 5, FALSE) ? ( p + 6 ) : ( p + 1 );
+    return _wec_encoder_is_digits(p, end, 2, FALSE) ? ( p + 2 ) : p;
+}
+
+/*
+ * Returns the end of the formatting code at p, or p if there is none
+ *
+ * WeeChat codes follow gui_color_decode(), IRC ones are what is left
+ * when the IRC plugin does not convert them
+ */
+static const gchar *
+_wec_encoder_skip_formatting(const gchar *p, const gchar *end)
+{
+    const gchar *c = p + 1;
+
+    switch ( *p )
+    {
+    case '\x19':
+        if ( c == end )
+            return c;
+        switch ( *c )
+        {
+        case 'F':
+        case 'B':
+            return _wec_encoder_skip_color(c + 1, end);
+        case '*':
+            c = _wec_encoder_skip_color(c + 1, end);
+            if ( ( c < end ) && ( ( *c == ',' ) || ( *c == '~' ) ) )
+                c = _wec_encoder_skip_color(c + 1, end);
+            return c;
+        case '@':
+            return _wec_encoder_skip_color(c, end);
+        case 'E':
+        case '\x1c':
+            return c + 1;
+        case 'b':
+            ++c;
+            if ( ( c < end ) && ( memchr("FDB_/-#il", *c, 9) != NULL ) )
+                ++c;
+            return c;
+        default:
+            return _wec_encoder_is_digits(c, end, 2, FALSE) ? ( c + 2 ) : c;
+        }
+    case '\x1a':
+    case '\x1b':
+        return ( c < end ) ? ( c + 1 ) : c;
+    case '\x1c':
+    case '\x02':
+    case '\x0f':
+    case '\x11':
+    case '\x16':
+    case '\x1d':
+    case '\x1e':
+    case '\x1f':
+        return c;
+    case '\x03':
+        if ( _wec_encoder_is_digits(c, end, 1, FALSE) )
+        {
+            c += _wec_encoder_is_digits(c, end, 2, FALSE) ? 2 : 1;
+            if ( ( c < end ) && ( *c == ',' ) && _wec_encoder_is_digits(c + 1, end, 1, FALSE) )
+                c += _wec_encoder_is_digits(c + 1, end, 2, FALSE) ? 3 : 2;
+        }
+        return c;
+    case '\x04':
+        if ( _wec_encoder_is_digits(c, end, 6, TRUE) )
+        {
+            c += 6;
+            if ( ( c < end ) && ( *c == ',' ) && _wec_encoder_is_digits(c + 1, end, 6, TRUE) )
+                c += 7;
+        }
+        return c;
+    }
+
+    return p;
+}
+
+/*
+ * Characters drawn on the previous one: combining marks, variation
+ * selectors, skin tones, and whatever follows a zero-width joiner
+ */
+static gboolean
+_wec_encoder_is_extend(gunichar c)
+{
+    return g_unichar_ismark(c) || ( c == 0x200d ) || ( ( c >= 0x1f3fb ) && ( c <= 0x1f3ff ) );
+}
+
+/*
+ * Appends a string in one pass: strips formatting (if strip), replaces
+ * invalid UTF-8, escapes like g_variant_print() (if quote is not 0)
+ * and cuts at max_size bytes or max_length characters (0 for no limit)
+ * with an ellipsis
+ *
+ * Limits count the text, not its escaping, and characters are counted
+ * with what is drawn on them, so we never cut in between
+ */
+static void
+_wec_encoder_append_string(GString *buffer, const gchar *value, gsize length, gchar quote, gboolean strip, gsize max_size, gsize max_length)
+{
+    const gchar *end = value + length;
+    gsize size = 0, count = 0;
+    gboolean joined = FALSE;
+
+    if ( max_size == 0 )
+        max_size = G_MAXSIZE;
+    if ( max_length == 0 )
+        max_length = G_MAXSIZE;
+
+    /* Where we cut, the text up to there and the ellipsis fit */
+    gsize cut = buffer->len;
+    gsize cut_size = ( max_size > WEC_ENCODER_ELLIPSIS_SIZE ) ? ( max_size - WEC_ENCODER_ELLIPSIS_SIZE ) : 0;
+    gsize cut_length = max_length - 1;
+
+    while ( value < end )
+    {
+        /* Plain ASCII, as far as we can while surely under the limits */
+        const gchar *run = value;
+        while ( ( ( end - run ) >= 8 ) && ( ( size + ( run - value ) + 8 ) <= cut_size ) && ( ( count + ( run - value ) + 8 ) <= cut_length ) )
+        {
+            guint64 v;
+            memcpy(&v, run, sizeof(v));
+            if ( ! _wec_encoder_is_plain(v, quote) )
+                break;
+            run += 8;
+        }
+        if ( run > value )
+        {
+            g_string_append_len(buffer, value, run - value);
+            size += run - value;
+            count += run - value;
+            value = run;
+            cut = buffer->len;
+            joined = FALSE;
+            continue;
+        }
+
+        if ( strip )
+        {
+            const gchar *next = _wec_encoder_skip_formatting(value, end);
+            if ( next != value )
+            {
+                value = next;
+                continue;
+            }
+        }
+
+        const gchar *text = value;
+        gsize text_size;
+        gsize next_size;
+        gunichar c = g_utf8_get_char_validated(value, end - value);
+        if ( c >= (gunichar) -2 )
+        {
+            /* Invalid UTF-8, one replacement character per byte */
+            c = 0xfffd;
+            text = "\xef\xbf\xbd";
+            text_size = 3;
+            next_size = 1;
+        }
+        else
+            text_size = next_size = g_utf8_next_char(value) - value;
+
+        if ( ! ( joined || _wec_encoder_is_extend(c) ) )
+        {
+            if ( ( size <= cut_size ) && ( count <= cut_length ) )
+                cut = buffer->len;
+            ++count;
+        }
+        joined = ( c == 0x200d );
+        size += text_size;
+
+        if ( ( size > max_size ) || ( count > max_length ) )
+        {
+            g_string_truncate(buffer, cut);
+            g_string_append(buffer, WEC_ENCODER_ELLIPSIS);
+            return;
+        }
+        value += next_size;
+
+        if ( quote == '\0' )
+        {
+            g_string_append_len(buffer, text, text_size);
+            continue;
+        }
+
+        if ( ( c == (gunichar) quote ) || ( c == '\\' ) )
+            g_string_append_c(buffer, '\\');
+
+        if ( g_unichar_isprint(c) )
+        {
+            g_string_append_len(buffer, text, text_size);
+            continue;
+        }
+
+        g_string_append_c(buffer, '\\');
+        switch ( c )
+        {
+        case '\a': g_string_append_c(buffer, 'a'); break;
+        case '\b': g_string_append_c(buffer, 'b'); break;
+        case '\f': g_string_append_c(buffer, 'f'); break;
+        case '\n': g_string_append_c(buffer, 'n'); break;
+        case '\r': g_string_append_c(buffer, 'r'); break;
+        case '\t': g_string_append_c(buffer, 't'); break;
+        case '\v': g_string_append_c(buffer, 'v'); break;
+        default:
+            if ( c < 0x10000 )
+            {
+                g_string_append_c(buffer, 'u');
+                _wec_encoder_append_hex(buffer, c, 4);
+            }
+            else
+            {
+                g_string_append_c(buffer, 'U');
+                _wec_encoder_append_hex(buffer, c, 8);
+            }
+        break;
+        }
+    }
+}
+
+/*
+ * Same quoting and escaping as g_variant_print() for a string
+ *
+ * The quote is picked on the whole value, so if we cut the only "'"
+ * we quote with '"' where GLib would not: it still parses the same
+ */
+static void
+_wec_encoder_append_value(GString *buffer, const gchar *value, gsize length, gboolean strip, gsize max_size, gsize max_length)
+{
+    gchar quote = ( memchr(value, '\'', length) != NULL ) ? '"' : '\'';
+
+    g_string_append_c(buffer, quote);
+    _wec_encoder_append_string(buffer, value, length, quote, strip, max_size, max_length);
+    g_string_append_c(buffer, quote);
+}
+
+static void
+_wec_encoder_append_header(GString *buffer, const gchar *uuid, const gchar *category, const gchar *name)
+{
+    g_string_append(buffer, "EVENT ");
+    if ( uuid != NULL )
+        g_string_append(buffer, uuid);
+    else
+        _wec_encoder_append_uuid(buffer);
+    g_string_append_c(buffer, ' ');
+    g_string_append(buffer, category);
+    g_string_append_c(buffer, ' ');
+    g_string_append(buffer, name);
+    g_string_append_c(buffer, '\n');
+}
+
+static void
+_wec_encoder_append_data(GString *buffer, const gchar *key, const gchar *value, gsize length, gboolean strip, gsize max_size, gsize max_length)
+{
+    g_string_append(buffer, "DATA ");
+    g_string_append(buffer, key);
+    g_string_append_c(buffer, ' ');
+    _wec_encoder_append_value(buffer, value, length, strip, max_size, max_length);
+    g_string_append_c(buffer, '\n');
+}
+
+static gboolean
+_wec_encoder_probe(WecEncoder *self, const gchar *value)
+{
+    EventdEvent *event = eventd_event_new("eventc", "probe");
+    eventd_event_add_data_string(event, g_strdup("probe"), g_strdup(value));
+
+    gchar *expected = eventd_protocol_generate_event(self->protocol, event);
+    const gchar *uuid = eventd_event_get_uuid(event);
+
+    g_string_truncate(self->buffer, 0);
+    if ( ( uuid != NULL ) && ( strlen(uuid) == WEC_ENCODER_UUID_SIZE ) )
+    {
+        _wec_encoder_append_header(self->buffer, uuid, "eventc", "probe");
+        _wec_encoder_append_data(self->buffer, "probe", value, strlen(value), FALSE, 0, 0);
+        g_string_append(self->buffer, ".\n");
+    }
+
+    gboolean r = ( g_strcmp0(expected, self->buffer->str) == 0 );
+
+    g_free(expected);
+    eventd_event_unref(event);
+
+    return r;
+}
+
+WecEncoder *
+wec_encoder_new(EventdProtocol *protocol)
+{
+    WecEncoder *self;
+
+    self = g_slice_new0(WecEncoder);
+    self->protocol = protocol;
+    self->buffer = g_string_sized_new(512);
+
+    self->direct = TRUE;
+    gsize i;
+    for ( i = 0 ; self->direct && ( i < G_N_ELEMENTS(_wec_encoder_probes) ) ; ++i )
+        self->direct = _wec_encoder_probe(self, _wec_encoder_probes[i]);
+
+    if ( ! self->direct )
+        g_debug("Events format differs from libeventd, generating them through libeventd");
+
+    return self;
+}
+
+void
+wec_encoder_free(WecEncoder *self)
+{
+    if ( self->event != NULL )
+        eventd_event_unref(self->event);
+    g_string_free(self->buffer, TRUE);
+
+    g_slice_free(WecEncoder, self);
+}
+
+gboolean
+wec_encoder_is_direct(const WecEncoder *self)
+{
+    return self->direct;
+}
+
+void
+wec_encoder_begin(WecEncoder *self, const gchar *category, const gchar *name)
+{
+    if ( ! self->direct )
+    {
+        if ( self->event != NULL )
+            eventd_event_unref(self->event);
+        self->event = eventd_event_new(category, name);
+        return;
+    }
+
+    g_string_truncate(self->buffer, 0);
+    _wec_encoder_append_header(self->buffer, NULL, category, name);
+}
+
+/*
+ * key must not contain spaces, length can be -1 for a nul-terminated value
+ */
+void
+wec_encoder_add(WecEncoder *self, const gchar *key, const gchar *value, gssize length)
+{
+    if ( length < 0 )
+        length = strlen(value);
+
+    if ( ! self->direct )
+    {
+        eventd_event_add_data_string(self->event, g_strdup(key), g_strndup(value, length));
+        return;
+    }
+
+    _wec_encoder_append_data(self->buffer, key, value, length, FALSE, 0, 0);
+}
+
+/*
+ * Same as wec_encoder_add() for text shown to the user: formatting is
+ * stripped and it is cut at max_size bytes or max_length characters
+ * (0 for no limit), with an ellipsis
+ */
+void
+wec_encoder_add_text(WecEncoder *self, const gchar *key, const gchar *value, gssize length, gsize max_size, gsize max_length)
+{
+    if ( length < 0 )
+        length = strlen(value);
+
+    if ( ! self->direct )
+    {
+        GString *text = g_string_sized_new(MIN((gsize) length, ( max_size > 0 ) ? max_size : G_MAXSIZE));
+        _wec_encoder_append_string(text, value, length, '\0', TRUE, max_size, max_length);
+        eventd_event_add_data_string(self->event, g_strdup(key), g_string_free(text, FALSE));
+        return;
+    }
+
+    _wec_encoder_append_data(self->buffer, key, value, length, TRUE, max_size, max_length);
+}
+
+WecMessage *
+wec_encoder_finish(WecEncoder *self)
+{
+    if ( ! self->direct )
+    {
+        gchar *data = eventd_protocol_generate_event(self->protocol, self->event);
+        eventd_event_unref(self->event);
+        self->event = NULL;
+
+        if ( data == NULL )
+            return NULL;
+        return wec_message_new(data, strlen(data));
+    }
+
+    g_string_append(self->buffer, ".\n");
+    return wec_message_new_copy(self->buffer->str, self->buffer->len);
+}
+
+/*
+ * Appends value to buffer with formatting stripped and invalid UTF-8
+ * replaced, for code that needs to look at the text itself
+ */
+void
+wec_encoder_strip_text(GString *buffer, const gchar *value, gssize length)
+{
+    if ( length < 0 )
+        length = strlen(value);
+
+    _wec_encoder_append_string(buffer, value, length, '\0', TRUE, 0, 0);
+}
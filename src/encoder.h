@@ -0,0 +1,44 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __WEECHAT_EVENTC_ENCODER_H__
+#define __WEECHAT_EVENTC_ENCODER_H__
+
+#include <libeventd-protocol.h>
+
+#include "queue.h"
+
+typedef struct _WecEncoder WecEncoder;
+
+WecEncoder *wec_encoder_new(EventdProtocol *protocol);
+void wec_encoder_free(WecEncoder *encoder);
+
+gboolean wec_encoder_is_direct(const WecEncoder *encoder);
+
+void wec_encoder_begin(WecEncoder *encoder, const gchar *category, const gchar *name);
+void wec_encoder_add(WecEncoder *encoder, const gchar *key, const gchar *value, gssize length);
+void wec_encoder_add_text(WecEncoder *encoder, const gchar *key, const gchar *value, gssize length, gsize max_size, gsize max_length);
+WecMessage *wec_encoder_finish(WecEncoder *encoder);
+
+void wec_encoder_strip_text(GString *buffer, const gchar *value, gssize length);
+
+#endif /* __WEECHAT_EVENTC_ENCODER_H__ */
@@ -0,0 +1,277 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <glib.h>
+
+#include "keywords.h"
+
+/*
+ * All keywords are compiled into one Aho-Corasick automaton, so a message
+ * is scanned once whatever the number of keywords
+ *
+ * Matching is ASCII case-insensitive. Bytes are mapped to classes first,
+ * only those appearing in a keyword get their own, which keeps the
+ * transition table (states × classes) small.
+ * A keyword edge that is a word character must be on a word boundary.
+ */
+
+#define WEC_KEYWORDS_NONE G_MAXUINT32
+
+typedef struct {
+    gchar *text;
+    gsize length;
+    guint64 sets;
+    gboolean word_start;
+    gboolean word_end;
+} WecKeyword;
+
+struct _WecKeywords {
+    GArray *keywords;
+    guint8 classes[256];
+    guint classes_count;
+    /* Complete transitions, classes_count per state */
+    guint32 *table;
+    /* Per state, the keyword ending there or -1 */
+    gint32 *output;
+    /* Per state, the next state on the failure chain with an output, 0 if none */
+    guint32 *dictionary;
+};
+
+/* UTF-8 sequences are part of words */
+static inline gboolean
+_wec_keywords_is_word(gchar c)
+{
+    return g_ascii_isalnum(c) || ( c == '_' ) || ( (guchar) c >= 0x80 );
+}
+
+WecKeywords *
+wec_keywords_new(void)
+{
+    WecKeywords *self;
+
+    self = g_slice_new0(WecKeywords);
+    self->keywords = g_array_new(FALSE, FALSE, sizeof(WecKeyword));
+
+    return self;
+}
+
+static void
+_wec_keywords_reset(WecKeywords *self)
+{
+    g_free(self->dictionary);
+    g_free(self->output);
+    g_free(self->table);
+    self->dictionary = NULL;
+    self->output = NULL;
+    self->table = NULL;
+}
+
+void
+wec_keywords_free(WecKeywords *self)
+{
+    guint i;
+
+    _wec_keywords_reset(self);
+    for ( i = 0 ; i < self->keywords->len ; ++i )
+        g_free(g_array_index(self->keywords, WecKeyword, i).text);
+    g_array_unref(self->keywords);
+
+    g_slice_free(WecKeywords, self);
+}
+
+/*
+ * Needs wec_keywords_compile() afterwards
+ */
+void
+wec_keywords_add(WecKeywords *self, const gchar *keyword, guint set)
+{
+    g_return_if_fail(set < WEC_KEYWORDS_MAX_SETS);
+
+    gsize length = strlen(keyword);
+    if ( length == 0 )
+        return;
+
+    WecKeyword entry = {
+        .text = g_strdup(keyword),
+        .length = length,
+        .sets = G_GUINT64_CONSTANT(1) << set,
+        .word_start = _wec_keywords_is_word(keyword[0]),
+        .word_end = _wec_keywords_is_word(keyword[length - 1]),
+    };
+    g_array_append_val(self->keywords, entry);
+}
+
+void
+wec_keywords_compile(WecKeywords *self)
+{
+    guint i, c;
+    gsize j;
+
+    _wec_keywords_reset(self);
+    if ( self->keywords->len == 0 )
+        return;
+
+    /* Class 0 is for every byte we do not care about */
+    memset(self->classes, 0, sizeof(self->classes));
+    self->classes_count = 1;
+    for ( i = 0 ; i < self->keywords->len ; ++i )
+    {
+        WecKeyword *keyword = &g_array_index(self->keywords, WecKeyword, i);
+        for ( j = 0 ; j < keyword->length ; ++j )
+        {
+            guchar folded = g_ascii_tolower(keyword->text[j]);
+            if ( self->classes[folded] == 0 )
+                self->classes[folded] = self->classes_count++;
+        }
+    }
+    for ( c = 0 ; c < 256 ; ++c )
+        self->classes[c] = self->classes[(guchar) g_ascii_tolower(c)];
+
+    /* The trie, transitions we did not add yet are WEC_KEYWORDS_NONE */
+    guint width = self->classes_count;
+    GArray *table = g_array_new(FALSE, FALSE, sizeof(guint32));
+    GArray *output = g_array_new(FALSE, FALSE, sizeof(gint32));
+    guint32 none = WEC_KEYWORDS_NONE;
+    gint32 no_output = -1;
+    guint32 states = 1;
+
+    for ( c = 0 ; c < width ; ++c )
+        g_array_append_val(table, none);
+    g_array_append_val(output, no_output);
+
+    for ( i = 0 ; i < self->keywords->len ; ++i )
+    {
+        WecKeyword *keyword = &g_array_index(self->keywords, WecKeyword, i);
+        guint32 state = 0;
+
+        for ( j = 0 ; j < keyword->length ; ++j )
+        {
+            guint32 *next = &g_array_index(table, guint32, state * width + self->classes[(guchar) keyword->text[j]]);
+            if ( *next == WEC_KEYWORDS_NONE )
+            {
+                *next = states++;
+                for ( c = 0 ; c < width ; ++c )
+                    g_array_append_val(table, none);
+                g_array_append_val(output, no_output);
+            }
+            state = g_array_index(table, guint32, state * width + self->classes[(guchar) keyword->text[j]]);
+        }
+
+        /* The same keyword for several sets, the first spelling wins */
+        gint32 *out = &g_array_index(output, gint32, state);
+        if ( *out < 0 )
+            *out = i;
+        else
+            g_array_index(self->keywords, WecKeyword, *out).sets |= keyword->sets;
+    }
+
+    self->table = (guint32 *) g_array_free(table, FALSE);
+    self->output = (gint32 *) g_array_free(output, FALSE);
+    self->dictionary = g_new0(guint32, states);
+
+    /*
+     * Breadth-first, so the failure state of a state is always complete
+     * when we get to it, and missing transitions just borrow its own
+     */
+    guint32 *fail = g_new0(guint32, states);
+    guint32 *queue = g_new(guint32, states);
+    guint head = 0, tail = 0;
+
+    for ( c = 0 ; c < width ; ++c )
+    {
+        guint32 next = self->table[c];
+        if ( next == WEC_KEYWORDS_NONE )
+            self->table[c] = 0;
+        else
+            queue[tail++] = next;
+    }
+
+    while ( head < tail )
+    {
+        guint32 state = queue[head++];
+        for ( c = 0 ; c < width ; ++c )
+        {
+            guint32 *next = &self->table[state * width + c];
+            guint32 fallback = self->table[fail[state] * width + c];
+            if ( *next == WEC_KEYWORDS_NONE )
+            {
+                *next = fallback;
+                continue;
+            }
+
+            fail[*next] = fallback;
+            self->dictionary[*next] = ( self->output[fallback] >= 0 ) ? fallback : self->dictionary[fallback];
+            queue[tail++] = *next;
+        }
+    }
+
+    g_free(queue);
+    g_free(fail);
+}
+
+gboolean
+wec_keywords_is_empty(const WecKeywords *self)
+{
+    return ( self->table == NULL );
+}
+
+/*
+ * Returns the keyword of one of the sets ending first in text (the longest
+ * one if several end there), or NULL
+ * A keyword added for several sets is returned with its first spelling
+ */
+const gchar *
+wec_keywords_search(const WecKeywords *self, const gchar *text, gsize length, guint64 sets)
+{
+    guint width = self->classes_count;
+    guint32 state = 0;
+    gsize i;
+
+    if ( self->table == NULL )
+        return NULL;
+
+    for ( i = 0 ; i < length ; ++i )
+    {
+        state = self->table[state * width + self->classes[(guchar) text[i]]];
+
+        guint32 match = ( self->output[state] >= 0 ) ? state : self->dictionary[state];
+        for ( ; match != 0 ; match = self->dictionary[match] )
+        {
+            const WecKeyword *keyword = &g_array_index(self->keywords, WecKeyword, self->output[match]);
+            gsize start = i + 1 - keyword->length;
+
+            if ( ( keyword->sets & sets ) == 0 )
+                continue;
+            if ( keyword->word_start && ( start > 0 ) && _wec_keywords_is_word(text[start - 1]) )
+                continue;
+            if ( keyword->word_end && ( ( i + 1 ) < length ) && _wec_keywords_is_word(text[i + 1]) )
+                continue;
+
+            return keyword->text;
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,40 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __WEECHAT_EVENTC_KEYWORDS_H__
+#define __WEECHAT_EVENTC_KEYWORDS_H__
+
+/* Sets are bits in a guint64 */
+#define WEC_KEYWORDS_MAX_SETS 64
+
+typedef struct _WecKeywords WecKeywords;
+
+WecKeywords *wec_keywords_new(void);
+void wec_keywords_free(WecKeywords *keywords);
+
+void wec_keywords_add(WecKeywords *keywords, const gchar *keyword, guint set);
+void wec_keywords_compile(WecKeywords *keywords);
+
+gboolean wec_keywords_is_empty(const WecKeywords *keywords);
+const gchar *wec_keywords_search(const WecKeywords *keywords, const gchar *text, gsize length, guint64 sets);
+
+#endif /* __WEECHAT_EVENTC_KEYWORDS_H__ */
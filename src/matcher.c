@@ -0,0 +1,328 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <glib.h>
+
+#include "matcher.h"
+
+/*
+ * Glob patterns ('*' and '?') compiled to a single automaton
+ *
+ * All the patterns are laid out in one array of items, a position in this
+ * array being an NFA state. DFA states (sets of positions) are built
+ * lazily, the first time a transition is needed, so matching costs one
+ * table lookup per byte whatever the number of patterns.
+ */
+
+/* Above this, we throw the DFA away and start over */
+#define WEC_MATCHER_MAX_STATES 1024
+
+typedef enum {
+    WEC_MATCHER_ITEM_END,
+    WEC_MATCHER_ITEM_BYTE,
+    WEC_MATCHER_ITEM_ANY,
+    WEC_MATCHER_ITEM_STAR,
+} WecMatcherItemType;
+
+typedef struct {
+    WecMatcherItemType type;
+    guchar byte;
+} WecMatcherItem;
+
+typedef struct {
+    gboolean accept;
+    gboolean dead;
+    gint32 next[256];
+    gsize nwords;
+    guint64 bits[];
+} WecMatcherState;
+
+struct _WecMatcher {
+    GArray *items;
+    GArray *starts;
+    GPtrArray *states;
+    GHashTable *index;
+    guint generation;
+    gint32 start;
+};
+
+static guint
+_wec_matcher_state_hash(gconstpointer key)
+{
+    const WecMatcherState *state = key;
+    guint hash = 5381;
+    gsize i;
+
+    for ( i = 0 ; i < state->nwords ; ++i )
+        hash = hash * 33 + (guint) ( state->bits[i] ^ ( state->bits[i] >> 32 ) );
+
+    return hash;
+}
+
+static gboolean
+_wec_matcher_state_equal(gconstpointer a, gconstpointer b)
+{
+    const WecMatcherState *sa = a, *sb = b;
+
+    return ( memcmp(sa->bits, sb->bits, sa->nwords * sizeof(guint64)) == 0 );
+}
+
+WecMatcher *
+wec_matcher_new(void)
+{
+    WecMatcher *self;
+
+    self = g_slice_new0(WecMatcher);
+    self->items = g_array_new(FALSE, FALSE, sizeof(WecMatcherItem));
+    self->starts = g_array_new(FALSE, FALSE, sizeof(guint));
+    self->states = g_ptr_array_new_with_free_func(g_free);
+    self->index = g_hash_table_new(_wec_matcher_state_hash, _wec_matcher_state_equal);
+    self->start = -1;
+
+    return self;
+}
+
+static void
+_wec_matcher_reset(WecMatcher *self)
+{
+    g_hash_table_remove_all(self->index);
+    g_ptr_array_set_size(self->states, 0);
+    self->start = -1;
+    ++self->generation;
+}
+
+void
+wec_matcher_free(WecMatcher *self)
+{
+    _wec_matcher_reset(self);
+
+    g_hash_table_unref(self->index);
+    g_ptr_array_unref(self->states);
+    g_array_unref(self->starts);
+    g_array_unref(self->items);
+
+    g_slice_free(WecMatcher, self);
+}
+
+void
+wec_matcher_add(WecMatcher *self, const gchar *pattern)
+{
+    guint start = self->items->len;
+    const guchar *c;
+
+    g_array_append_val(self->starts, start);
+
+    for ( c = (const guchar *) pattern ; *c != '\0' ; ++c )
+    {
+        WecMatcherItem item = { .type = WEC_MATCHER_ITEM_BYTE, .byte = *c };
+        if ( *c == '?' )
+            item.type = WEC_MATCHER_ITEM_ANY;
+        else if ( *c == '*' )
+        {
+            /* "a**b" is "a*b" */
+            if ( ( self->items->len > start ) && ( g_array_index(self->items, WecMatcherItem, self->items->len - 1).type == WEC_MATCHER_ITEM_STAR ) )
+                continue;
+            item.type = WEC_MATCHER_ITEM_STAR;
+        }
+        g_array_append_val(self->items, item);
+    }
+
+    WecMatcherItem end = { .type = WEC_MATCHER_ITEM_END };
+    g_array_append_val(self->items, end);
+
+    _wec_matcher_reset(self);
+}
+
+void
+wec_matcher_clear(WecMatcher *self)
+{
+    _wec_matcher_reset(self);
+    g_array_set_size(self->starts, 0);
+    g_array_set_size(self->items, 0);
+}
+
+static WecMatcherState *
+_wec_matcher_state_new(WecMatcher *self)
+{
+    gsize nwords = ( self->items->len + 63 ) / 64;
+    WecMatcherState *state;
+
+    state = g_malloc0(sizeof(WecMatcherState) + nwords * sizeof(guint64));
+    state->nwords = nwords;
+
+    return state;
+}
+
+#define _wec_matcher_bit_test(state, i) ( ( (state)->bits[(i) / 64] >> ( (i) % 64 ) ) & 1 )
+#define _wec_matcher_bit_set(state, i) ( (state)->bits[(i) / 64] |= ( (guint64) 1 << ( (i) % 64 ) ) )
+
+/*
+ * Closes the set under empty transitions (skipping a '*'), computes its
+ * properties, and returns the index of the equivalent known state
+ */
+static gint32
+_wec_matcher_state_add(WecMatcher *self, WecMatcherState *state)
+{
+    const WecMatcherItem *items = (const WecMatcherItem *) self->items->data;
+    gsize i;
+    gboolean empty = TRUE;
+
+    /* Items of a pattern are in order, so one pass is enough */
+    for ( i = 0 ; i < self->items->len ; ++i )
+    {
+        if ( ! _wec_matcher_bit_test(state, i) )
+            continue;
+        empty = FALSE;
+        if ( items[i].type == WEC_MATCHER_ITEM_STAR )
+            _wec_matcher_bit_set(state, i + 1);
+        else if ( items[i].type == WEC_MATCHER_ITEM_END )
+            state->accept = TRUE;
+    }
+    state->dead = empty;
+    memset(state->next, 0xff, sizeof(state->next));
+
+    gpointer known = g_hash_table_lookup(self->index, state);
+    if ( known != NULL )
+    {
+        g_free(state);
+        return GPOINTER_TO_INT(known) - 1;
+    }
+
+    if ( self->states->len >= WEC_MATCHER_MAX_STATES )
+        _wec_matcher_reset(self);
+
+    gint32 index = self->states->len;
+    g_ptr_array_add(self->states, state);
+    g_hash_table_insert(self->index, state, GINT_TO_POINTER(index + 1));
+
+    return index;
+}
+
+static gint32
+_wec_matcher_get_start(WecMatcher *self)
+{
+    if ( self->start >= 0 )
+        return self->start;
+
+    WecMatcherState *state = _wec_matcher_state_new(self);
+    guint i;
+    for ( i = 0 ; i < self->starts->len ; ++i )
+        _wec_matcher_bit_set(state, g_array_index(self->starts, guint, i));
+
+    self->start = _wec_matcher_state_add(self, state);
+    return self->start;
+}
+
+static gint32
+_wec_matcher_step(WecMatcher *self, gint32 current, guchar byte)
+{
+    WecMatcherState *from = g_ptr_array_index(self->states, current);
+    if ( from->next[byte] >= 0 )
+        return from->next[byte];
+
+    const WecMatcherItem *items = (const WecMatcherItem *) self->items->data;
+    WecMatcherState *state = _wec_matcher_state_new(self);
+    gsize i;
+    for ( i = 0 ; i < self->items->len ; ++i )
+    {
+        if ( ! _wec_matcher_bit_test(from, i) )
+            continue;
+        switch ( items[i].type )
+        {
+        case WEC_MATCHER_ITEM_END:
+        break;
+        case WEC_MATCHER_ITEM_BYTE:
+            if ( items[i].byte == byte )
+                _wec_matcher_bit_set(state, i + 1);
+        break;
+        case WEC_MATCHER_ITEM_ANY:
+            _wec_matcher_bit_set(state, i + 1);
+        break;
+        case WEC_MATCHER_ITEM_STAR:
+            _wec_matcher_bit_set(state, i);
+        break;
+        }
+    }
+
+    guint generation = self->generation;
+    gint32 next = _wec_matcher_state_add(self, state);
+
+    /* If the DFA was reset, from is gone */
+    if ( generation == self->generation )
+        from->next[byte] = next;
+
+    return next;
+}
+
+static gboolean
+_wec_matcher_feed(WecMatcher *self, gint32 *state, const gchar *string, const guchar *fold)
+{
+    const guchar *c;
+
+    for ( c = (const guchar *) string ; *c != '\0' ; ++c )
+    {
+        *state = _wec_matcher_step(self, *state, ( fold != NULL ) ? fold[*c] : *c);
+        if ( ( (WecMatcherState *) g_ptr_array_index(self->states, *state) )->dead )
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Matches "qualifier.string" (or "string" without a qualifier) without
+ * building it; if not NULL, fold is applied to each byte of string
+ */
+gboolean
+wec_matcher_match_full(WecMatcher *self, const gchar *qualifier, const gchar *string, const guchar *fold)
+{
+    if ( self->starts->len == 0 )
+        return FALSE;
+
+    gint32 state = _wec_matcher_get_start(self);
+    if ( qualifier != NULL )
+    {
+        if ( ! _wec_matcher_feed(self, &state, qualifier, NULL) )
+            return FALSE;
+        if ( ! _wec_matcher_feed(self, &state, ".", NULL) )
+            return FALSE;
+    }
+    if ( ! _wec_matcher_feed(self, &state, string, fold) )
+        return FALSE;
+
+    return ( (WecMatcherState *) g_ptr_array_index(self->states, state) )->accept;
+}
+
+gboolean
+wec_matcher_match(WecMatcher *self, const gchar *string)
+{
+    return wec_matcher_match_full(self, NULL, string, NULL);
+}
+
+gboolean
+wec_matcher_match_qualified(WecMatcher *self, const gchar *qualifier, const gchar *string)
+{
+    return wec_matcher_match_full(self, qualifier, string, NULL);
+}
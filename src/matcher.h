@@ -0,0 +1,38 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __WEECHAT_EVENTC_MATCHER_H__
+#define __WEECHAT_EVENTC_MATCHER_H__
+
+typedef struct _WecMatcher WecMatcher;
+
+WecMatcher *wec_matcher_new(void);
+void wec_matcher_free(WecMatcher *matcher);
+
+void wec_matcher_add(WecMatcher *matcher, const gchar *pattern);
+void wec_matcher_clear(WecMatcher *matcher);
+
+gboolean wec_matcher_match(WecMatcher *matcher, const gchar *string);
+gboolean wec_matcher_match_qualified(WecMatcher *matcher, const gchar *qualifier, const gchar *string);
+gboolean wec_matcher_match_full(WecMatcher *matcher, const gchar *qualifier, const gchar *string, const guchar *fold);
+
+#endif /* __WEECHAT_EVENTC_MATCHER_H__ */
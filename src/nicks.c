@@ -0,0 +1,636 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <glib.h>
+
+#include "casemapping.h"
+#include "nicks.h"
+
+/*
+ * What the irc plugin tells us about nicknames, one cache per server
+ *
+ * We only read the messages WeeChat already parsed (irc_in2_* signals),
+ * the print hook then gets everything with a single lookup.
+ * Entries are keyed by the folded nickname and bounded, the least
+ * recently used go first.
+ */
+
+/* Longer nicknames are not cached, we fold on the stack */
+#define WEC_NICKS_MAX_NICK_SIZE 64
+#define WEC_NICKS_MAX_PARAMS 16
+
+/* Until the server tells us (RFC 1459) */
+#define WEC_NICKS_DEFAULT_PREFIX_MODES "ov"
+#define WEC_NICKS_DEFAULT_PREFIX_CHARS "@+"
+#define WEC_NICKS_DEFAULT_CHANMODES "beI,k,l,imnpst"
+
+struct _WecNick {
+    /* In WecNicks.lru, most recent first */
+    GList link;
+    gchar *host;
+    gchar *account;
+    gboolean away;
+    /* Folded names of the channels we are op in */
+    GSList *ops;
+    gchar key[];
+};
+
+struct _WecNicks {
+    WecCasemapping casemapping;
+    const guchar *fold;
+    GHashTable *nicks;
+    GQueue lru;
+    /* From ISUPPORT PREFIX, op and above first */
+    gchar *prefix_modes;
+    gchar *prefix_chars;
+    gchar *op_modes;
+    gchar *op_chars;
+    /* From ISUPPORT CHANMODES, types A and B then type C */
+    gchar *param_modes;
+    gchar *set_param_modes;
+};
+
+static void
+_wec_nick_free(gpointer data)
+{
+    WecNick *self = data;
+
+    g_slist_free_full(self->ops, g_free);
+    g_free(self->account);
+    g_free(self->host);
+
+    g_free(self);
+}
+
+WecNicks *
+wec_nicks_new(WecCasemapping casemapping)
+{
+    WecNicks *self;
+
+    self = g_slice_new0(WecNicks);
+    self->casemapping = casemapping;
+    self->fold = wec_casemapping_get_table(casemapping);
+    self->nicks = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, _wec_nick_free);
+    g_queue_init(&self->lru);
+    wec_nicks_set_modes(self, NULL, NULL, NULL);
+
+    return self;
+}
+
+void
+wec_nicks_free(WecNicks *self)
+{
+    g_free(self->set_param_modes);
+    g_free(self->param_modes);
+    g_free(self->op_chars);
+    g_free(self->op_modes);
+    g_free(self->prefix_chars);
+    g_free(self->prefix_modes);
+    g_hash_table_unref(self->nicks);
+
+    g_slice_free(WecNicks, self);
+}
+
+/*
+ * Keys were folded with the old casemapping, we start over
+ */
+void
+wec_nicks_set_casemapping(WecNicks *self, WecCasemapping casemapping)
+{
+    if ( self->casemapping == casemapping )
+        return;
+
+    wec_nicks_clear(self);
+    self->casemapping = casemapping;
+    self->fold = wec_casemapping_get_table(casemapping);
+}
+
+/*
+ * Channel modes as the server announced them (PREFIX and CHANMODES),
+ * NULL for the RFC 1459 ones
+ *
+ * Modes at or above op (the "@" prefix) count as op, the others
+ * only tell us how many arguments a MODE line takes
+ */
+void
+wec_nicks_set_modes(WecNicks *self, const gchar *prefix_modes, const gchar *prefix_chars, const gchar *chanmodes)
+{
+    if ( ( prefix_modes == NULL ) || ( prefix_chars == NULL ) || ( strlen(prefix_modes) != strlen(prefix_chars) ) )
+    {
+        prefix_modes = WEC_NICKS_DEFAULT_PREFIX_MODES;
+        prefix_chars = WEC_NICKS_DEFAULT_PREFIX_CHARS;
+    }
+    if ( chanmodes == NULL )
+        chanmodes = WEC_NICKS_DEFAULT_CHANMODES;
+
+    g_free(self->prefix_modes);
+    g_free(self->prefix_chars);
+    g_free(self->op_modes);
+    g_free(self->op_chars);
+    self->prefix_modes = g_strdup(prefix_modes);
+    self->prefix_chars = g_strdup(prefix_chars);
+
+    const gchar *op = strchr(prefix_chars, '@');
+    gsize ops = ( op != NULL ) ? (gsize) ( op - prefix_chars + 1 ) : MIN(strlen(prefix_chars), 1);
+    self->op_modes = g_strndup(prefix_modes, ops);
+    self->op_chars = g_strndup(prefix_chars, ops);
+
+    gchar **types = g_strsplit(chanmodes, ",", 4);
+    guint n = g_strv_length(types);
+    g_free(self->param_modes);
+    g_free(self->set_param_modes);
+    self->param_modes = g_strconcat(( n > 0 ) ? types[0] : "", ( n > 1 ) ? types[1] : "", NULL);
+    self->set_param_modes = g_strdup(( n > 2 ) ? types[2] : "");
+    g_strfreev(types);
+}
+
+void
+wec_nicks_clear(WecNicks *self)
+{
+    g_hash_table_remove_all(self->nicks);
+    g_queue_init(&self->lru);
+}
+
+static gboolean
+_wec_nicks_fold(WecNicks *self, const gchar *string, gsize length, gchar *buffer)
+{
+    gsize i;
+
+    if ( ( length == 0 ) || ( length >= WEC_NICKS_MAX_NICK_SIZE ) )
+        return FALSE;
+
+    for ( i = 0 ; i < length ; ++i )
+        buffer[i] = self->fold[(guchar) string[i]];
+    buffer[length] = '\0';
+
+    return TRUE;
+}
+
+/*
+ * folded is already folded, string is not
+ */
+static gboolean
+_wec_nicks_equal(WecNicks *self, const gchar *folded, const gchar *string)
+{
+    for ( ; ( *folded != '\0' ) && ( *string != '\0' ) ; ++folded, ++string )
+    {
+        if ( *folded != (gchar) self->fold[(guchar) *string] )
+            return FALSE;
+    }
+    return ( *folded == *string );
+}
+
+static WecNick *
+_wec_nicks_get(WecNicks *self, const gchar *nick, gsize length, guint max_size)
+{
+    gchar key[WEC_NICKS_MAX_NICK_SIZE];
+    WecNick *entry;
+
+    if ( ! _wec_nicks_fold(self, nick, length, key) )
+        return NULL;
+
+    entry = g_hash_table_lookup(self->nicks, key);
+    if ( entry != NULL )
+    {
+        g_queue_unlink(&self->lru, &entry->link);
+        g_queue_push_head_link(&self->lru, &entry->link);
+        return entry;
+    }
+
+    if ( max_size == 0 )
+        return NULL;
+
+    entry = g_malloc0(sizeof(WecNick) + length + 1);
+    memcpy(entry->key, key, length + 1);
+    entry->link.data = entry;
+    g_hash_table_insert(self->nicks, entry->key, entry);
+    g_queue_push_head_link(&self->lru, &entry->link);
+
+    while ( self->lru.length > max_size )
+    {
+        WecNick *oldest = self->lru.tail->data;
+        g_queue_unlink(&self->lru, &oldest->link);
+        g_hash_table_remove(self->nicks, oldest->key);
+    }
+
+    return entry;
+}
+
+static void
+_wec_nicks_remove(WecNicks *self, WecNick *entry)
+{
+    g_queue_unlink(&self->lru, &entry->link);
+    g_hash_table_remove(self->nicks, entry->key);
+}
+
+static void
+_wec_nick_set_string(gchar **field, const gchar *value)
+{
+    if ( g_strcmp0(*field, value) == 0 )
+        return;
+    g_free(*field);
+    *field = g_strdup(value);
+}
+
+static void
+_wec_nick_set_host(WecNick *self, const gchar *user, const gchar *host)
+{
+    if ( ( user == NULL ) || ( host == NULL ) )
+        return;
+
+    gchar *userhost = g_strconcat(user, "@", host, NULL);
+    _wec_nick_set_string(&self->host, userhost);
+    g_free(userhost);
+}
+
+/* "*" (or "0" in some replies) means logged out */
+static void
+_wec_nick_set_account(WecNick *self, const gchar *account)
+{
+    if ( ( g_strcmp0(account, "*") == 0 ) || ( g_strcmp0(account, "0") == 0 ) )
+        account = NULL;
+    _wec_nick_set_string(&self->account, account);
+}
+
+static void
+_wec_nick_set_op(WecNicks *nicks, WecNick *self, const gchar *channel, gboolean op)
+{
+    GSList *link;
+    for ( link = self->ops ; link != NULL ; link = g_slist_next(link) )
+    {
+        if ( _wec_nicks_equal(nicks, link->data, channel) )
+            break;
+    }
+
+    if ( op && ( link == NULL ) )
+    {
+        gchar *folded = g_strdup(channel);
+        gchar *c;
+        for ( c = folded ; *c != '\0' ; ++c )
+            *c = nicks->fold[(guchar) *c];
+        self->ops = g_slist_prepend(self->ops, folded);
+    }
+    else if ( ( ! op ) && ( link != NULL ) )
+    {
+        g_free(link->data);
+        self->ops = g_slist_delete_link(self->ops, link);
+    }
+}
+
+static WecNick *
+_wec_nicks_get_string(WecNicks *self, const gchar *nick, guint max_size)
+{
+    return _wec_nicks_get(self, nick, strlen(nick), max_size);
+}
+
+/*
+ * RPL_NAMREPLY entries, with multi-prefix and userhost-in-names
+ */
+static void
+_wec_nicks_names(WecNicks *self, const gchar *channel, gchar *names, guint max_size)
+{
+    gchar *name, *next;
+
+    for ( name = names ; name != NULL ; name = next )
+    {
+        next = strchr(name, ' ');
+        if ( next != NULL )
+            *next++ = '\0';
+
+        gboolean op = FALSE;
+        for ( ; ( *name != '\0' ) && ( strchr(self->prefix_chars, *name) != NULL ) ; ++name )
+            op = op || ( strchr(self->op_chars, *name) != NULL );
+
+        gchar *user = strchr(name, '!');
+        gchar *host = NULL;
+        if ( user != NULL )
+        {
+            *user++ = '\0';
+            host = strchr(user, '@');
+            if ( host != NULL )
+                *host++ = '\0';
+        }
+
+        WecNick *entry = _wec_nicks_get_string(self, name, max_size);
+        if ( entry == NULL )
+            continue;
+        _wec_nick_set_host(entry, user, host);
+        _wec_nick_set_op(self, entry, channel, op);
+    }
+}
+
+static void
+_wec_nicks_mode(WecNicks *self, gchar **params, guint n)
+{
+    if ( ( n < 2 ) || ( strchr("#&!+", params[0][0]) == NULL ) )
+        return;
+
+    const gchar *channel = params[0];
+    const gchar *mode;
+    gboolean set = TRUE;
+    guint arg = 2;
+
+    for ( mode = params[1] ; *mode != '\0' ; ++mode )
+    {
+        switch ( *mode )
+        {
+        case '+':
+            set = TRUE;
+        break;
+        case '-':
+            set = FALSE;
+        break;
+        default:
+            if ( strchr(self->prefix_modes, *mode) != NULL )
+            {
+                /* Only nicknames we already know, arguments are never trusted to create one */
+                WecNick *entry;
+                if ( ( arg < n ) && ( strchr(self->op_modes, *mode) != NULL ) && ( ( entry = _wec_nicks_get_string(self, params[arg], 0) ) != NULL ) )
+                    _wec_nick_set_op(self, entry, channel, set);
+                ++arg;
+            }
+            else if ( strchr(self->param_modes, *mode) != NULL )
+                ++arg;
+            else if ( set && ( strchr(self->set_param_modes, *mode) != NULL ) )
+                ++arg;
+        break;
+        }
+    }
+}
+
+/*
+ * Feeds the cache with a raw IRC message, as the irc plugin got it
+ */
+void
+wec_nicks_message(WecNicks *self, const gchar *message, guint max_size)
+{
+    gchar *copy = g_strdup(message);
+    gchar *s = copy;
+    gchar *account_tag = NULL;
+
+    s[strcspn(s, "\r\n")] = '\0';
+
+    /* IRCv3 account-tag */
+    if ( *s == '@' )
+    {
+        gchar *tags = s + 1;
+        s = strchr(s, ' ');
+        if ( s == NULL )
+            goto out;
+        *s++ = '\0';
+
+        gchar *tag, *next;
+        for ( tag = tags ; tag != NULL ; tag = next )
+        {
+            next = strchr(tag, ';');
+            if ( next != NULL )
+                *next++ = '\0';
+            if ( strncmp(tag, "account=", strlen("account=")) == 0 )
+                account_tag = tag + strlen("account=");
+        }
+    }
+
+    while ( *s == ' ' )
+        ++s;
+
+    gchar *nick = NULL, *user = NULL, *host = NULL;
+    if ( *s == ':' )
+    {
+        nick = s + 1;
+        s = strchr(s, ' ');
+        if ( s == NULL )
+            goto out;
+        *s++ = '\0';
+
+        user = strchr(nick, '!');
+        if ( user != NULL )
+        {
+            *user++ = '\0';
+            host = strchr(user, '@');
+            if ( host != NULL )
+                *host++ = '\0';
+        }
+    }
+
+    while ( *s == ' ' )
+        ++s;
+    gchar *command = s;
+    gchar *params[WEC_NICKS_MAX_PARAMS];
+    guint n = 0;
+    s = strchr(s, ' ');
+    while ( ( s != NULL ) && ( n < WEC_NICKS_MAX_PARAMS ) )
+    {
+        *s++ = '\0';
+        while ( *s == ' ' )
+            ++s;
+        if ( *s == '\0' )
+            break;
+        if ( *s == ':' )
+        {
+            params[n++] = s + 1;
+            break;
+        }
+        params[n++] = s;
+        s = strchr(s, ' ');
+    }
+
+    WecNick *entry = NULL;
+    if ( nick != NULL )
+    {
+        /* We only learn about nicknames we see doing something */
+        gboolean create = ( g_ascii_strcasecmp(command, "JOIN") == 0 ) || ( account_tag != NULL );
+        entry = _wec_nicks_get_string(self, nick, create ? max_size : 0);
+        if ( entry != NULL )
+        {
+            _wec_nick_set_host(entry, user, host);
+            if ( account_tag != NULL )
+                _wec_nick_set_account(entry, account_tag);
+        }
+    }
+
+    if ( g_ascii_strcasecmp(command, "JOIN") == 0 )
+    {
+        if ( ( entry == NULL ) || ( n < 1 ) )
+            goto out;
+        _wec_nick_set_op(self, entry, params[0], FALSE);
+        /* extended-join */
+        if ( n >= 3 )
+            _wec_nick_set_account(entry, params[1]);
+    }
+    else if ( g_ascii_strcasecmp(command, "PART") == 0 )
+    {
+        if ( ( entry != NULL ) && ( n >= 1 ) )
+            _wec_nick_set_op(self, entry, params[0], FALSE);
+    }
+    else if ( g_ascii_strcasecmp(command, "KICK") == 0 )
+    {
+        WecNick *victim;
+        if ( ( n >= 2 ) && ( ( victim = _wec_nicks_get_string(self, params[1], 0) ) != NULL ) )
+            _wec_nick_set_op(self, victim, params[0], FALSE);
+    }
+    else if ( g_ascii_strcasecmp(command, "QUIT") == 0 )
+    {
+        if ( entry != NULL )
+            _wec_nicks_remove(self, entry);
+    }
+    else if ( g_ascii_strcasecmp(command, "NICK") == 0 )
+    {
+        if ( ( entry == NULL ) || ( n < 1 ) )
+            goto out;
+
+        /* Taken out first, adding the new one may evict anything */
+        gchar *old_host = entry->host;
+        gchar *old_account = entry->account;
+        GSList *ops = entry->ops;
+        gboolean away = entry->away;
+        entry->host = entry->account = NULL;
+        entry->ops = NULL;
+        _wec_nicks_remove(self, entry);
+
+        WecNick *renamed = _wec_nicks_get_string(self, params[0], max_size);
+        if ( renamed != NULL )
+        {
+            g_free(renamed->host);
+            g_free(renamed->account);
+            g_slist_free_full(renamed->ops, g_free);
+            renamed->host = old_host;
+            renamed->account = old_account;
+            renamed->ops = ops;
+            renamed->away = away;
+        }
+        else
+        {
+            g_free(old_host);
+            g_free(old_account);
+            g_slist_free_full(ops, g_free);
+        }
+    }
+    else if ( g_ascii_strcasecmp(command, "AWAY") == 0 )
+    {
+        /* away-notify, no message means back */
+        if ( entry != NULL )
+            entry->away = ( n >= 1 ) && ( *params[0] != '\0' );
+    }
+    else if ( g_ascii_strcasecmp(command, "ACCOUNT") == 0 )
+    {
+        if ( ( entry != NULL ) && ( n >= 1 ) )
+            _wec_nick_set_account(entry, params[0]);
+    }
+    else if ( g_ascii_strcasecmp(command, "CHGHOST") == 0 )
+    {
+        if ( ( entry != NULL ) && ( n >= 2 ) )
+            _wec_nick_set_host(entry, params[0], params[1]);
+    }
+    else if ( g_ascii_strcasecmp(command, "MODE") == 0 )
+        _wec_nicks_mode(self, params, n);
+    else if ( strcmp(command, "353") == 0 )
+    {
+        /* me, symbol, channel, names */
+        if ( n >= 4 )
+            _wec_nicks_names(self, params[2], params[3], max_size);
+    }
+    else if ( strcmp(command, "352") == 0 )
+    {
+        /* RPL_WHOREPLY: me, channel, user, host, server, nick, flags, "hops realname" */
+        if ( n < 7 )
+            goto out;
+        WecNick *who = _wec_nicks_get_string(self, params[5], max_size);
+        if ( who == NULL )
+            goto out;
+        _wec_nick_set_host(who, params[2], params[3]);
+        who->away = ( params[6][0] == 'G' );
+        if ( strcmp(params[1], "*") != 0 )
+            _wec_nick_set_op(self, who, params[1], ( params[6][0] != '\0' ) && ( strpbrk(params[6] + 1, self->op_chars) != NULL ));
+    }
+    else if ( strcmp(command, "311") == 0 )
+    {
+        /* RPL_WHOISUSER: me, nick, user, host, "*", realname */
+        WecNick *whois;
+        if ( ( n >= 4 ) && ( ( whois = _wec_nicks_get_string(self, params[1], max_size) ) != NULL ) )
+            _wec_nick_set_host(whois, params[2], params[3]);
+    }
+    else if ( strcmp(command, "330") == 0 )
+    {
+        /* RPL_WHOISACCOUNT: me, nick, account, text */
+        WecNick *whois;
+        if ( ( n >= 3 ) && ( ( whois = _wec_nicks_get_string(self, params[1], max_size) ) != NULL ) )
+            _wec_nick_set_account(whois, params[2]);
+    }
+    else if ( strcmp(command, "301") == 0 )
+    {
+        /* RPL_AWAY: me, nick, message */
+        WecNick *away;
+        if ( ( n >= 2 ) && ( ( away = _wec_nicks_get_string(self, params[1], 0) ) != NULL ) )
+            away->away = TRUE;
+    }
+
+out:
+    g_free(copy);
+}
+
+/*
+ * The entry is only valid until the next call feeding the cache
+ */
+WecNick *
+wec_nicks_lookup(WecNicks *self, const gchar *nick)
+{
+    return _wec_nicks_get_string(self, nick, 0);
+}
+
+guint
+wec_nicks_get_size(const WecNicks *self)
+{
+    return self->lru.length;
+}
+
+const gchar *
+wec_nick_get_host(const WecNick *self)
+{
+    return self->host;
+}
+
+const gchar *
+wec_nick_get_account(const WecNick *self)
+{
+    return self->account;
+}
+
+gboolean
+wec_nick_is_away(const WecNick *self)
+{
+    return self->away;
+}
+
+gboolean
+wec_nicks_is_op(WecNicks *self, const WecNick *nick, const gchar *channel)
+{
+    GSList *link;
+    for ( link = nick->ops ; link != NULL ; link = g_slist_next(link) )
+    {
+        if ( _wec_nicks_equal(self, link->data, channel) )
+            return TRUE;
+    }
+    return FALSE;
+}
@@ -0,0 +1,47 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __WEECHAT_EVENTC_NICKS_H__
+#define __WEECHAT_EVENTC_NICKS_H__
+
+#include "casemapping.h"
+
+typedef struct _WecNicks WecNicks;
+typedef struct _WecNick WecNick;
+
+WecNicks *wec_nicks_new(WecCasemapping casemapping);
+void wec_nicks_free(WecNicks *nicks);
+
+void wec_nicks_set_casemapping(WecNicks *nicks, WecCasemapping casemapping);
+void wec_nicks_set_modes(WecNicks *nicks, const gchar *prefix_modes, const gchar *prefix_chars, const gchar *chanmodes);
+void wec_nicks_clear(WecNicks *nicks);
+void wec_nicks_message(WecNicks *nicks, const gchar *message, guint max_size);
+
+WecNick *wec_nicks_lookup(WecNicks *nicks, const gchar *nick);
+guint wec_nicks_get_size(const WecNicks *nicks);
+gboolean wec_nicks_is_op(WecNicks *nicks, const WecNick *nick, const gchar *channel);
+
+const gchar *wec_nick_get_host(const WecNick *nick);
+const gchar *wec_nick_get_account(const WecNick *nick);
+gboolean wec_nick_is_away(const WecNick *nick);
+
+#endif /* __WEECHAT_EVENTC_NICKS_H__ */
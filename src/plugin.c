@@ -22,43 +22,169 @@
 
 #include "config.h"
 
+#include <errno.h>
+#include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
 #include <glib.h>
+#include <glib-unix.h>
 #include <weechat-plugin.h>
 #include <libeventd-event.h>
-#include <libeventc-light.h>
+#include <libeventd-protocol.h>
+
+#include "socket.h"
+#include "matcher.h"
+#include "casemapping.h"
+#include "queue.h"
+#include "ring.h"
+#include "encoder.h"
+#include "spool.h"
+#include "stats.h"
+#include "record.h"
+#include "nicks.h"
+#include "keywords.h"
+#include "trace.h"
+#include "probes.h"
+
+typedef enum {
+    WEC_EVENT_HIGHLIGHT,
+    WEC_EVENT_CHAT,
+    WEC_EVENT_IM,
+    WEC_EVENT_NOTICE,
+    /* Only a filter, a /me is still WEC_EVENT_CHAT or WEC_EVENT_IM */
+    WEC_EVENT_ACTION,
+    WEC_EVENT_NOTIFY,
+    WEC_EVENT_JOIN,
+    WEC_EVENT_LEAVE,
+    WEC_EVENT_QUIT,
+    WEC_EVENT_KEYWORD,
+    _WEC_EVENT_SIZE
+} WecEventKind;
 
 typedef struct {
+    struct _WecContext *context;
     struct t_config_option *option;
     gboolean whitelist;
-    GHashTable *names;
+    /* Nothing can pass, an empty whitelist or a blacklisted "*" */
+    gboolean disabled;
+    WecMatcher *matcher;
+    /* Only for nick filters, one per casemapping */
+    WecMatcher *folded[_WEC_CASEMAPPING_SIZE];
 } WecEventFilter;
 
+typedef enum {
+    WEC_BUFFER_TYPE_OTHER,
+    WEC_BUFFER_TYPE_CHANNEL,
+    WEC_BUFFER_TYPE_PRIVATE,
+} WecBufferType;
+
+/*
+ * Everything we need to know about a buffer in the print hook,
+ * so we only ask WeeChat once per buffer
+ */
 typedef struct {
+    gboolean irc;
+    /* One of the /eventc bench fake buffers */
+    gboolean bench;
+    WecBufferType type;
+    gchar *server;
+    gchar *name;
+    WecCasemapping casemapping;
+    /* Owned by context->nicks */
+    WecNicks *nicks;
+    guint filters_serial;
+    guint32 allowed;
+    /* Keyword sets matching this buffer */
+    guint64 keywords;
+} WecBuffer;
+
+typedef enum {
+    WEC_CONNECTION_DISABLED,
+    WEC_CONNECTION_BACKOFF,
+    WEC_CONNECTION_CONNECTING,
+    WEC_CONNECTION_CONNECTED,
+} WecConnectionState;
+
+typedef struct _WecContext {
     struct t_gui_buffer *buffer;
-    EventcLightConnection *client;
-    gboolean want_connected;
-    gint reconnect_count;
-    gint fd;
-    struct t_hook *fd_hook;
-    struct t_hook *connect_hook;
+    GPtrArray *endpoints;
+    /* Whether new endpoints should connect right away */
+    gboolean enabled;
+    /* Of the event being built */
+    const gchar *category;
+    const gchar *name;
+    WecQueuePriority priority;
+    /* Copies of the options endpoints read, see _wec_setting() */
+    struct {
+        gint queue_max_size;
+        gint queue_drop_policy;
+        gint queue_shed_size;
+        gint queue_shed_age;
+        gint spool_max_size;
+        gint spool_batch_size;
+        gint retry_min;
+        gint retry_max;
+        gint connect_timeout;
+    } settings;
+    /* See _wec_delivery_start() */
+    struct {
+        gboolean active;
+        GThread *main_thread;
+        GThread *thread;
+        GMainContext *context;
+        GMainLoop *loop;
+        GSource *source;
+        gint waiting;
+        gint notified;
+        gint pipe[2];
+        struct t_hook *pipe_hook;
+        /* The thread own statistics */
+        WecStats stats;
+        /* Under lock */
+        GMutex lock;
+        WecStats pending;
+        GQueue logs;
+        /* Atomic, where to dump the trace up to, see _wec_delivery_trace_dump() */
+        gint trace_dump;
+    } delivery;
     struct t_hook *print_hook;
+    gchar *print_hook_tags;
     struct t_hook *buffer_closing_hook;
+    struct t_hook *buffer_changed_hooks[4];
+    struct t_hook *buffer_switch_hooks[2];
+    struct t_hook *isupport_hook;
+    struct t_hook *nicks_hooks[15];
     struct t_hook *command_hook;
+    EventdProtocol *protocol;
+    WecEncoder *encoder;
+    WecStats stats;
+    struct t_hook *infolist_hook;
+    WecRecorder *recorder;
+    struct _WecBench *bench;
+    struct t_hook *record_timer;
+    struct t_hook *record_write_hook;
+    WecTrace *trace;
+    GHashTable *buffers;
+    GHashTable *presence;
+    GHashTable *playback;
+    GHashTable *flood;
+    GQueue flood_lru;
+    GHashTable *nicks;
+    /* One automaton for every set, see _wec_keywords_update() */
+    WecKeywords *keywords;
+    GPtrArray *keyword_sets;
+    GString *scratch;
+    struct t_gui_buffer *current_buffer;
+    guint filters_serial;
     struct {
         struct t_config_file *file;
         struct {
             struct t_config_section *section;
 
-            WecEventFilter highlight;
-            WecEventFilter chat;
-            WecEventFilter im;
-            WecEventFilter notice;
-            WecEventFilter action;
-            WecEventFilter notify;
-            WecEventFilter join;
-            WecEventFilter leave;
-            WecEventFilter quit;
+            /* Compiled into WecBuffer.allowed, see _wec_buffer_update_filters() */
+            WecEventFilter filters[_WEC_EVENT_SIZE];
         } events;
         struct {
             struct t_config_section *section;
@@ -66,13 +192,137 @@ typedef struct {
             struct t_config_option *ignore_current_buffer;
             WecEventFilter nick_filter;
         } restrictions;
+        struct {
+            struct t_config_section *section;
+
+            struct t_config_option *max_size;
+            struct t_config_option *max_length;
+        } message;
+        struct {
+            struct t_config_section *section;
+
+            struct t_config_option *max_size;
+            struct t_config_option *drop_policy;
+            struct t_config_option *shed_size;
+            struct t_config_option *shed_age;
+        } queue;
+        struct {
+            struct t_config_section *section;
+
+            struct t_config_option *window;
+            struct t_config_option *max_nicks;
+        } presence;
+        struct {
+            struct t_config_section *section;
+
+            struct t_config_option *max_age;
+            struct t_config_option *summary_delay;
+        } playback;
+        struct {
+            struct t_config_section *section;
+
+            struct t_config_option *chat_rate;
+            struct t_config_option *chat_burst;
+            struct t_config_option *im_rate;
+            struct t_config_option *im_burst;
+            struct t_config_option *presence_rate;
+            struct t_config_option *presence_burst;
+            struct t_config_option *max_nicks;
+            struct t_config_option *limit_high;
+        } flood;
+        struct {
+            struct t_config_section *section;
+
+            struct t_config_option *max_size;
+        } nicks;
+        struct {
+            struct t_config_section *section;
+
+            struct t_config_option *list;
+        } keywords;
+        struct {
+            struct t_config_section *section;
+
+            struct t_config_option *dump_size;
+        } trace;
+        struct {
+            struct t_config_section *section;
+
+            struct t_config_option *max_size;
+            struct t_config_option *file;
+            struct t_config_option *batch_size;
+            struct t_config_option *persist_timeout;
+        } spool;
+        struct {
+            struct t_config_section *section;
+
+            struct t_config_option *retry_min;
+            struct t_config_option *retry_max;
+            struct t_config_option *connect_timeout;
+            struct t_config_option *endpoints;
+            struct t_config_option *thread;
+        } connection;
     } config;
 } WecContext;
 
+/* Events handed over to the delivery thread, per endpoint */
+#define WEC_DELIVERY_RING_SIZE 4096
+
+typedef struct _WecEndpoint WecEndpoint;
+
+typedef void (*WecWatchFunc)(WecEndpoint *endpoint);
+
+typedef struct {
+    WecEndpoint *endpoint;
+    WecWatchFunc func;
+    struct t_hook *hook;
+    GSource *source;
+} WecWatch;
+
+typedef struct {
+    WecConnectionState state;
+    gint error;
+    guint retries;
+    gint64 next_retry;
+    guint64 shed[_WEC_QUEUE_PRIORITY_SIZE];
+} WecEndpointStatus;
+
+/*
+ * One eventd we send events to, with its own connection and backlog
+ */
+struct _WecEndpoint {
+    WecContext *context;
+    /* As configured, "" being the local eventd */
+    gchar *name;
+    WecAddress *address;
+    /* NULL to get every event */
+    WecMatcher *categories;
+    WecConnectionState state;
+    gint error;
+    guint retries;
+    gint64 next_retry;
+    gint fd;
+    WecWatch *read_watch;
+    WecWatch *write_watch;
+    WecWatch *timer_watch;
+    /* Where the watches are, NULL for WeeChat main loop */
+    GMainContext *loop;
+    gboolean attached;
+    WecStats *stats;
+    WecQueue *queue;
+    WecSpool *spool;
+    WecRing *ring;
+    /* Last known by the main thread, under delivery lock */
+    WecEndpointStatus reported;
+};
+
 #define _wec_config_boolean(sname, name) weechat_config_boolean(context->config.sname.name)
+#define _wec_config_integer(sname, name) weechat_config_integer(context->config.sname.name)
 
 struct t_weechat_plugin *weechat_plugin = NULL;
 static WecContext _wec_context;
+/* We only generate events, we never parse anything */
+static const EventdProtocolCallbacks _wec_protocol_callbacks;
 
 WEECHAT_PLUGIN_NAME("eventc");
 WEECHAT_PLUGIN_DESCRIPTION("Client for eventd");
@@ -81,417 +331,3387 @@ WEECHAT_PLUGIN_VERSION("0.1");
 WEECHAT_PLUGIN_LICENSE("GPL3");
 
 
-static gboolean _wec_connect(WecContext *context);
-static gint
-_wec_fd_callback(gconstpointer user_data, gpointer data, gint fd)
+#define _wec_setting(name) g_atomic_int_get(&context->settings.name)
+
+static void
+_wec_settings_update(gconstpointer user_data, gpointer data, struct t_config_option *option)
 {
     WecContext *context = (WecContext *) user_data;
 
-    eventc_light_connection_read(context->client);
+    g_atomic_int_set(&context->settings.queue_max_size, _wec_config_integer(queue, max_size));
+    g_atomic_int_set(&context->settings.queue_drop_policy, _wec_config_integer(queue, drop_policy));
+    g_atomic_int_set(&context->settings.queue_shed_size, _wec_config_integer(queue, shed_size));
+    g_atomic_int_set(&context->settings.queue_shed_age, _wec_config_integer(queue, shed_age));
+    g_atomic_int_set(&context->settings.spool_max_size, _wec_config_integer(spool, max_size));
+    g_atomic_int_set(&context->settings.spool_batch_size, _wec_config_integer(spool, batch_size));
+    g_atomic_int_set(&context->settings.retry_min, _wec_config_integer(connection, retry_min));
+    g_atomic_int_set(&context->settings.retry_max, _wec_config_integer(connection, retry_max));
+    g_atomic_int_set(&context->settings.connect_timeout, _wec_config_integer(connection, connect_timeout));
+}
+
+/*
+ * Endpoints watch their socket and timers either with WeeChat hooks
+ * or with GLib sources in the delivery thread
+ *
+ * Watches stay until removed, which callbacks may do on their own
+ */
+static void _wec_delivery_report(WecContext *context);
+
+static gint
+_wec_watch_hook_fd_callback(gconstpointer user_data, gpointer data, gint fd)
+{
+    WecWatch *self = (WecWatch *) user_data;
+
+    self->func(self->endpoint);
 
     return WEECHAT_RC_OK;
 }
 
 static gint
-_wec_try_connect(gconstpointer user_data, gpointer data, gint remaining_calls)
+_wec_watch_hook_timer_callback(gconstpointer user_data, gpointer data, gint remaining_calls)
+{
+    WecWatch *self = (WecWatch *) user_data;
+
+    self->func(self->endpoint);
+
+    return WEECHAT_RC_OK;
+}
+
+static gboolean
+_wec_watch_source_callback(gpointer user_data)
+{
+    WecWatch *self = user_data;
+    WecEndpoint *endpoint = self->endpoint;
+
+    /* self may be gone after that */
+    self->func(endpoint);
+    _wec_delivery_report(endpoint->context);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+_wec_watch_source_fd_callback(gint fd, GIOCondition condition, gpointer user_data)
+{
+    return _wec_watch_source_callback(user_data);
+}
+
+static WecWatch *
+_wec_watch_new(WecEndpoint *endpoint, WecWatchFunc func)
+{
+    WecWatch *self;
+
+    self = g_slice_new0(WecWatch);
+    self->endpoint = endpoint;
+    self->func = func;
+
+    return self;
+}
+
+static void
+_wec_watch_attach(WecWatch *self, GSource *source, GSourceFunc callback)
+{
+    g_source_set_callback(source, callback, self, NULL);
+    g_source_attach(source, self->endpoint->loop);
+    self->source = source;
+}
+
+static WecWatch *
+_wec_watch_fd(WecEndpoint *endpoint, gboolean write, WecWatchFunc func)
+{
+    if ( ! endpoint->attached )
+        return NULL;
+
+    WecWatch *self = _wec_watch_new(endpoint, func);
+    if ( endpoint->loop == NULL )
+        self->hook = weechat_hook_fd(endpoint->fd, ! write, write, 0, _wec_watch_hook_fd_callback, self, NULL);
+    else
+        _wec_watch_attach(self, g_unix_fd_source_new(endpoint->fd, write ? G_IO_OUT : G_IO_IN), (GSourceFunc) (void (*)(void)) _wec_watch_source_fd_callback);
+
+    return self;
+}
+
+static WecWatch *
+_wec_watch_timer(WecEndpoint *endpoint, gint64 delay, WecWatchFunc func)
+{
+    if ( ! endpoint->attached )
+        return NULL;
+
+    WecWatch *self = _wec_watch_new(endpoint, func);
+    delay = MAX(delay, 1);
+    if ( endpoint->loop == NULL )
+        self->hook = weechat_hook_timer(delay, 0, 0, _wec_watch_hook_timer_callback, self, NULL);
+    else
+        _wec_watch_attach(self, g_timeout_source_new(delay), _wec_watch_source_callback);
+
+    return self;
+}
+
+static void
+_wec_watch_remove(WecWatch **watch)
+{
+    WecWatch *self = *watch;
+    if ( self == NULL )
+        return;
+    *watch = NULL;
+
+    if ( self->hook != NULL )
+        weechat_unhook(self->hook);
+    if ( self->source != NULL )
+    {
+        g_source_destroy(self->source);
+        g_source_unref(self->source);
+    }
+
+    g_slice_free(WecWatch, self);
+}
+
+/*
+ * Under congestion, less important events make room for the others
+ */
+static void
+_wec_queue_shed(WecEndpoint *self)
+{
+    WecContext *context = self->context;
+    gsize max_size = (gsize) _wec_setting(queue_shed_size) * 1024;
+    gint64 max_age = (gint64) _wec_setting(queue_shed_age) * 1000;
+    guint shed = wec_queue_shed(self->queue, max_size, max_age);
+    if ( shed > 0 )
+        wec_trace_add(context->trace, WEC_TRACE_STAGE_QUEUE, WEC_STATS_DROP_QUEUE, shed, self);
+    self->stats->drops[WEC_STATS_DROP_QUEUE] += shed;
+}
+
+static void
+_wec_queue_push(WecEndpoint *self, WecMessage *message)
+{
+    WecContext *context = self->context;
+    gsize max_size = (gsize) _wec_setting(queue_max_size) * 1024;
+    WecQueueDropPolicy policy = _wec_setting(queue_drop_policy);
+    guint64 dropped = wec_queue_get_dropped(self->queue);
+    wec_queue_push(self->queue, message, max_size, policy);
+    dropped = wec_queue_get_dropped(self->queue) - dropped;
+    if ( dropped > 0 )
+        wec_trace_add(context->trace, WEC_TRACE_STAGE_QUEUE, WEC_STATS_DROP_QUEUE, dropped, self);
+    self->stats->drops[WEC_STATS_DROP_QUEUE] += dropped;
+    _wec_queue_shed(self);
+}
+
+/*
+ * Move a batch of spooled events to the queue,
+ * the next batch comes once the queue is drained
+ */
+static void
+_wec_spool_replay(WecEndpoint *self)
+{
+    WecContext *context = self->context;
+    guint batch_size = _wec_setting(spool_batch_size);
+    WecMessage *message;
+
+    while ( ( wec_queue_get_length(self->queue) < batch_size ) && ( ( message = wec_spool_pop(self->spool) ) != NULL ) )
+        _wec_queue_push(self, message);
+}
+
+/*
+ * The local eventd keeps the historical spool directory,
+ * every other endpoint gets its own below it
+ */
+static void
+_wec_endpoint_spool_update(WecEndpoint *self)
+{
+    WecContext *context = self->context;
+    gsize max_size = (gsize) _wec_config_integer(spool, max_size) * 1024;
+
+    if ( ! _wec_config_boolean(spool, file) )
+    {
+        wec_spool_set_directory(self->spool, NULL, max_size);
+        return;
+    }
+
+    gchar *base = weechat_string_eval_path_home("%h/eventc", NULL, NULL, NULL);
+    if ( *self->name == '\0' )
+        wec_spool_set_directory(self->spool, base, max_size);
+    else
+    {
+        gchar *escaped = g_uri_escape_string(self->name, NULL, FALSE);
+        gchar *directory = g_build_filename(base, "endpoints", escaped, NULL);
+        wec_spool_set_directory(self->spool, directory, max_size);
+        g_free(directory);
+        g_free(escaped);
+    }
+    free(base);
+}
+
+static gboolean _wec_delivery_stop(WecContext *context);
+static void _wec_delivery_start(WecContext *context);
+
+static void
+_wec_spool_update(gconstpointer user_data, gpointer data, struct t_config_option *option)
 {
     WecContext *context = (WecContext *) user_data;
+    guint i;
 
-    gint error = 0;
-    if ( eventc_light_connection_is_connected(context->client, &error) )
-        return WEECHAT_RC_OK;
+    /* Reading the configuration, endpoints come later */
+    if ( context->endpoints == NULL )
+        return;
+
+    gboolean active = _wec_delivery_stop(context);
+    for ( i = 0 ; i < context->endpoints->len ; ++i )
+        _wec_endpoint_spool_update(g_ptr_array_index(context->endpoints, i));
+    if ( active )
+        _wec_delivery_start(context);
+}
+
+static void
+_wec_queue_sent(const WecMessage *message, gpointer user_data)
+{
+    WecEndpoint *self = user_data;
+
+    /* Message time comes from the same monotonic clock, in microseconds */
+    wec_stats_time(self->stats, WEC_STATS_TIMING_QUEUE, wec_message_get_time(message) * 1000);
+}
+
+static void _wec_connection_lost(WecEndpoint *self);
+static void
+_wec_write_callback(WecEndpoint *self)
+{
+    _wec_queue_shed(self);
 
-    if ( eventc_light_connection_connect(context->client) < 0 )
+    gint64 start = wec_stats_now();
+    gssize r = wec_queue_flush(self->queue, self->fd, _wec_queue_sent, self);
+    gint error = errno;
+    wec_stats_time(self->stats, WEC_STATS_TIMING_FLUSH, start);
+    if ( r < 0 )
     {
-        context->connect_hook = weechat_hook_timer((1000 << ++context->reconnect_count), 60, 1, _wec_try_connect, context, NULL);
-        return WEECHAT_RC_ERROR;
+        self->error = error;
+        g_warning("Could not send events to %s: %s", self->name, g_strerror(self->error));
+        _wec_connection_lost(self);
+        return;
     }
 
-    g_debug("Connected");
+    if ( wec_queue_is_empty(self->queue) )
+        _wec_spool_replay(self);
 
-    context->reconnect_count = 0;
-    context->connect_hook = NULL;
-    context->fd = eventc_light_connection_get_socket(context->client);
-    context->fd_hook = weechat_hook_fd(context->fd, 1, 0, 0, _wec_fd_callback, context, NULL);
-    return WEECHAT_RC_OK;
+    if ( wec_queue_is_empty(self->queue) )
+        _wec_watch_remove(&self->write_watch);
 }
 
-static gboolean
-_wec_connect(WecContext *context)
+static void
+_wec_queue_watch(WecEndpoint *self)
+{
+    if ( ( self->write_watch != NULL ) || ( self->state != WEC_CONNECTION_CONNECTED ) || wec_queue_is_empty(self->queue) )
+        return;
+
+    /*
+     * We only write once the main loop tells us the socket is writable,
+     * so all the events of a loop iteration go out in one write
+     */
+    self->write_watch = _wec_watch_fd(self, TRUE, _wec_write_callback);
+}
+
+static void
+_wec_queue_unwatch(WecEndpoint *self)
 {
-    context->want_connected = TRUE;
+    _wec_watch_remove(&self->write_watch);
 
-    return ( _wec_try_connect(context, NULL, 0) == WEECHAT_RC_OK );
+    wec_queue_discard_partial(self->queue);
 }
 
 static void
-_wec_disconnected_callback(EventcLightConnection *client, gpointer user_data)
+_wec_event_begin(WecContext *context, WecQueuePriority priority, const gchar *category, const gchar *name)
 {
-    WecContext *context = user_data;
+    wec_stats_event(&context->stats, category, name);
+    wec_encoder_begin(context->encoder, category, name);
+    context->category = category;
+    context->name = name;
+    context->priority = priority;
+}
 
-    g_debug("Disconnected");
-    if ( context->want_connected )
-        _wec_connect(context);
+/*
+ * Takes ownership of message
+ */
+static void
+_wec_endpoint_push(WecEndpoint *self, WecMessage *message)
+{
+    WecContext *context = self->context;
+
+    /* Not connected, keep it for later */
+    if ( self->state != WEC_CONNECTION_CONNECTED )
+    {
+        guint64 dropped = wec_spool_get_dropped(self->spool);
+        wec_spool_push(self->spool, message, (gsize) _wec_setting(spool_max_size) * 1024);
+        dropped = wec_spool_get_dropped(self->spool) - dropped;
+        wec_trace_add(context->trace, WEC_TRACE_STAGE_QUEUE, WEC_STATS_DROP_SPOOLED, 1, self);
+        if ( dropped > 0 )
+            wec_trace_add(context->trace, WEC_TRACE_STAGE_QUEUE, WEC_STATS_DROP_SPOOL, dropped, self);
+        ++self->stats->drops[WEC_STATS_DROP_SPOOLED];
+        self->stats->drops[WEC_STATS_DROP_SPOOL] += dropped;
+    }
+    else
+    {
+        _wec_queue_push(self, message);
+        _wec_queue_watch(self);
+    }
+}
+
+/*
+ * Consumer side of the ring, in the delivery thread
+ * (or in the main thread once it is stopped)
+ */
+static void
+_wec_endpoint_drain(WecEndpoint *self)
+{
+    WecMessage *message;
+
+    while ( ( message = wec_ring_pop(self->ring) ) != NULL )
+        _wec_endpoint_push(self, message);
+}
+
+static void
+_wec_send_event(WecContext *context)
+{
+    gint64 start = wec_stats_now();
+    WecMessage *message = wec_encoder_finish(context->encoder);
+    if ( message == NULL )
+        return;
+    wec_message_set_priority(message, context->priority);
+    WEC_PROBE3(event__send, context->category, context->name, wec_message_get_size(message));
+
+    /* Encoded once, every endpoint queues a reference to the same bytes */
+    guint i;
+    for ( i = 0 ; i < context->endpoints->len ; ++i )
+    {
+        WecEndpoint *endpoint = g_ptr_array_index(context->endpoints, i);
+        if ( ( endpoint->categories != NULL ) && ( ! wec_matcher_match(endpoint->categories, context->category) ) )
+            continue;
+
+        if ( context->delivery.thread == NULL )
+            _wec_endpoint_push(endpoint, wec_message_ref(message));
+        else if ( ! wec_ring_push(endpoint->ring, wec_message_ref(message)) )
+        {
+            wec_message_unref(message);
+            ++context->stats.drops[WEC_STATS_DROP_QUEUE];
+        }
+    }
+    wec_message_unref(message);
+
+    /* Only wake the thread up if it is going to sleep */
+    if ( ( context->delivery.thread != NULL ) && g_atomic_int_compare_and_exchange(&context->delivery.waiting, TRUE, FALSE) )
+        g_main_context_wakeup(context->delivery.context);
+
+    wec_stats_time(&context->stats, WEC_STATS_TIMING_SEND, start);
+}
+
+/*
+ * On unload, try to send what is left then keep the rest for next time,
+ * without taking more than spool.persist-timeout
+ *
+ * All endpoints are flushed together, so a slow one cannot eat
+ * the time of the others
+ */
+static void
+_wec_spool_persist(WecContext *context)
+{
+    gint64 deadline = g_get_monotonic_time() + (gint64) _wec_config_integer(spool, persist_timeout) * 1000;
+    struct pollfd *pfds = g_newa(struct pollfd, context->endpoints->len);
+    WecEndpoint **pending = g_newa(WecEndpoint *, context->endpoints->len);
+    gint64 now;
+    guint i, n;
+
+    while ( ( now = g_get_monotonic_time() ) < deadline )
+    {
+        for ( i = 0, n = 0 ; i < context->endpoints->len ; ++i )
+        {
+            WecEndpoint *endpoint = g_ptr_array_index(context->endpoints, i);
+            if ( ( endpoint->state != WEC_CONNECTION_CONNECTED ) || wec_queue_is_empty(endpoint->queue) )
+                continue;
+            pfds[n].fd = endpoint->fd;
+            pfds[n].events = POLLOUT;
+            pfds[n].revents = 0;
+            pending[n++] = endpoint;
+        }
+        if ( n == 0 )
+            break;
+
+        if ( poll(pfds, n, ( deadline - now + 999 ) / 1000) <= 0 )
+            break;
+
+        for ( i = 0 ; i < n ; ++i )
+        {
+            if ( pfds[i].revents == 0 )
+                continue;
+            /* Give up on this one, what is left goes to the spool below */
+            if ( ( ( pfds[i].revents & POLLOUT ) == 0 ) || ( wec_queue_flush(pending[i]->queue, pending[i]->fd, NULL, NULL) < 0 ) )
+                pending[i]->state = WEC_CONNECTION_DISABLED;
+        }
+    }
+
+    if ( ! _wec_config_boolean(spool, file) )
+        return;
+
+    gsize max_size = (gsize) _wec_config_integer(spool, max_size) * 1024;
+    for ( i = 0 ; i < context->endpoints->len ; ++i )
+    {
+        WecEndpoint *endpoint = g_ptr_array_index(context->endpoints, i);
+        WecMessage *message;
+
+        while ( ( g_get_monotonic_time() < deadline ) && ( ( message = wec_queue_pop(endpoint->queue) ) != NULL ) )
+            wec_spool_push(endpoint->spool, message, max_size);
+    }
+}
+
+static void
+_wec_read_callback(WecEndpoint *self)
+{
+    gchar buffer[1024];
+    gssize r;
+
+    /* We do not subscribe to anything, we only care about eventd going away */
+    while ( ( r = read(self->fd, buffer, sizeof(buffer)) ) > 0 );
+
+    if ( ( r < 0 ) && ( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) || ( errno == EINTR ) ) )
+        return;
+
+    self->error = ( r < 0 ) ? errno : 0;
+    g_debug("Disconnected from %s", self->name);
+    _wec_connection_lost(self);
+}
+
+static void _wec_try_connect(WecEndpoint *self);
+static void
+_wec_retry_callback(WecEndpoint *self)
+{
+    _wec_watch_remove(&self->timer_watch);
+    _wec_try_connect(self);
+}
+
+static void
+_wec_backoff(WecEndpoint *self)
+{
+    WecContext *context = self->context;
+    gint64 min = _wec_setting(retry_min);
+    gint64 max = MAX(min, _wec_setting(retry_max));
+    gint64 delay = min;
+    guint i;
+
+    /* We stop doubling once we reach the maximum, so this never overflows */
+    for ( i = 0 ; ( i < self->retries ) && ( delay < max ) ; ++i )
+        delay *= 2;
+    delay = MIN(delay, max);
+
+    /* Somewhere between half and the full delay, so clients do not retry in sync */
+    delay = delay / 2 + g_random_int_range(0, delay / 2 + 1);
+    delay = MAX(delay, 1);
+
+    ++self->retries;
+    WEC_PROBE3(retry, self->name, self->retries, delay);
+    self->state = WEC_CONNECTION_BACKOFF;
+    self->next_retry = g_get_real_time() + delay * 1000;
+    self->timer_watch = _wec_watch_timer(self, delay, _wec_retry_callback);
+}
+
+static void
+_wec_close(WecEndpoint *self)
+{
+    _wec_queue_unwatch(self);
+    _wec_watch_remove(&self->read_watch);
+    _wec_watch_remove(&self->timer_watch);
+
+    if ( self->fd >= 0 )
+        close(self->fd);
+    self->fd = -1;
+}
+
+static void
+_wec_connect_failed(WecEndpoint *self, gint error)
+{
+    g_debug("Could not connect to %s: %s", wec_address_to_string(self->address), g_strerror(error));
+
+    ++self->stats->connection[WEC_STATS_CONNECTION_FAILED];
+    WEC_PROBE2(connect__done, self->name, error);
+    wec_trace_add(self->context->trace, WEC_TRACE_STAGE_CONNECTION, WEC_STATS_CONNECTION_FAILED, error, self);
+    self->error = error;
+    _wec_close(self);
+    _wec_backoff(self);
+}
+
+static void
+_wec_connected(WecEndpoint *self)
+{
+    g_debug("Connected to %s", wec_address_to_string(self->address));
+
+    ++self->stats->connection[WEC_STATS_CONNECTION_ESTABLISHED];
+    WEC_PROBE2(connect__done, self->name, 0);
+    wec_trace_add(self->context->trace, WEC_TRACE_STAGE_CONNECTION, WEC_STATS_CONNECTION_ESTABLISHED, 0, self);
+    self->state = WEC_CONNECTION_CONNECTED;
+    self->retries = 0;
+    self->error = 0;
+    self->read_watch = _wec_watch_fd(self, FALSE, _wec_read_callback);
+    _wec_spool_replay(self);
+    _wec_queue_watch(self);
+}
+
+static void
+_wec_connecting_callback(WecEndpoint *self)
+{
+    _wec_watch_remove(&self->write_watch);
+    _wec_watch_remove(&self->timer_watch);
+
+    gint error = wec_socket_connect_finish(self->fd);
+    if ( error < 0 )
+        _wec_connect_failed(self, -error);
+    else
+        _wec_connected(self);
+}
+
+static void
+_wec_connect_timeout_callback(WecEndpoint *self)
+{
+    _wec_watch_remove(&self->timer_watch);
+    _wec_connect_failed(self, ETIMEDOUT);
+}
+
+static void
+_wec_connecting_watch(WecEndpoint *self)
+{
+    WecContext *context = self->context;
+
+    /* The socket will be writable once connected */
+    self->write_watch = _wec_watch_fd(self, TRUE, _wec_connecting_callback);
+    self->timer_watch = _wec_watch_timer(self, _wec_setting(connect_timeout), _wec_connect_timeout_callback);
+}
+
+static void
+_wec_try_connect(WecEndpoint *self)
+{
+    if ( self->address == NULL )
+    {
+        self->state = WEC_CONNECTION_DISABLED;
+        self->error = EINVAL;
+        return;
+    }
+
+    ++self->stats->connection[WEC_STATS_CONNECTION_ATTEMPTS];
+    WEC_PROBE2(connect__start, self->name, self->retries);
+    wec_trace_add(self->context->trace, WEC_TRACE_STAGE_CONNECTION, WEC_STATS_CONNECTION_ATTEMPTS, 0, self);
+    gint r = wec_socket_connect(self->address, &self->fd);
+    if ( r == 0 )
+    {
+        _wec_connected(self);
+        return;
+    }
+    if ( r != -EINPROGRESS )
+    {
+        self->fd = -1;
+        _wec_connect_failed(self, -r);
+        return;
+    }
+
+    self->state = WEC_CONNECTION_CONNECTING;
+    _wec_connecting_watch(self);
+}
+
+static void
+_wec_endpoint_connect(WecEndpoint *self)
+{
+    if ( self->state != WEC_CONNECTION_DISABLED )
+        return;
+
+    self->retries = 0;
+    _wec_try_connect(self);
+}
+
+/*
+ * Flight recorder rendering, records only hold pointers
+ * so we check they are still alive before using them
+ */
+#define WEC_TRACE_SIZE 4096
+#define WEC_TRACE_DUMP_DEFAULT 100
+
+typedef struct {
+    WecContext *context;
+    gint64 now;
+} WecTraceDump;
+
+static const gchar *
+_wec_trace_buffer_name(gconstpointer buffer)
+{
+    struct t_hdata *hdata = weechat_hdata_get("buffer");
+
+    if ( buffer == NULL )
+        return "(none)";
+    if ( ! weechat_hdata_check_pointer(hdata, weechat_hdata_get_list(hdata, "gui_buffers"), (gpointer) buffer) )
+        return "(closed)";
+    return weechat_buffer_get_string((struct t_gui_buffer *) buffer, "full_name");
+}
+
+static const gchar *
+_wec_trace_endpoint_name(WecContext *context, gconstpointer endpoint)
+{
+    guint i;
+
+    for ( i = 0 ; i < context->endpoints->len ; ++i )
+    {
+        WecEndpoint *self = g_ptr_array_index(context->endpoints, i);
+        if ( self == endpoint )
+            return ( self->address != NULL ) ? wec_address_to_string(self->address) : self->name;
+    }
+
+    return "(removed)";
+}
+
+static void
+_wec_trace_print(const WecTraceRecord *record, gpointer user_data)
+{
+    WecTraceDump *dump = user_data;
+    WecContext *context = dump->context;
+    const gchar *subject = NULL;
+    const gchar *decision = NULL;
+    gchar *reason = NULL;
+
+    switch ( (WecTraceStage) record->stage )
+    {
+    case WEC_TRACE_STAGE_LINE:
+        subject = _wec_trace_buffer_name(record->subject);
+        decision = wec_stats_line_get_name(record->decision);
+    break;
+    case WEC_TRACE_STAGE_QUEUE:
+        subject = _wec_trace_endpoint_name(context, record->subject);
+        decision = wec_stats_drop_get_name(record->decision);
+        reason = g_strdup_printf("%u events", record->reason);
+    break;
+    case WEC_TRACE_STAGE_CONNECTION:
+        subject = _wec_trace_endpoint_name(context, record->subject);
+        decision = wec_stats_connection_get_name(record->decision);
+        if ( record->reason != 0 )
+            reason = g_strdup(g_strerror(record->reason));
+    break;
+    case _WEC_TRACE_STAGE_SIZE:
+        g_return_if_reached();
+    }
+
+    static const gchar * const stages[_WEC_TRACE_STAGE_SIZE] = {
+        [WEC_TRACE_STAGE_LINE] = "line",
+        [WEC_TRACE_STAGE_QUEUE] = "queue",
+        [WEC_TRACE_STAGE_CONNECTION] = "connection",
+    };
+    weechat_printf(context->buffer, "%s"PACKAGE_NAME ": %+.3fs %s %s: %s%s%s", weechat_prefix("network"), (gdouble) ( record->time - dump->now ) / G_USEC_PER_SEC, stages[record->stage], subject, decision, ( reason != NULL ) ? ", " : "", ( reason != NULL ) ? reason : "");
+    g_free(reason);
+}
+
+/*
+ * Prints the n records before end, in the debug buffer if any
+ */
+static void
+_wec_trace_dump(WecContext *context, guint end, guint n)
+{
+    WecTraceDump dump = {
+        .context = context,
+        .now = g_get_monotonic_time(),
+    };
+
+    if ( n == 0 )
+        return;
+
+    weechat_printf(context->buffer, "%s"PACKAGE_NAME ": trace:", weechat_prefix("network"));
+    if ( wec_trace_foreach(context->trace, end, n, _wec_trace_print, &dump) == 0 )
+        weechat_printf(context->buffer, "%s"PACKAGE_NAME ": (empty)", weechat_prefix("network"));
+}
+
+/*
+ * On a lost connection, only into an open debug buffer,
+ * WeeChat core buffer is no place for it
+ */
+static void
+_wec_trace_auto_dump(WecContext *context, guint end)
+{
+    if ( context->buffer == NULL )
+        return;
+
+    _wec_trace_dump(context, end, _wec_config_integer(trace, dump_size));
+}
+
+static gboolean _wec_delivery_trace_dump(WecContext *context, guint end);
+static void
+_wec_connection_lost(WecEndpoint *self)
+{
+    WecContext *context = self->context;
+
+    ++self->stats->connection[WEC_STATS_CONNECTION_LOST];
+    WEC_PROBE2(disconnect, self->name, self->error);
+    guint end = wec_trace_add(context->trace, WEC_TRACE_STAGE_CONNECTION, WEC_STATS_CONNECTION_LOST, self->error, self);
+    if ( ! _wec_delivery_trace_dump(context, end) )
+        _wec_trace_auto_dump(context, end);
+    _wec_close(self);
+
+    if ( self->state != WEC_CONNECTION_DISABLED )
+        _wec_backoff(self);
+}
+
+static void
+_wec_endpoint_disconnect(WecEndpoint *self)
+{
+    _wec_close(self);
+
+    self->state = WEC_CONNECTION_DISABLED;
+    self->error = 0;
+    self->retries = 0;
+}
+
+/*
+ * Watches are tied to a loop, so moving an endpoint to another one
+ * means dropping them and making them again from its state
+ */
+static void
+_wec_endpoint_attach(WecEndpoint *self, GMainContext *loop, WecStats *stats)
+{
+    self->loop = loop;
+    self->stats = stats;
+    self->attached = TRUE;
+
+    switch ( self->state )
+    {
+    case WEC_CONNECTION_DISABLED:
+    break;
+    case WEC_CONNECTION_BACKOFF:
+        self->timer_watch = _wec_watch_timer(self, MAX(self->next_retry - g_get_real_time(), 0) / 1000, _wec_retry_callback);
+    break;
+    case WEC_CONNECTION_CONNECTING:
+        _wec_connecting_watch(self);
+    break;
+    case WEC_CONNECTION_CONNECTED:
+        self->read_watch = _wec_watch_fd(self, FALSE, _wec_read_callback);
+        _wec_queue_watch(self);
+    break;
+    }
+}
+
+static void
+_wec_endpoint_detach(WecEndpoint *self)
+{
+    /* A partially written event stays, we will finish it */
+    _wec_watch_remove(&self->read_watch);
+    _wec_watch_remove(&self->write_watch);
+    _wec_watch_remove(&self->timer_watch);
+
+    self->attached = FALSE;
+    self->loop = NULL;
+    self->stats = &self->context->stats;
+}
+
+static void
+_wec_endpoint_status(WecEndpoint *self, WecEndpointStatus *status)
+{
+    status->state = self->state;
+    status->error = self->error;
+    status->retries = self->retries;
+    status->next_retry = self->next_retry;
+
+    WecQueuePriority priority;
+    for ( priority = 0 ; priority < _WEC_QUEUE_PRIORITY_SIZE ; ++priority )
+        status->shed[priority] = wec_queue_get_shed(self->queue, priority);
+}
+
+/*
+ * Delivery thread
+ *
+ * With connection.thread, endpoints live in a thread with its own
+ * GMainContext: it owns their sockets, queues and spools, so nothing
+ * eventd does can block WeeChat. We still filter and encode in the print
+ * callback, as that needs the WeeChat API, and hand the encoded events
+ * over through a ring per endpoint.
+ *
+ * The thread reports back its status and statistics under a lock,
+ * and its log messages through a pipe, as only the main thread may
+ * touch WeeChat.
+ */
+typedef struct {
+    GSource source;
+    WecContext *context;
+} WecDeliverySource;
+
+typedef struct {
+    gchar *domain;
+    GLogLevelFlags level;
+    gchar *message;
+} WecDeliveryLog;
+
+static gboolean
+_wec_delivery_has_events(WecContext *context)
+{
+    guint i;
+
+    for ( i = 0 ; i < context->endpoints->len ; ++i )
+    {
+        if ( ! wec_ring_is_empty(((WecEndpoint *) g_ptr_array_index(context->endpoints, i))->ring) )
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static gboolean
+_wec_delivery_source_prepare(GSource *source, gint *timeout)
+{
+    WecContext *context = ((WecDeliverySource *) source)->context;
+
+    *timeout = -1;
+
+    /*
+     * Tell the main thread we may sleep before looking,
+     * so either we see its events or it wakes us up
+     */
+    g_atomic_int_set(&context->delivery.waiting, TRUE);
+    if ( ! _wec_delivery_has_events(context) )
+        return FALSE;
+    g_atomic_int_set(&context->delivery.waiting, FALSE);
+
+    return TRUE;
+}
+
+static gboolean
+_wec_delivery_source_check(GSource *source)
+{
+    WecContext *context = ((WecDeliverySource *) source)->context;
+
+    return _wec_delivery_has_events(context);
+}
+
+static gboolean
+_wec_delivery_source_dispatch(GSource *source, GSourceFunc callback, gpointer user_data)
+{
+    WecContext *context = ((WecDeliverySource *) source)->context;
+    guint i;
+
+    for ( i = 0 ; i < context->endpoints->len ; ++i )
+        _wec_endpoint_drain(g_ptr_array_index(context->endpoints, i));
+    _wec_delivery_report(context);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs _wec_delivery_source_funcs = {
+    .prepare = _wec_delivery_source_prepare,
+    .check = _wec_delivery_source_check,
+    .dispatch = _wec_delivery_source_dispatch,
+};
+
+/*
+ * In the delivery thread, after anything it did
+ */
+static void
+_wec_delivery_report(WecContext *context)
+{
+    guint i;
+
+    g_mutex_lock(&context->delivery.lock);
+    wec_stats_merge(&context->delivery.pending, &context->delivery.stats);
+    for ( i = 0 ; i < context->endpoints->len ; ++i )
+    {
+        WecEndpoint *endpoint = g_ptr_array_index(context->endpoints, i);
+        _wec_endpoint_status(endpoint, &endpoint->reported);
+    }
+    g_mutex_unlock(&context->delivery.lock);
+}
+
+/*
+ * In the main thread, before showing anything
+ */
+static void
+_wec_delivery_sync(WecContext *context)
+{
+    g_mutex_lock(&context->delivery.lock);
+    wec_stats_merge(&context->stats, &context->delivery.pending);
+    g_mutex_unlock(&context->delivery.lock);
+}
+
+static void
+_wec_delivery_get_status(WecContext *context, WecEndpoint *endpoint, WecEndpointStatus *status)
+{
+    if ( context->delivery.thread == NULL )
+    {
+        _wec_endpoint_status(endpoint, status);
+        return;
+    }
+
+    g_mutex_lock(&context->delivery.lock);
+    *status = endpoint->reported;
+    g_mutex_unlock(&context->delivery.lock);
+}
+
+static void
+_wec_delivery_notify(WecContext *context)
+{
+    /* One byte is enough until the main thread reads it */
+    if ( g_atomic_int_compare_and_exchange(&context->delivery.notified, FALSE, TRUE) )
+    {
+        if ( write(context->delivery.pipe[1], "", 1) < 0 )
+            g_atomic_int_set(&context->delivery.notified, FALSE);
+    }
+}
+
+/*
+ * Returns TRUE if the message was deferred to the main thread
+ */
+static gboolean
+_wec_delivery_log(WecContext *context, const gchar *domain, GLogLevelFlags level, const gchar *message)
+{
+    if ( ( context->delivery.main_thread == NULL ) || ( g_thread_self() == context->delivery.main_thread ) )
+        return FALSE;
+
+    WecDeliveryLog *log = g_slice_new(WecDeliveryLog);
+    log->domain = g_strdup(domain);
+    log->level = level;
+    log->message = g_strdup(message);
+
+    g_mutex_lock(&context->delivery.lock);
+    g_queue_push_tail(&context->delivery.logs, log);
+    g_mutex_unlock(&context->delivery.lock);
+
+    _wec_delivery_notify(context);
+
+    return TRUE;
+}
+
+/*
+ * Returns TRUE if the dump was deferred to the main thread,
+ * a later one replaces it
+ */
+static gboolean
+_wec_delivery_trace_dump(WecContext *context, guint end)
+{
+    if ( ( context->delivery.main_thread == NULL ) || ( g_thread_self() == context->delivery.main_thread ) )
+        return FALSE;
+
+    g_atomic_int_set(&context->delivery.trace_dump, (gint) end);
+    _wec_delivery_notify(context);
+
+    return TRUE;
+}
+
+static void
+_wec_delivery_flush_logs(WecContext *context)
+{
+    GQueue logs = G_QUEUE_INIT;
+    WecDeliveryLog *log;
+
+    g_atomic_int_set(&context->delivery.notified, FALSE);
+
+    g_mutex_lock(&context->delivery.lock);
+    logs = context->delivery.logs;
+    g_queue_init(&context->delivery.logs);
+    g_mutex_unlock(&context->delivery.lock);
+
+    while ( ( log = g_queue_pop_head(&logs) ) != NULL )
+    {
+        g_log(log->domain, log->level, "%s", log->message);
+        g_free(log->message);
+        g_free(log->domain);
+        g_slice_free(WecDeliveryLog, log);
+    }
+
+    gint end = g_atomic_int_get(&context->delivery.trace_dump);
+    if ( ( end != 0 ) && g_atomic_int_compare_and_exchange(&context->delivery.trace_dump, end, 0) )
+        _wec_trace_auto_dump(context, (guint) end);
+}
+
+static gint
+_wec_delivery_pipe_callback(gconstpointer user_data, gpointer data, gint fd)
+{
+    WecContext *context = (WecContext *) user_data;
+    gchar buffer[64];
+
+    while ( read(fd, buffer, sizeof(buffer)) > 0 );
+    _wec_delivery_flush_logs(context);
+
+    return WEECHAT_RC_OK;
+}
+
+static gpointer
+_wec_delivery_thread(gpointer user_data)
+{
+    WecContext *context = user_data;
+    guint i;
+
+    g_main_context_push_thread_default(context->delivery.context);
+
+    for ( i = 0 ; i < context->endpoints->len ; ++i )
+        _wec_endpoint_attach(g_ptr_array_index(context->endpoints, i), context->delivery.context, &context->delivery.stats);
+    _wec_delivery_report(context);
+
+    g_main_loop_run(context->delivery.loop);
+
+    g_main_context_pop_thread_default(context->delivery.context);
+
+    return NULL;
+}
+
+static gboolean
+_wec_delivery_quit(gpointer user_data)
+{
+    WecContext *context = user_data;
+    guint i;
+
+    for ( i = 0 ; i < context->endpoints->len ; ++i )
+    {
+        WecEndpoint *endpoint = g_ptr_array_index(context->endpoints, i);
+        _wec_endpoint_drain(endpoint);
+        _wec_endpoint_detach(endpoint);
+    }
+    g_main_loop_quit(context->delivery.loop);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+_wec_delivery_spawn(WecContext *context)
+{
+    GError *error = NULL;
+
+    if ( ! g_unix_open_pipe(context->delivery.pipe, FD_CLOEXEC, &error) )
+    {
+        g_warning("Could not create delivery thread pipe: %s", error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+    g_unix_set_fd_nonblocking(context->delivery.pipe[0], TRUE, NULL);
+    g_unix_set_fd_nonblocking(context->delivery.pipe[1], TRUE, NULL);
+    context->delivery.pipe_hook = weechat_hook_fd(context->delivery.pipe[0], 1, 0, 0, _wec_delivery_pipe_callback, context, NULL);
+
+    context->delivery.context = g_main_context_new();
+    context->delivery.loop = g_main_loop_new(context->delivery.context, FALSE);
+    context->delivery.source = g_source_new(&_wec_delivery_source_funcs, sizeof(WecDeliverySource));
+    ((WecDeliverySource *) context->delivery.source)->context = context;
+    g_source_attach(context->delivery.source, context->delivery.context);
+
+    context->delivery.thread = g_thread_try_new("eventc", _wec_delivery_thread, context, &error);
+    if ( context->delivery.thread != NULL )
+        return TRUE;
+
+    g_warning("Could not start delivery thread: %s", error->message);
+    g_error_free(error);
+
+    g_source_destroy(context->delivery.source);
+    g_source_unref(context->delivery.source);
+    g_main_loop_unref(context->delivery.loop);
+    g_main_context_unref(context->delivery.context);
+    weechat_unhook(context->delivery.pipe_hook);
+    close(context->delivery.pipe[0]);
+    close(context->delivery.pipe[1]);
+
+    return FALSE;
+}
+
+/*
+ * Endpoints are only touched by one side at a time: changing them
+ * from the main thread means stopping the delivery, then starting
+ * it again
+ */
+static void
+_wec_delivery_start(WecContext *context)
+{
+    guint i;
+
+    context->delivery.active = TRUE;
+    if ( _wec_config_boolean(connection, thread) && _wec_delivery_spawn(context) )
+        return;
+
+    for ( i = 0 ; i < context->endpoints->len ; ++i )
+        _wec_endpoint_attach(g_ptr_array_index(context->endpoints, i), NULL, &context->stats);
+}
+
+/*
+ * Returns whether it was started
+ */
+static gboolean
+_wec_delivery_stop(WecContext *context)
+{
+    guint i;
+
+    if ( ! context->delivery.active )
+        return FALSE;
+    context->delivery.active = FALSE;
+
+    if ( context->delivery.thread == NULL )
+    {
+        for ( i = 0 ; i < context->endpoints->len ; ++i )
+            _wec_endpoint_detach(g_ptr_array_index(context->endpoints, i));
+        return TRUE;
+    }
+
+    g_main_context_invoke(context->delivery.context, _wec_delivery_quit, context);
+    g_thread_join(context->delivery.thread);
+    context->delivery.thread = NULL;
+
+    g_source_destroy(context->delivery.source);
+    g_source_unref(context->delivery.source);
+    g_main_loop_unref(context->delivery.loop);
+    g_main_context_unref(context->delivery.context);
+
+    weechat_unhook(context->delivery.pipe_hook);
+    close(context->delivery.pipe[0]);
+    close(context->delivery.pipe[1]);
+
+    _wec_delivery_report(context);
+    _wec_delivery_sync(context);
+    _wec_delivery_flush_logs(context);
+
+    return TRUE;
+}
+
+static void
+_wec_delivery_update(gconstpointer user_data, gpointer data, struct t_config_option *option)
+{
+    WecContext *context = (WecContext *) user_data;
+
+    if ( _wec_delivery_stop(context) )
+        _wec_delivery_start(context);
+}
+
+static void
+_wec_connect(WecContext *context)
+{
+    guint i;
+
+    context->enabled = TRUE;
+    for ( i = 0 ; i < context->endpoints->len ; ++i )
+        _wec_endpoint_connect(g_ptr_array_index(context->endpoints, i));
+}
+
+static void
+_wec_disconnect(WecContext *context)
+{
+    guint i;
+
+    context->enabled = FALSE;
+    for ( i = 0 ; i < context->endpoints->len ; ++i )
+        _wec_endpoint_disconnect(g_ptr_array_index(context->endpoints, i));
+}
+
+static WecEndpoint *
+_wec_endpoint_new(WecContext *context, const gchar *name)
+{
+    WecEndpoint *self;
+
+    self = g_slice_new0(WecEndpoint);
+    self->context = context;
+    self->name = g_strdup(name);
+    self->address = wec_address_new(name);
+    self->fd = -1;
+    self->stats = &context->stats;
+    self->queue = wec_queue_new();
+    self->spool = wec_spool_new();
+    self->ring = wec_ring_new(WEC_DELIVERY_RING_SIZE);
+
+    _wec_endpoint_spool_update(self);
+
+    return self;
+}
+
+static void
+_wec_endpoint_free(gpointer data)
+{
+    WecEndpoint *self = data;
+
+    _wec_endpoint_disconnect(self);
+
+    if ( self->categories != NULL )
+        wec_matcher_free(self->categories);
+    wec_ring_free(self->ring);
+    wec_spool_free(self->spool);
+    wec_queue_free(self->queue);
+    if ( self->address != NULL )
+        wec_address_free(self->address);
+    g_free(self->name);
+
+    g_slice_free(WecEndpoint, self);
+}
+
+/*
+ * connection.endpoints is a comma-separated list of address[=categories],
+ * categories being a "+"-separated list of globs
+ *
+ * Endpoints still in the list keep their connection and backlog
+ */
+static void
+_wec_endpoints_update(gconstpointer user_data, gpointer data, struct t_config_option *option)
+{
+    WecContext *context = (WecContext *) user_data;
+    GPtrArray *old = context->endpoints;
+    gchar **entries = g_strsplit(weechat_config_string(context->config.connection.endpoints), ",", -1);
+    gchar **entry;
+    guint i;
+
+    gboolean active = _wec_delivery_stop(context);
+
+    /* Nothing configured, the local eventd */
+    if ( entries[0] == NULL )
+    {
+        g_strfreev(entries);
+        entries = g_new0(gchar *, 2);
+        entries[0] = g_strdup("");
+    }
+
+    context->endpoints = g_ptr_array_new_with_free_func(_wec_endpoint_free);
+    for ( entry = entries ; *entry != NULL ; ++entry )
+    {
+        gchar *categories = strchr(*entry, '=');
+        if ( categories != NULL )
+            *categories++ = '\0';
+        const gchar *name = g_strstrip(*entry);
+
+        WecEndpoint *endpoint = NULL;
+        for ( i = 0 ; i < context->endpoints->len ; ++i )
+        {
+            if ( g_strcmp0(((WecEndpoint *) g_ptr_array_index(context->endpoints, i))->name, name) == 0 )
+                break;
+        }
+        if ( i < context->endpoints->len )
+        {
+            g_warning("Endpoint %s listed twice, ignoring the second one", name);
+            continue;
+        }
+
+        for ( i = 0 ; ( old != NULL ) && ( i < old->len ) ; ++i )
+        {
+            if ( g_strcmp0(((WecEndpoint *) g_ptr_array_index(old, i))->name, name) == 0 )
+            {
+                endpoint = g_ptr_array_index(old, i);
+                /* Steal it so freeing the old list keeps it alive */
+                g_ptr_array_index(old, i) = NULL;
+                break;
+            }
+        }
+        if ( endpoint == NULL )
+        {
+            endpoint = _wec_endpoint_new(context, name);
+            if ( context->enabled )
+                _wec_endpoint_connect(endpoint);
+        }
+
+        if ( endpoint->categories != NULL )
+            wec_matcher_free(endpoint->categories);
+        endpoint->categories = NULL;
+        if ( categories != NULL )
+        {
+            gchar **list = g_strsplit(categories, "+", -1), **n;
+            endpoint->categories = wec_matcher_new();
+            for ( n = list ; *n != NULL ; ++n )
+            {
+                if ( *g_strstrip(*n) != '\0' )
+                    wec_matcher_add(endpoint->categories, *n);
+            }
+            g_strfreev(list);
+        }
+
+        g_ptr_array_add(context->endpoints, endpoint);
+    }
+    g_strfreev(entries);
+
+    if ( old != NULL )
+    {
+        for ( i = 0 ; i < old->len ; ++i )
+        {
+            if ( g_ptr_array_index(old, i) != NULL )
+                _wec_endpoint_free(g_ptr_array_index(old, i));
+        }
+        g_ptr_array_set_free_func(old, NULL);
+        g_ptr_array_unref(old);
+    }
+
+    if ( active )
+        _wec_delivery_start(context);
+}
+
+#define _wec_define_section(name) G_STMT_START { \
+        context->config.name.section = weechat_config_new_section(context->config.file, #name, 0, 0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL); \
+    } G_STMT_END
+#define _wec_define_boolean(sname, name, member, default_value, description) G_STMT_START { \
+        context->config.sname.member = weechat_config_new_option(context->config.file, context->config.sname.section, name, "boolean", description, NULL, 0, 0, default_value, NULL, 0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL); \
+    } G_STMT_END
+#define _wec_define_boolean_full(sname, name, member, default_value, description, callback) G_STMT_START { \
+        context->config.sname.member = weechat_config_new_option(context->config.file, context->config.sname.section, name, "boolean", description, NULL, 0, 0, default_value, NULL, 0, NULL, NULL, NULL, callback, context, NULL, NULL, NULL, NULL); \
+    } G_STMT_END
+#define _wec_define_integer(sname, name, member, min, max, default_value, description) G_STMT_START { \
+        context->config.sname.member = weechat_config_new_option(context->config.file, context->config.sname.section, name, "integer", description, NULL, min, max, default_value, NULL, 0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL); \
+    } G_STMT_END
+#define _wec_define_integer_full(sname, name, member, min, max, default_value, description, callback) G_STMT_START { \
+        context->config.sname.member = weechat_config_new_option(context->config.file, context->config.sname.section, name, "integer", description, NULL, min, max, default_value, NULL, 0, NULL, NULL, NULL, callback, context, NULL, NULL, NULL, NULL); \
+    } G_STMT_END
+#define _wec_define_enum_full(sname, name, member, values, default_value, description, callback) G_STMT_START { \
+        context->config.sname.member = weechat_config_new_option(context->config.file, context->config.sname.section, name, "integer", description, values, 0, 0, default_value, NULL, 0, NULL, NULL, NULL, callback, context, NULL, NULL, NULL, NULL); \
+    } G_STMT_END
+#define _wec_define_enum(sname, name, member, values, default_value, description) G_STMT_START { \
+        context->config.sname.member = weechat_config_new_option(context->config.file, context->config.sname.section, name, "integer", description, values, 0, 0, default_value, NULL, 0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL); \
+    } G_STMT_END
+#define _wec_define_string_full(sname, name, member, default_value, description, callback) G_STMT_START { \
+        context->config.sname.member = weechat_config_new_option(context->config.file, context->config.sname.section, name, "string", description, NULL, 0, 0, default_value, NULL, 0, NULL, NULL, NULL, callback, context, NULL, NULL, NULL, NULL); \
+    } G_STMT_END
+#define _wec_define_string(sname, name, member, default_value, description) G_STMT_START { \
+        context->config.sname.member = weechat_config_new_option(context->config.file, context->config.sname.section, #name, "string", description, NULL, 0, 0, default_value, NULL, 0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL); \
+    } G_STMT_END
+#define _wec_define_filter(sname, name, member, default_value, description) G_STMT_START { \
+        context->config.sname.member.option = weechat_config_new_option(context->config.file, context->config.sname.section, name, "string", description, NULL, 0, 0, default_value, NULL, 0, _wec_filter_check, &context->config.sname.member, NULL, _wec_filter_update, &context->config.sname.member, NULL, NULL, NULL, NULL); \
+        context->config.sname.member.context = context; \
+        context->config.sname.member.matcher = wec_matcher_new(); \
+    } G_STMT_END
+#define _wec_define_nick_filter(sname, name, member, default_value, description) G_STMT_START { \
+        guint i_; \
+        for ( i_ = 0 ; i_ < _WEC_CASEMAPPING_SIZE ; ++i_ ) \
+            context->config.sname.member.folded[i_] = wec_matcher_new(); \
+        _wec_define_filter(sname, name, member, default_value, description); \
+    } G_STMT_END
+#define _wec_define_event_filter(name, kind, default_value, description) _wec_define_filter(events, name, filters[kind], default_value, description)
+#define _wec_process_filter(sname, member) G_STMT_START { \
+        _wec_filter_update(&context->config.sname.member, NULL, context->config.sname.member.option); \
+    } G_STMT_END
+#define _wec_clean_filter(sname, member) G_STMT_START { \
+        guint i_; \
+        for ( i_ = 0 ; i_ < _WEC_CASEMAPPING_SIZE ; ++i_ ) \
+        { \
+            if ( context->config.sname.member.folded[i_] != NULL ) \
+                wec_matcher_free(context->config.sname.member.folded[i_]); \
+        } \
+        wec_matcher_free(context->config.sname.member.matcher); \
+    } G_STMT_END
+
+/*
+ * Filter entries are globs, matched against both "name" and "server.name"
+ */
+static inline gboolean
+_wec_filter_ignore(WecEventFilter *filter, const gchar *server, const gchar *name)
+{
+    if ( name == NULL )
+        return TRUE;
+
+    gboolean match = wec_matcher_match(filter->matcher, name);
+    if ( ( ! match ) && ( server != NULL ) )
+        match = wec_matcher_match_qualified(filter->matcher, server, name);
+
+    return ( filter->whitelist != match );
+}
+
+/*
+ * Nicknames are folded with the server casemapping while matching,
+ * entries were folded once when the filter was built
+ */
+static inline gboolean
+_wec_nick_filter_ignore(WecEventFilter *filter, WecCasemapping casemapping, const gchar *server, const gchar *nick)
+{
+    if ( nick == NULL )
+        return TRUE;
+
+    WecMatcher *matcher = filter->folded[casemapping];
+    const guchar *fold = wec_casemapping_get_table(casemapping);
+
+    gboolean match = wec_matcher_match_full(matcher, NULL, nick, fold);
+    if ( ( ! match ) && ( server != NULL ) )
+        match = wec_matcher_match_full(matcher, server, nick, fold);
+
+    return ( filter->whitelist != match );
+}
+
+static void
+_wec_filter_add(WecEventFilter *filter, const gchar *entry)
+{
+    wec_matcher_add(filter->matcher, entry);
+
+    if ( filter->folded[0] == NULL )
+        return;
+
+    /* Only fold the nickname, not the server qualifier */
+    const gchar *nick = strrchr(entry, '.');
+    nick = ( nick != NULL ) ? ( nick + 1 ) : entry;
+
+    guint i;
+    for ( i = 0 ; i < _WEC_CASEMAPPING_SIZE ; ++i )
+    {
+        gchar *folded = wec_casemapping_fold(i, nick);
+        gchar *pattern = g_strdup(entry);
+        memcpy(pattern + ( nick - entry ), folded, strlen(folded));
+        wec_matcher_add(filter->folded[i], pattern);
+        g_free(pattern);
+        g_free(folded);
+    }
+}
+
+static gint
+_wec_filter_check(gconstpointer user_data, gpointer data, struct t_config_option *option, const gchar *value)
+{
+    WecEventFilter *filter = (WecEventFilter *) user_data;
+
+    g_return_val_if_fail(filter->option == option, WEECHAT_RC_ERROR);
+
+    if ( g_utf8_get_char(value) != '+' )
+        return 1;
+
+    value = g_utf8_next_char(value);
+    gboolean want_end = TRUE;
+    if ( g_utf8_get_char(value) == ' ' )
+    {
+        want_end = FALSE;
+        value = g_utf8_next_char(value);
+    }
+    if ( g_utf8_get_char(value) == '\0' )
+        return want_end ? 1 : 0;
+    return 1;
+}
+
+static void _wec_print_hook_update(WecContext *context);
+static void
+_wec_filter_update(gconstpointer user_data, gpointer data, struct t_config_option *option)
+{
+    WecEventFilter *filter = (WecEventFilter *) user_data;
+
+    g_return_if_fail(filter->option == option);
+
+    const gchar *value = weechat_config_string(filter->option);
+
+    wec_matcher_clear(filter->matcher);
+    guint i;
+    for ( i = 0 ; i < _WEC_CASEMAPPING_SIZE ; ++i )
+    {
+        if ( filter->folded[i] != NULL )
+            wec_matcher_clear(filter->folded[i]);
+    }
+    /* Cached per-buffer verdicts are now stale */
+    ++filter->context->filters_serial;
+
+    filter->whitelist = ( g_utf8_get_char(value) == '+' );
+    filter->disabled = filter->whitelist;
+    if ( filter->whitelist )
+    {
+        value = g_utf8_next_char(value);
+        if ( g_utf8_get_char(value) == '\0' )
+            goto out;
+        value = g_utf8_next_char(value);
+    }
+
+    gchar **list, **n;
+    list = g_strsplit(value, " ", -1);
+    for ( n = list ; *n != NULL ; ++n )
+    {
+        if ( g_utf8_get_char(*n) == '\0' )
+            continue;
+        _wec_filter_add(filter, *n);
+        if ( filter->whitelist )
+            filter->disabled = FALSE;
+        else if ( strcmp(*n, "*") == 0 )
+            filter->disabled = TRUE;
+    }
+    g_strfreev(list);
+
+out:
+    _wec_print_hook_update(filter->context);
+}
+
+/*
+ * keywords.list is a space-separated list of [glob=]keyword[,keyword...],
+ * entries sharing a glob share a set
+ *
+ * The automaton is only built here, never in the print hook
+ */
+static void
+_wec_keywords_update(gconstpointer user_data, gpointer data, struct t_config_option *option)
+{
+    WecContext *context = (WecContext *) user_data;
+    gchar **entries = g_strsplit(weechat_config_string(context->config.keywords.list), " ", -1);
+    gchar **entry;
+    GPtrArray *globs = g_ptr_array_new();
+    guint i;
+
+    if ( context->keywords != NULL )
+        wec_keywords_free(context->keywords);
+    context->keywords = wec_keywords_new();
+    g_ptr_array_set_size(context->keyword_sets, 0);
+
+    for ( entry = entries ; *entry != NULL ; ++entry )
+    {
+        if ( **entry == '\0' )
+            continue;
+
+        const gchar *glob = "*";
+        gchar *list = strchr(*entry, '=');
+        if ( list != NULL )
+        {
+            *list++ = '\0';
+            glob = *entry;
+        }
+        else
+            list = *entry;
+
+        for ( i = 0 ; i < globs->len ; ++i )
+        {
+            if ( strcmp(g_ptr_array_index(globs, i), glob) == 0 )
+                break;
+        }
+        if ( i == globs->len )
+        {
+            if ( i == WEC_KEYWORDS_MAX_SETS )
+            {
+                g_warning("Too many keyword buffer globs, ignoring %s", glob);
+                continue;
+            }
+            WecMatcher *matcher = wec_matcher_new();
+            wec_matcher_add(matcher, glob);
+            g_ptr_array_add(context->keyword_sets, matcher);
+            g_ptr_array_add(globs, (gpointer) glob);
+        }
+
+        gchar **keywords = g_strsplit(list, ",", -1), **keyword;
+        for ( keyword = keywords ; *keyword != NULL ; ++keyword )
+        {
+            if ( **keyword != '\0' )
+                wec_keywords_add(context->keywords, *keyword, i);
+        }
+        g_strfreev(keywords);
+    }
+    g_ptr_array_free(globs, TRUE);
+    g_strfreev(entries);
+
+    wec_keywords_compile(context->keywords);
+
+    /* Cached per-buffer sets are now stale */
+    ++context->filters_serial;
+    _wec_print_hook_update(context);
+}
+
+static void
+_wec_config_init(WecContext *context)
+{
+    context->config.file = weechat_config_new("eventc", NULL, NULL, NULL);
+
+    _wec_define_section(events);
+    _wec_define_event_filter("highlight", WEC_EVENT_HIGHLIGHT, "", "Highlight");
+    _wec_define_event_filter("chat", WEC_EVENT_CHAT, "+", "Channel messages");
+    _wec_define_event_filter("im", WEC_EVENT_IM, "", "Private messages");
+    _wec_define_event_filter("notice", WEC_EVENT_NOTICE, "", "Notices");
+    _wec_define_event_filter("action", WEC_EVENT_ACTION, "", "Action messages (/me), on top of the chat and im filters, highlights excepted");
+    _wec_define_event_filter("notify", WEC_EVENT_NOTIFY, "", "Presence notifications");
+    _wec_define_event_filter("join", WEC_EVENT_JOIN, "+", "Channel join");
+    _wec_define_event_filter("leave", WEC_EVENT_LEAVE, "+", "Channel part and kick");
+    _wec_define_event_filter("quit", WEC_EVENT_QUIT, "+", "Channel quit");
+    _wec_define_event_filter("keyword", WEC_EVENT_KEYWORD, "", "Messages matching a keyword, highlights excepted");
+
+    _wec_define_section(restrictions);
+    _wec_define_boolean(restrictions, "ignore-current-buffer", ignore_current_buffer, "on", "Ignore messages from currently displayed buffer");
+    _wec_define_nick_filter(restrictions, "nick-filter", nick_filter, "", "A (space-separated) list of nicknames to completely ignore (globs, optionally prefixed by \"server.\")");
+
+    _wec_define_section(message);
+    _wec_define_integer(message, "max-size", max_size, 0, 1024 * 1024, "1024", "Maximum size (in bytes) of a message sent to eventd, longer ones are cut with an ellipsis (0 means no limit)");
+    _wec_define_integer(message, "max-length", max_length, 0, 100000, "300", "Maximum length (in characters) of a message sent to eventd, longer ones are cut with an ellipsis (0 means no limit)");
+
+    _wec_define_section(queue);
+    _wec_define_integer_full(queue, "max-size", max_size, 0, 1024 * 1024, "1024", "Maximum size (in KiB) of events waiting to be sent to eventd (0 means no limit)", _wec_settings_update);
+    _wec_define_enum_full(queue, "drop-policy", drop_policy, "oldest|newest", "oldest", "Which events to drop when the queue is full, among the least important ones", _wec_settings_update);
+    _wec_define_integer_full(queue, "shed-size", shed_size, 0, 1024 * 1024, "256", "Size (in KiB) of waiting events above which all but highlights and private messages are dropped, presence first (0 to disable)", _wec_settings_update);
+    _wec_define_integer_full(queue, "shed-age", shed_age, 0, 3600 * 1000, "30000", "Time (in milliseconds) events other than highlights and private messages may wait in the queue before being dropped, time spent in the spool excepted (0 to disable)", _wec_settings_update);
+
+    _wec_define_section(presence);
+    _wec_define_integer(presence, "window", window, 0, 60 * 1000, "2000", "Time window (in milliseconds) during which channel joins, leaves and quits are merged into a single event (0 to disable)");
+    _wec_define_integer(presence, "max-nicks", max_nicks, 0, 100, "10", "Maximum number of nicknames listed in a merged presence event");
+
+    _wec_define_section(playback);
+    _wec_define_integer(playback, "max-age", max_age, 0, 7 * 24 * 3600, "60", "Lines older than this (in seconds) are bouncer playback, summarized instead of sent (0 to only rely on chathistory and znc.in/playback batches)");
+    _wec_define_integer(playback, "summary-delay", summary_delay, 100, 60 * 1000, "2000", "Time (in milliseconds) without playback lines in a buffer after which its summary is sent");
+
+    _wec_define_section(flood);
+    _wec_define_integer(flood, "chat-rate", chat_rate, 0, 60 * 1000, "30", "Channel events per minute a nickname may cause in a buffer once its burst is used, further ones are folded into a single \"more\" event (0 to disable)");
+    _wec_define_integer(flood, "chat-burst", chat_burst, 1, 1000, "10", "Channel events a nickname may cause in a buffer in a row");
+    _wec_define_integer(flood, "im-rate", im_rate, 0, 60 * 1000, "30", "Private events per minute a nickname may cause in a buffer once its burst is used, further ones are folded into a single \"more\" event (0 to disable), only with flood.limit-high");
+    _wec_define_integer(flood, "im-burst", im_burst, 1, 1000, "10", "Private events a nickname may cause in a buffer in a row");
+    _wec_define_integer(flood, "presence-rate", presence_rate, 0, 60 * 1000, "10", "Presence events per minute a nickname may cause in a buffer once its burst is used, further ones are folded into a single \"more\" event (0 to disable)");
+    _wec_define_integer(flood, "presence-burst", presence_burst, 1, 1000, "5", "Presence events a nickname may cause in a buffer in a row");
+    _wec_define_integer(flood, "max-nicks", max_nicks, 1, 1000000, "1024", "Maximum number of nicknames tracked, the least recently seen are forgotten");
+    _wec_define_boolean(flood, "limit-high", limit_high, "off", "Also fold highlights, private messages and keyword matches");
+
+    _wec_define_section(nicks);
+    _wec_define_integer(nicks, "max-size", max_size, 0, 1000000, "4096", "Maximum number of nicknames per server whose host, account, away and op status are kept to be added to events (0 to disable)");
+
+    _wec_define_section(keywords);
+    _wec_define_string_full(keywords, "list", list, "", "A (space-separated) list of keyword sets, each a (comma-separated) list of keywords optionally prefixed by a buffer glob and \"=\" (e.g. \"weechat mybug-* freenode.#eventd=eventd,evp\"), matched as whole words ignoring ASCII case", _wec_keywords_update);
+
+    _wec_define_section(trace);
+    _wec_define_integer(trace, "dump-size", dump_size, 0, WEC_TRACE_SIZE, "20", "Number of trace records (lines, queue drops, connections) printed in the debug buffer (see /eventc debug) when a connection is lost (0 to disable)");
+
+    _wec_define_section(spool);
+    _wec_define_integer_full(spool, "max-size", max_size, 0, 1024 * 1024, "1024", "Maximum size (in KiB) of events kept while disconnected (0 means no limit)", _wec_settings_update);
+    _wec_define_boolean_full(spool, "file", file, "off", "Keep events in a file in WeeChat data directory while disconnected, and across restarts", _wec_spool_update);
+    _wec_define_integer_full(spool, "batch-size", batch_size, 1, 10000, "50", "Number of kept events to send at once after reconnecting", _wec_settings_update);
+    _wec_define_integer(spool, "persist-timeout", persist_timeout, 0, 10000, "200", "Maximum time (in milliseconds) spent sending or saving pending events on unload");
+
+    _wec_define_section(connection);
+    _wec_define_integer_full(connection, "retry-min", retry_min, 100, 3600 * 1000, "1000", "Minimum delay (in milliseconds) before trying to reconnect", _wec_settings_update);
+    _wec_define_integer_full(connection, "retry-max", retry_max, 100, 3600 * 1000, "60000", "Maximum delay (in milliseconds) before trying to reconnect", _wec_settings_update);
+    _wec_define_integer_full(connection, "connect-timeout", connect_timeout, 100, 60 * 1000, "5000", "Time (in milliseconds) after which a connection attempt is given up", _wec_settings_update);
+    _wec_define_string_full(connection, "endpoints", endpoints, "", "A (comma-separated) list of eventd addresses to send events to, each optionally followed by \"=\" and a (\"+\"-separated) list of category globs it gets (an empty address is the local eventd, e.g. \",relay.example.net:7100=chat+im\")", _wec_endpoints_update);
+    _wec_define_boolean_full(connection, "thread", thread, "off", "Send events from a separate thread, so eventd being slow or unreachable never delays WeeChat", _wec_delivery_update);
+
+    switch ( weechat_config_read(context->config.file) )
+    {
+    case WEECHAT_CONFIG_READ_OK:
+    break;
+    case WEECHAT_CONFIG_READ_MEMORY_ERROR:
+    break;
+    case WEECHAT_CONFIG_READ_FILE_NOT_FOUND:
+        weechat_config_write(context->config.file);
+    break;
+    }
+
+    /* events.notify used to default to "*", which blocked nothing but would now block everything */
+    struct t_config_option *notify = context->config.events.filters[WEC_EVENT_NOTIFY].option;
+    if ( strcmp(weechat_config_string(notify), "*") == 0 )
+        weechat_config_option_set(notify, "", 0);
+
+    WecEventKind kind;
+    for ( kind = 0 ; kind < _WEC_EVENT_SIZE ; ++kind )
+        _wec_process_filter(events, filters[kind]);
+    _wec_process_filter(restrictions, nick_filter);
+    _wec_settings_update(context, NULL, NULL);
+    _wec_endpoints_update(context, NULL, context->config.connection.endpoints);
+    _wec_keywords_update(context, NULL, context->config.keywords.list);
+    _wec_spool_update(context, NULL, context->config.spool.file);
+}
+
+static void
+_wec_config_uninit(WecContext *context)
+{
+    WecEventKind kind;
+    for ( kind = 0 ; kind < _WEC_EVENT_SIZE ; ++kind )
+        _wec_clean_filter(events, filters[kind]);
+    _wec_clean_filter(restrictions, nick_filter);
+}
+
+static void
+_wec_buffer_free(gpointer data)
+{
+    WecBuffer *self = data;
+
+    g_free(self->name);
+    g_free(self->server);
+
+    g_slice_free(WecBuffer, self);
+}
+
+/*
+ * Compile every event filter into one bitmask of allowed kinds,
+ * so a line only needs the WecBuffer lookup to know its verdict
+ */
+static void
+_wec_buffer_update_filters(WecContext *context, WecBuffer *self)
+{
+    self->filters_serial = context->filters_serial;
+    self->allowed = 0;
+
+    if ( ! self->irc )
+        return;
+
+    WecEventKind kind;
+    for ( kind = 0 ; kind < _WEC_EVENT_SIZE ; ++kind )
+    {
+        if ( ! _wec_filter_ignore(&context->config.events.filters[kind], self->server, self->name) )
+            self->allowed |= ( 1 << kind );
+    }
+
+    self->keywords = 0;
+    if ( ( self->allowed & ( 1 << WEC_EVENT_KEYWORD ) ) == 0 )
+        return;
+
+    guint i;
+    for ( i = 0 ; i < context->keyword_sets->len ; ++i )
+    {
+        WecMatcher *matcher = g_ptr_array_index(context->keyword_sets, i);
+        if ( wec_matcher_match(matcher, self->name) || ( ( self->server != NULL ) && wec_matcher_match_qualified(matcher, self->server, self->name) ) )
+            self->keywords |= ( G_GUINT64_CONSTANT(1) << i );
+    }
+}
+
+/*
+ * Lines are searched with colors stripped, as they will be sent
+ */
+static const gchar *
+_wec_keywords_search(WecContext *context, WecBuffer *wbuffer, const gchar *message)
+{
+    if ( ( wbuffer->keywords == 0 ) || ( message == NULL ) || wec_keywords_is_empty(context->keywords) )
+        return NULL;
+
+    g_string_truncate(context->scratch, 0);
+    wec_encoder_strip_text(context->scratch, message, -1);
+    return wec_keywords_search(context->keywords, context->scratch->str, context->scratch->len, wbuffer->keywords);
+}
+
+static gpointer
+_wec_server_find(struct t_hdata *hdata, const gchar *server)
+{
+    gpointer ptr;
+
+    if ( ( server == NULL ) || ( hdata == NULL ) )
+        return NULL;
+
+    for ( ptr = weechat_hdata_get_list(hdata, "irc_servers") ; ptr != NULL ; ptr = weechat_hdata_move(hdata, ptr, 1) )
+    {
+        if ( g_strcmp0(weechat_hdata_string(hdata, ptr, "name"), server) == 0 )
+            return ptr;
+    }
+
+    return NULL;
+}
+
+static WecCasemapping
+_wec_server_casemapping(const gchar *server)
+{
+    struct t_hdata *hdata = weechat_hdata_get("irc_server");
+    gpointer ptr = _wec_server_find(hdata, server);
+
+    if ( ptr == NULL )
+        return WEC_CASEMAPPING_RFC1459;
+
+    gint casemapping = weechat_hdata_integer(hdata, ptr, "casemapping");
+    if ( ( casemapping < 0 ) || ( casemapping >= _WEC_CASEMAPPING_SIZE ) )
+        return WEC_CASEMAPPING_RFC1459;
+    return casemapping;
+}
+
+/*
+ * The irc plugin keeps the ISUPPORT PREFIX and CHANMODES it got
+ */
+static void
+_wec_server_modes(const gchar *server, WecNicks *nicks)
+{
+    struct t_hdata *hdata = weechat_hdata_get("irc_server");
+    gpointer ptr = _wec_server_find(hdata, server);
+
+    if ( ptr == NULL )
+    {
+        wec_nicks_set_modes(nicks, NULL, NULL, NULL);
+        return;
+    }
+
+    wec_nicks_set_modes(nicks, weechat_hdata_string(hdata, ptr, "prefix_modes"), weechat_hdata_string(hdata, ptr, "prefix_chars"), weechat_hdata_string(hdata, ptr, "chanmodes"));
+}
+
+/*
+ * Nickname details, fed by the irc plugin signals
+ *
+ * One cache per server, kept until unload so buffers can hold on to it
+ */
+static WecNicks *
+_wec_nicks_get(WecContext *context, const gchar *server)
+{
+    WecNicks *nicks = g_hash_table_lookup(context->nicks, server);
+    if ( nicks == NULL )
+    {
+        nicks = wec_nicks_new(_wec_server_casemapping(server));
+        _wec_server_modes(server, nicks);
+        g_hash_table_insert(context->nicks, g_strdup(server), nicks);
+    }
+    return nicks;
+}
+
+static gint
+_wec_nicks_callback(gconstpointer user_data, gpointer data, const gchar *signal, const gchar *type_data, gpointer signal_data)
+{
+    WecContext *context = (WecContext *) user_data;
+    gint max_size = _wec_config_integer(nicks, max_size);
+
+    if ( ( max_size <= 0 ) || ( signal_data == NULL ) )
+        return WEECHAT_RC_OK;
+
+    const gchar *comma = strchr(signal, ',');
+    if ( comma == NULL )
+        return WEECHAT_RC_OK;
+
+    gchar *server = g_strndup(signal, comma - signal);
+    wec_nicks_message(_wec_nicks_get(context, server), signal_data, max_size);
+    g_free(server);
+
+    return WEECHAT_RC_OK;
+}
+
+static gint
+_wec_nicks_disconnected_callback(gconstpointer user_data, gpointer data, const gchar *signal, const gchar *type_data, gpointer signal_data)
+{
+    WecContext *context = (WecContext *) user_data;
+
+    WecNicks *nicks = g_hash_table_lookup(context->nicks, signal_data);
+    if ( nicks != NULL )
+        wec_nicks_clear(nicks);
+
+    return WEECHAT_RC_OK;
+}
+
+static void
+_wec_nicks_hook(WecContext *context)
+{
+    static const gchar * const signals[] = {
+        "*,irc_in2_join",
+        "*,irc_in2_part",
+        "*,irc_in2_kick",
+        "*,irc_in2_quit",
+        "*,irc_in2_nick",
+        "*,irc_in2_away",
+        "*,irc_in2_account",
+        "*,irc_in2_chghost",
+        "*,irc_in2_mode",
+        /* NAMES, WHO and WHOIS replies */
+        "*,irc_in2_353",
+        "*,irc_in2_352",
+        "*,irc_in2_311",
+        "*,irc_in2_330",
+        "*,irc_in2_301",
+    };
+    G_STATIC_ASSERT(G_N_ELEMENTS(signals) + 1 == G_N_ELEMENTS(context->nicks_hooks));
+    guint i;
+
+    for ( i = 0 ; i < G_N_ELEMENTS(signals) ; ++i )
+        context->nicks_hooks[i] = weechat_hook_signal(signals[i], _wec_nicks_callback, context, NULL);
+    context->nicks_hooks[i] = weechat_hook_signal("irc_server_disconnected", _wec_nicks_disconnected_callback, context, NULL);
+}
+
+static WecBuffer *
+_wec_buffer_get(WecContext *context, struct t_gui_buffer *buffer)
+{
+    WecBuffer *self;
+
+    self = g_hash_table_lookup(context->buffers, buffer);
+    if ( G_LIKELY(self != NULL) )
+    {
+        if ( G_UNLIKELY(self->filters_serial != context->filters_serial) )
+            _wec_buffer_update_filters(context, self);
+        return self;
+    }
+
+    self = g_slice_new0(WecBuffer);
+
+    self->irc = ( g_strcmp0(weechat_buffer_get_string(buffer, "plugin"), "irc") == 0 );
+    if ( self->irc )
+    {
+        const gchar *type = weechat_buffer_get_string(buffer, "localvar_type");
+        if ( g_strcmp0(type, "channel") == 0 )
+            self->type = WEC_BUFFER_TYPE_CHANNEL;
+        else if ( g_strcmp0(type, "private") == 0 )
+            self->type = WEC_BUFFER_TYPE_PRIVATE;
+
+        self->server = g_strdup(weechat_buffer_get_string(buffer, "localvar_server"));
+        self->casemapping = _wec_server_casemapping(self->server);
+        if ( self->server != NULL )
+            self->nicks = _wec_nicks_get(context, self->server);
+        if ( self->type != WEC_BUFFER_TYPE_OTHER )
+            self->name = g_strdup(weechat_buffer_get_string(buffer, "localvar_channel"));
+    }
+
+    _wec_buffer_update_filters(context, self);
+    g_hash_table_insert(context->buffers, buffer, self);
+
+    return self;
+}
+
+/*
+ * Presence storms (netsplits, bouncer reconnections)
+ *
+ * The first join/leave/quit in a buffer is sent right away and opens a
+ * window; the following ones are counted and sent as one summary event
+ * when the window closes
+ */
+enum {
+    WEC_PRESENCE_JOIN,
+    WEC_PRESENCE_LEAVE,
+    WEC_PRESENCE_QUIT,
+    _WEC_PRESENCE_SIZE
+};
+
+typedef struct {
+    WecContext *context;
+    struct t_gui_buffer *buffer;
+    gchar *channel;
+    struct t_hook *timer;
+    guint count[_WEC_PRESENCE_SIZE];
+    GPtrArray *nicks;
+    guint more;
+} WecPresenceWindow;
+
+static void
+_wec_presence_window_free(gpointer data)
+{
+    WecPresenceWindow *self = data;
+
+    if ( self->timer != NULL )
+        weechat_unhook(self->timer);
+
+    g_ptr_array_unref(self->nicks);
+    g_free(self->channel);
+
+    g_slice_free(WecPresenceWindow, self);
+}
+
+static void
+_wec_presence_window_flush(WecPresenceWindow *self)
+{
+    WecContext *context = self->context;
+    guint total = self->count[WEC_PRESENCE_JOIN] + self->count[WEC_PRESENCE_LEAVE] + self->count[WEC_PRESENCE_QUIT];
+
+    if ( total == 0 )
+        return;
+
+    static const gchar * const verbs[_WEC_PRESENCE_SIZE] = {
+        [WEC_PRESENCE_JOIN] = "joined",
+        [WEC_PRESENCE_LEAVE] = "left",
+        [WEC_PRESENCE_QUIT] = "quit",
+    };
+    GString *message = g_string_new(NULL);
+    guint i;
+    for ( i = 0 ; i < _WEC_PRESENCE_SIZE ; ++i )
+    {
+        if ( self->count[i] == 0 )
+            continue;
+        if ( message->len > 0 )
+            g_string_append(message, ", ");
+        g_string_append_printf(message, "%u %s", self->count[i], verbs[i]);
+    }
+
+    g_ptr_array_add(self->nicks, NULL);
+    gchar *nicks = g_strjoinv(", ", (gchar **) self->nicks->pdata);
+    g_ptr_array_set_size(self->nicks, self->nicks->len - 1);
+
+    if ( self->nicks->len > 0 )
+    {
+        g_string_append_printf(message, ": %s", nicks);
+        if ( self->more > 0 )
+            g_string_append_printf(message, " and %u more", self->more);
+    }
+
+    static const gchar * const keys[_WEC_PRESENCE_SIZE] = {
+        [WEC_PRESENCE_JOIN] = "joins",
+        [WEC_PRESENCE_LEAVE] = "leaves",
+        [WEC_PRESENCE_QUIT] = "quits",
+    };
+    gchar count[sizeof("4294967295")];
+
+    _wec_event_begin(context, WEC_QUEUE_PRIORITY_PRESENCE, "presence", "summary");
+    wec_encoder_add(context->encoder, "channel", self->channel, -1);
+    wec_encoder_add(context->encoder, "buddy-names", nicks, -1);
+    for ( i = 0 ; i < _WEC_PRESENCE_SIZE ; ++i )
+    {
+        g_snprintf(count, sizeof(count), "%u", self->count[i]);
+        wec_encoder_add(context->encoder, keys[i], count, -1);
+    }
+    wec_encoder_add(context->encoder, "message", message->str, message->len);
+    _wec_send_event(context);
+
+    g_free(nicks);
+    g_string_free(message, TRUE);
+}
+
+static gint
+_wec_presence_window_close(gconstpointer user_data, gpointer data, gint remaining_calls)
+{
+    WecPresenceWindow *self = (WecPresenceWindow *) user_data;
+    WecContext *context = self->context;
+
+    /* WeeChat removes the hook itself after the last call */
+    self->timer = NULL;
+
+    _wec_presence_window_flush(self);
+    g_hash_table_remove(context->presence, self->buffer);
+
+    return WEECHAT_RC_OK;
+}
+
+/*
+ * Returns TRUE if the event was merged in an open window
+ */
+static gboolean
+_wec_presence_aggregate(WecContext *context, struct t_gui_buffer *buffer, WecBuffer *wbuffer, WecEventKind kind, const gchar *nick)
+{
+    gint window = _wec_config_integer(presence, window);
+    if ( window <= 0 )
+        return FALSE;
+
+    WecPresenceWindow *self = g_hash_table_lookup(context->presence, buffer);
+    if ( self == NULL )
+    {
+        self = g_slice_new0(WecPresenceWindow);
+        self->context = context;
+        self->buffer = buffer;
+        self->channel = g_strdup(wbuffer->name);
+        self->nicks = g_ptr_array_new_with_free_func(g_free);
+        self->timer = weechat_hook_timer(window, 0, 1, _wec_presence_window_close, self, NULL);
+        g_hash_table_insert(context->presence, buffer, self);
+        return FALSE;
+    }
+
+    switch ( kind )
+    {
+    case WEC_EVENT_JOIN:
+        ++self->count[WEC_PRESENCE_JOIN];
+    break;
+    case WEC_EVENT_LEAVE:
+        ++self->count[WEC_PRESENCE_LEAVE];
+    break;
+    case WEC_EVENT_QUIT:
+        ++self->count[WEC_PRESENCE_QUIT];
+    break;
+    default:
+        g_return_val_if_reached(FALSE);
+    }
+
+    /* A NULL would end the list early when joined, an unnamed one is only counted */
+    if ( ( nick != NULL ) && ( self->nicks->len < (guint) _wec_config_integer(presence, max_nicks) ) )
+        g_ptr_array_add(self->nicks, g_strdup(nick));
+    else
+        ++self->more;
+
+    return TRUE;
+}
+
+/*
+ * Bouncer playback (ZNC, soju, chathistory)
+ *
+ * Old lines, or lines in a history batch, are only counted, and a buffer gets a single
+ * summary event once no playback line came for playback.summary-delay
+ */
+typedef struct {
+    WecContext *context;
+    struct t_gui_buffer *buffer;
+    WecBufferType type;
+    gchar *name;
+    struct t_hook *timer;
+    gint64 last;
+    guint messages;
+    guint highlights;
+} WecPlaybackWindow;
+
+static void
+_wec_playback_window_free(gpointer data)
+{
+    WecPlaybackWindow *self = data;
+
+    if ( self->timer != NULL )
+        weechat_unhook(self->timer);
+
+    g_free(self->name);
+
+    g_slice_free(WecPlaybackWindow, self);
+}
+
+static void
+_wec_playback_window_flush(WecPlaybackWindow *self)
+{
+    WecContext *context = self->context;
+
+    if ( self->messages == 0 )
+        return;
+
+    const gchar *category = ( self->type == WEC_BUFFER_TYPE_CHANNEL ) ? "chat" : "im";
+    GString *message = g_string_new(NULL);
+    g_string_append_printf(message, "%u missed message%s", self->messages, ( self->messages > 1 ) ? "s" : "");
+    if ( self->highlights > 0 )
+        g_string_append_printf(message, ", %u highlight%s", self->highlights, ( self->highlights > 1 ) ? "s" : "");
+    if ( self->name != NULL )
+        g_string_append_printf(message, ( self->type == WEC_BUFFER_TYPE_CHANNEL ) ? " in %s" : " from %s", self->name);
+
+    gchar count[sizeof("4294967295")];
+
+    _wec_event_begin(context, ( self->highlights > 0 ) ? WEC_QUEUE_PRIORITY_HIGH : WEC_QUEUE_PRIORITY_CHAT, category, "missed");
+    if ( self->name != NULL )
+        wec_encoder_add(context->encoder, ( self->type == WEC_BUFFER_TYPE_CHANNEL ) ? "channel" : "buddy-name", self->name, -1);
+    g_snprintf(count, sizeof(count), "%u", self->messages);
+    wec_encoder_add(context->encoder, "messages", count, -1);
+    g_snprintf(count, sizeof(count), "%u", self->highlights);
+    wec_encoder_add(context->encoder, "highlights", count, -1);
+    wec_encoder_add(context->encoder, "message", message->str, message->len);
+    _wec_send_event(context);
+
+    g_string_free(message, TRUE);
+}
+
+static gint
+_wec_playback_window_close(gconstpointer user_data, gpointer data, gint remaining_calls)
+{
+    WecPlaybackWindow *self = (WecPlaybackWindow *) user_data;
+    WecContext *context = self->context;
+
+    /* WeeChat removes the hook itself after the last call */
+    self->timer = NULL;
+
+    /* Still replaying, wait for the rest */
+    gint64 delay = _wec_config_integer(playback, summary_delay);
+    gint64 idle = ( g_get_monotonic_time() - self->last ) / 1000;
+    if ( idle < delay )
+    {
+        self->timer = weechat_hook_timer(delay - idle, 0, 1, _wec_playback_window_close, self, NULL);
+        return WEECHAT_RC_OK;
+    }
+
+    _wec_playback_window_flush(self);
+    g_hash_table_remove(context->playback, self->buffer);
+
+    return WEECHAT_RC_OK;
+}
+
+static void
+_wec_playback_aggregate(WecContext *context, struct t_gui_buffer *buffer, WecBuffer *wbuffer, WecEventKind kind)
+{
+    WecPlaybackWindow *self = g_hash_table_lookup(context->playback, buffer);
+    if ( self == NULL )
+    {
+        self = g_slice_new0(WecPlaybackWindow);
+        self->context = context;
+        self->buffer = buffer;
+        self->type = wbuffer->type;
+        self->name = g_strdup(wbuffer->name);
+        self->timer = weechat_hook_timer(_wec_config_integer(playback, summary_delay), 0, 1, _wec_playback_window_close, self, NULL);
+        g_hash_table_insert(context->playback, buffer, self);
+    }
+    self->last = g_get_monotonic_time();
+
+    switch ( kind )
+    {
+    case WEC_EVENT_HIGHLIGHT:
+    case WEC_EVENT_KEYWORD:
+        ++self->highlights;
+    /* fallthrough */
+    case WEC_EVENT_CHAT:
+    case WEC_EVENT_IM:
+    case WEC_EVENT_NOTICE:
+        ++self->messages;
+    break;
+    /* Stale presence is just dropped */
+    default:
+    break;
+    }
+}
+
+/*
+ * Flood protection
+ *
+ * Each (buffer, category, nick) gets a token bucket; once it is empty,
+ * lines are only counted and a single "more" event tells how many were
+ * folded when the next token comes.
+ * Buckets live in a bounded table, the least recently used go first.
+ * High priority events skip it, unless flood.limit-high is on.
+ */
+typedef enum {
+    WEC_FLOOD_CHAT,
+    WEC_FLOOD_IM,
+    WEC_FLOOD_PRESENCE,
+    _WEC_FLOOD_SIZE
+} WecFloodCategory;
+
+static const gchar * const _wec_flood_categories[_WEC_FLOOD_SIZE] = {
+    [WEC_FLOOD_CHAT] = "chat",
+    [WEC_FLOOD_IM] = "im",
+    [WEC_FLOOD_PRESENCE] = "presence",
+};
+
+typedef struct {
+    struct t_gui_buffer *buffer;
+    WecFloodCategory category;
+    const gchar *nick;
+} WecFloodKey;
+
+typedef struct {
+    /* First, the table uses it as the key */
+    WecFloodKey key;
+    /* In context->flood_lru, most recent first */
+    GList link;
+    WecContext *context;
+    gchar *channel;
+    gdouble tokens;
+    gint64 last;
+    guint folded;
+    WecQueuePriority priority;
+    struct t_hook *timer;
+    gchar nick[];
+} WecFloodBucket;
+
+static guint
+_wec_flood_key_hash(gconstpointer data)
+{
+    const WecFloodKey *key = data;
+    return g_direct_hash(key->buffer) ^ ( key->category * 31 ) ^ g_str_hash(key->nick);
+}
+
+static gboolean
+_wec_flood_key_equal(gconstpointer a, gconstpointer b)
+{
+    const WecFloodKey *ka = a, *kb = b;
+    return ( ka->buffer == kb->buffer ) && ( ka->category == kb->category ) && ( strcmp(ka->nick, kb->nick) == 0 );
+}
+
+static void
+_wec_flood_bucket_free(gpointer data)
+{
+    WecFloodBucket *self = data;
+
+    if ( self->timer != NULL )
+        weechat_unhook(self->timer);
+    g_queue_unlink(&self->context->flood_lru, &self->link);
+
+    g_free(self->channel);
+    g_free(self);
+}
+
+static void
+_wec_flood_bucket_flush(WecFloodBucket *self)
+{
+    WecContext *context = self->context;
+
+    if ( self->folded == 0 )
+        return;
+
+    gchar *message = g_strdup_printf("and %u more from %s", self->folded, self->key.nick);
+    gchar count[sizeof("4294967295")];
+    g_snprintf(count, sizeof(count), "%u", self->folded);
+
+    _wec_event_begin(context, self->priority, _wec_flood_categories[self->key.category], "more");
+    wec_encoder_add(context->encoder, "buddy-name", self->key.nick, -1);
+    if ( self->channel != NULL )
+        wec_encoder_add(context->encoder, "channel", self->channel, -1);
+    wec_encoder_add(context->encoder, "count", count, -1);
+    wec_encoder_add(context->encoder, "message", message, -1);
+    _wec_send_event(context);
+
+    g_free(message);
+    self->folded = 0;
+}
+
+static gint
+_wec_flood_bucket_timeout(gconstpointer user_data, gpointer data, gint remaining_calls)
+{
+    WecFloodBucket *self = (WecFloodBucket *) user_data;
+
+    /* WeeChat removes the hook itself after the last call */
+    self->timer = NULL;
+
+    /* The folded lines take the token we waited for */
+    _wec_flood_bucket_flush(self);
+    self->tokens = 0;
+    self->last = g_get_monotonic_time();
+
+    return WEECHAT_RC_OK;
+}
+
+/*
+ * Sends what is pending and forgets the buckets of a buffer
+ */
+static void
+_wec_flood_forget_buffer(WecContext *context, struct t_gui_buffer *buffer)
+{
+    GList *link = context->flood_lru.head;
+    while ( link != NULL )
+    {
+        WecFloodBucket *self = link->data;
+        link = link->next;
+        if ( self->key.buffer != buffer )
+            continue;
+        _wec_flood_bucket_flush(self);
+        g_hash_table_remove(context->flood, &self->key);
+    }
+}
+
+#define _wec_flood_setting(category, name) ( \
+        ( category == WEC_FLOOD_CHAT ) ? _wec_config_integer(flood, chat_ ## name) : \
+        ( category == WEC_FLOOD_IM ) ? _wec_config_integer(flood, im_ ## name) : \
+        _wec_config_integer(flood, presence_ ## name) \
+    )
+/*
+ * Returns FALSE if the line was folded
+ */
+static gboolean
+_wec_flood_allow(WecContext *context, struct t_gui_buffer *buffer, WecBuffer *wbuffer, const gchar *category, WecQueuePriority priority, const gchar *nick)
+{
+    WecFloodCategory fcategory;
+    for ( fcategory = 0 ; fcategory < _WEC_FLOOD_SIZE ; ++fcategory )
+    {
+        if ( strcmp(category, _wec_flood_categories[fcategory]) == 0 )
+            break;
+    }
+    if ( fcategory == _WEC_FLOOD_SIZE )
+        return TRUE;
+    /* Their latency matters more than the noise */
+    if ( ( priority == WEC_QUEUE_PRIORITY_HIGH ) && ( ! _wec_config_boolean(flood, limit_high) ) )
+        return TRUE;
+    /* The bench measures the send path, not the folding */
+    if ( wbuffer->bench )
+        return TRUE;
+
+    /* Per minute */
+    gint rate = _wec_flood_setting(fcategory, rate);
+    if ( rate <= 0 )
+        return TRUE;
+    gint burst = MAX(_wec_flood_setting(fcategory, burst), 1);
+
+    WecFloodKey key = {
+        .buffer = buffer,
+        .category = fcategory,
+        .nick = nick,
+    };
+    gint64 now = g_get_monotonic_time();
+    WecFloodBucket *self = g_hash_table_lookup(context->flood, &key);
+    if ( self == NULL )
+    {
+        gsize length = strlen(nick) + 1;
+        self = g_malloc0(sizeof(WecFloodBucket) + length);
+        memcpy(self->nick, nick, length);
+        self->key.buffer = buffer;
+        self->key.category = fcategory;
+        self->key.nick = self->nick;
+        self->link.data = self;
+        self->context = context;
+        if ( wbuffer->type == WEC_BUFFER_TYPE_CHANNEL )
+            self->channel = g_strdup(wbuffer->name);
+        self->tokens = burst;
+        self->last = now;
+        g_hash_table_insert(context->flood, &self->key, self);
+        g_queue_push_head_link(&context->flood_lru, &self->link);
+
+        guint max = MAX(_wec_config_integer(flood, max_nicks), 1);
+        while ( context->flood_lru.length > max )
+        {
+            WecFloodBucket *oldest = context->flood_lru.tail->data;
+            _wec_flood_bucket_flush(oldest);
+            g_hash_table_remove(context->flood, &oldest->key);
+        }
+    }
+    else
+    {
+        self->tokens = MIN(self->tokens + ( now - self->last ) * rate / ( 60.0 * G_USEC_PER_SEC ), burst);
+        self->last = now;
+        g_queue_unlink(&context->flood_lru, &self->link);
+        g_queue_push_head_link(&context->flood_lru, &self->link);
+    }
+
+    if ( ( self->folded == 0 ) && ( self->tokens >= 1 ) )
+    {
+        self->tokens -= 1;
+        return TRUE;
+    }
+
+    if ( self->folded++ == 0 )
+    {
+        self->priority = priority;
+        gint64 wait = ( 1 - self->tokens ) * 60 * 1000 / rate;
+        self->timer = weechat_hook_timer(MAX(wait, 100), 0, 1, _wec_flood_bucket_timeout, self, NULL);
+    }
+    else
+        self->priority = MIN(self->priority, priority);
+
+    return FALSE;
+}
+#undef _wec_flood_setting
+
+/*
+ * Returns the length of the quoted part of s, and moves s to its start
+ */
+static gssize
+_wec_split_message(const gchar **s)
+{
+    const gchar *c1, *c2;
+    c1 = strchr(*s, '"');
+    if ( c1 == NULL )
+        return -1;
+    ++c1;
+
+    c2 = strchr(c1, '"');
+    if ( c2 == NULL )
+        return -1;
+
+    *s = c1;
+    return c2 - c1;
+}
+
+typedef enum {
+    WEC_TAG_NONE,
+    WEC_TAG_ABORT,
+    WEC_TAG_NICK,
+    WEC_TAG_PLAYBACK,
+    WEC_TAG_ACTION,
+    WEC_TAG_PRIVMSG,
+    WEC_TAG_NOTICE,
+    WEC_TAG_NOTIFY_JOIN,
+    WEC_TAG_NOTIFY_QUIT,
+    WEC_TAG_NOTIFY_BACK,
+    WEC_TAG_NOTIFY_AWAY,
+    WEC_TAG_NOTIFY_STILL_AWAY,
+    WEC_TAG_JOIN,
+    WEC_TAG_LEAVE,
+    WEC_TAG_QUIT,
+} WecTagAction;
+
+#define _wec_tag_is(tag, s) ( strcmp(tag, s) == 0 )
+/*
+ * Map a tag to what it means for us
+ *
+ * We dispatch on the first distinguishing character, so each tag costs
+ * one switch and at most one string comparison
+ */
+static WecTagAction
+_wec_tag_classify(const gchar *tag)
+{
+    switch ( tag[0] )
+    {
+    case 'a':
+        if ( _wec_tag_is(tag, "away_info") )
+            return WEC_TAG_ABORT;
+    break;
+    case 'n':
+        if ( ( tag[1] == 'i' ) && ( strncmp(tag, "nick_", strlen("nick_")) == 0 ) )
+            return WEC_TAG_NICK;
+        if ( ( tag[1] == 'o' ) && _wec_tag_is(tag, "notify_none") )
+            return WEC_TAG_ABORT;
+    break;
+    case 'i':
+        if ( strncmp(tag, "irc_", strlen("irc_")) != 0 )
+            break;
+        tag += strlen("irc_");
+        switch ( tag[0] )
+        {
+        case 'a':
+            if ( _wec_tag_is(tag, "action") )
+                return WEC_TAG_ACTION;
+        break;
+        case 'b':
+            /* Only history batches, netsplit and netjoin ones are live presence */
+            if ( strncmp(tag, "batch_type_", strlen("batch_type_")) != 0 )
+                break;
+            tag += strlen("batch_type_");
+            if ( _wec_tag_is(tag, "chathistory") || _wec_tag_is(tag, "znc.in/playback") )
+                return WEC_TAG_PLAYBACK;
+        break;
+        case 'p':
+            if ( _wec_tag_is(tag, "privmsg") )
+                return WEC_TAG_PRIVMSG;
+            if ( _wec_tag_is(tag, "part") )
+                return WEC_TAG_LEAVE;
+        break;
+        case 'n':
+            if ( _wec_tag_is(tag, "notice") )
+                return WEC_TAG_NOTICE;
+            if ( strncmp(tag, "notify_", strlen("notify_")) != 0 )
+                break;
+            tag += strlen("notify_");
+            switch ( tag[0] )
+            {
+            case 'j':
+                if ( _wec_tag_is(tag, "join") )
+                    return WEC_TAG_NOTIFY_JOIN;
+            break;
+            case 'q':
+                if ( _wec_tag_is(tag, "quit") )
+                    return WEC_TAG_NOTIFY_QUIT;
+            break;
+            case 'b':
+                if ( _wec_tag_is(tag, "back") )
+                    return WEC_TAG_NOTIFY_BACK;
+            break;
+            case 'a':
+                if ( _wec_tag_is(tag, "away") )
+                    return WEC_TAG_NOTIFY_AWAY;
+            break;
+            case 's':
+                if ( _wec_tag_is(tag, "still_away") )
+                    return WEC_TAG_NOTIFY_STILL_AWAY;
+            break;
+            }
+        break;
+        case 'j':
+            if ( _wec_tag_is(tag, "join") )
+                return WEC_TAG_JOIN;
+        break;
+        case 'k':
+            if ( _wec_tag_is(tag, "kick") )
+                return WEC_TAG_LEAVE;
+        break;
+        case 'q':
+            if ( _wec_tag_is(tag, "quit") )
+                return WEC_TAG_QUIT;
+        break;
+        }
+    break;
+    }
+    return WEC_TAG_NONE;
+}
+#undef _wec_tag_is
+
+/* Which queue lane each kind of event goes to */
+static const WecQueuePriority _wec_event_priorities[_WEC_EVENT_SIZE] = {
+    [WEC_EVENT_HIGHLIGHT] = WEC_QUEUE_PRIORITY_HIGH,
+    [WEC_EVENT_CHAT] = WEC_QUEUE_PRIORITY_CHAT,
+    [WEC_EVENT_IM] = WEC_QUEUE_PRIORITY_HIGH,
+    [WEC_EVENT_NOTICE] = WEC_QUEUE_PRIORITY_NOTICE,
+    [WEC_EVENT_NOTIFY] = WEC_QUEUE_PRIORITY_PRESENCE,
+    [WEC_EVENT_JOIN] = WEC_QUEUE_PRIORITY_PRESENCE,
+    [WEC_EVENT_LEAVE] = WEC_QUEUE_PRIORITY_PRESENCE,
+    [WEC_EVENT_QUIT] = WEC_QUEUE_PRIORITY_PRESENCE,
+    [WEC_EVENT_KEYWORD] = WEC_QUEUE_PRIORITY_HIGH,
+};
+
+/* With what the filter looked at, for the filter__reject probe */
+#define _wec_print_reject(verdict, detail) G_STMT_START { \
+        WEC_PROBE3(filter__reject, buffer, verdict, detail); \
+        return verdict; \
+    } G_STMT_END
+
+static WecStatsLine
+_wec_print_line(WecContext *context, struct t_gui_buffer *buffer, time_t date, gint tags_count, const gchar **tags, gint displayed, gint highlight, const gchar *message)
+{
+    if ( ( ! displayed ) || ( buffer == NULL ) )
+        return WEC_STATS_LINE_HIDDEN;
+
+    /*
+     * First pass: only look at the tags, most lines stop here
+     */
+    WecTagAction action = WEC_TAG_NONE;
+    const gchar *nick = NULL;
+    gboolean playback = FALSE;
+    /* Comes with irc_privmsg, in either order */
+    gboolean is_action = FALSE;
+
+    gint i;
+    for ( i = 0 ; i < tags_count  ; ++i )
+    {
+        WecTagAction tag_action = _wec_tag_classify(tags[i]);
+        switch ( tag_action )
+        {
+        case WEC_TAG_NONE:
+        break;
+        case WEC_TAG_ABORT:
+            return WEC_STATS_LINE_TAG;
+        case WEC_TAG_NICK:
+            nick = tags[i] + strlen("nick_");
+        break;
+        case WEC_TAG_PLAYBACK:
+            playback = TRUE;
+        break;
+        case WEC_TAG_ACTION:
+            is_action = TRUE;
+        break;
+        default:
+            action = tag_action;
+        break;
+        }
+    }
+
+    if ( ( action == WEC_TAG_NONE ) || ( nick == NULL ) )
+        return WEC_STATS_LINE_TAG;
+
+    /*
+     * Now we know the line may be interesting, look at the buffer
+     */
+    WecBuffer *wbuffer = _wec_buffer_get(context, buffer);
+    if ( ! wbuffer->irc )
+        _wec_print_reject(WEC_STATS_LINE_PLUGIN, NULL);
+
+    if ( _wec_config_boolean(restrictions, ignore_current_buffer) && ( buffer == context->current_buffer ) )
+        _wec_print_reject(WEC_STATS_LINE_CURRENT_BUFFER, NULL);
+
+    const gchar *category = NULL;
+    const gchar *name = NULL;
+    WecEventKind kind;
+
+    const gchar *channel = NULL;
+    const gchar *keyword = NULL;
+    gboolean split_message = FALSE;
+
+    switch ( wbuffer->type )
+    {
+    case WEC_BUFFER_TYPE_CHANNEL:
+        category = "chat";
+        channel = wbuffer->name;
+    break;
+    case WEC_BUFFER_TYPE_PRIVATE:
+        category = "im";
+    break;
+    case WEC_BUFFER_TYPE_OTHER:
+    break;
+    }
+
+    switch ( action )
+    {
+    case WEC_TAG_PRIVMSG:
+        name = "received";
+        if ( highlight )
+        {
+            kind = WEC_EVENT_HIGHLIGHT;
+            name = "highlight";
+        }
+        else if ( ( keyword = _wec_keywords_search(context, wbuffer, message) ) != NULL )
+        {
+            kind = WEC_EVENT_KEYWORD;
+            name = "keyword";
+        }
+        else if ( channel != NULL )
+            kind = WEC_EVENT_CHAT;
+        else
+            kind = WEC_EVENT_IM;
+        /* A /me is still a channel or private message, the action filter comes on top */
+        if ( is_action && ( ( kind == WEC_EVENT_CHAT ) || ( kind == WEC_EVENT_IM ) ) && ( ( wbuffer->allowed & ( 1 << WEC_EVENT_ACTION ) ) == 0 ) )
+            _wec_print_reject(WEC_STATS_LINE_EVENT_FILTER, name);
+    break;
+    case WEC_TAG_NOTICE:
+        category = "im";
+        name = "received";
+        if ( highlight )
+        {
+            kind = WEC_EVENT_HIGHLIGHT;
+            name = "highlight";
+        }
+        else
+            kind = WEC_EVENT_NOTICE;
+    break;
+    case WEC_TAG_NOTIFY_JOIN:
+        kind = WEC_EVENT_NOTIFY;
+        category = "presence";
+        name = "signed-on";
+    break;
+    case WEC_TAG_NOTIFY_QUIT:
+        kind = WEC_EVENT_NOTIFY;
+        category = "presence";
+        name = "signed-off";
+    break;
+    case WEC_TAG_NOTIFY_BACK:
+        kind = WEC_EVENT_NOTIFY;
+        category = "presence";
+        name = "back";
+    break;
+    case WEC_TAG_NOTIFY_AWAY:
+        kind = WEC_EVENT_NOTIFY;
+        category = "presence";
+        name = "away";
+        split_message = TRUE;
+    break;
+    case WEC_TAG_NOTIFY_STILL_AWAY:
+        kind = WEC_EVENT_NOTIFY;
+        category = "presence";
+        name = "message";
+        split_message = TRUE;
+    break;
+    case WEC_TAG_JOIN:
+        kind = WEC_EVENT_JOIN;
+        category = "presence";
+        name = "join";
+    break;
+    case WEC_TAG_LEAVE:
+        kind = WEC_EVENT_LEAVE;
+        category = "presence";
+        name = "leave";
+    break;
+    case WEC_TAG_QUIT:
+        kind = WEC_EVENT_QUIT;
+        category = "presence";
+        name = "signed-off";
+    break;
+    default:
+        g_return_val_if_reached(WEC_STATS_LINE_TAG);
+    }
+
+    if ( category == NULL )
+        _wec_print_reject(WEC_STATS_LINE_EVENT_FILTER, name);
+
+    if ( ( wbuffer->allowed & ( 1 << kind ) ) == 0 )
+        _wec_print_reject(WEC_STATS_LINE_EVENT_FILTER, name);
+
+    if ( _wec_nick_filter_ignore(&context->config.restrictions.nick_filter, wbuffer->casemapping, wbuffer->server, nick) )
+        _wec_print_reject(WEC_STATS_LINE_NICK_FILTER, nick);
+
+    if ( ! playback )
+    {
+        gint max_age = _wec_config_integer(playback, max_age);
+        playback = ( max_age > 0 ) && ( date > 0 ) && ( date < ( time(NULL) - max_age ) );
+    }
+    if ( playback )
+    {
+        _wec_playback_aggregate(context, buffer, wbuffer, kind);
+        return WEC_STATS_LINE_PLAYBACK;
+    }
+
+    switch ( kind )
+    {
+    case WEC_EVENT_JOIN:
+    case WEC_EVENT_LEAVE:
+    case WEC_EVENT_QUIT:
+        if ( _wec_presence_aggregate(context, buffer, wbuffer, kind, nick) )
+            return WEC_STATS_LINE_MERGED;
+    break;
+    default:
+    break;
+    }
+
+    WecQueuePriority priority = _wec_event_priorities[kind];
+
+    if ( ! _wec_flood_allow(context, buffer, wbuffer, category, priority, nick) )
+        _wec_print_reject(WEC_STATS_LINE_RATE_LIMITED, nick);
+
+    /*
+     * This line is an event, written directly in the encoder buffer
+     */
+    gssize message_length = -1;
+    if ( split_message )
+        message_length = _wec_split_message(&message);
+
+    _wec_event_begin(context, priority, category, name);
+    wec_encoder_add(context->encoder, "buddy-name", nick, -1);
+    if ( channel != NULL )
+        wec_encoder_add(context->encoder, "channel", channel, -1);
+
+    WecNick *details = ( wbuffer->nicks != NULL ) ? wec_nicks_lookup(wbuffer->nicks, nick) : NULL;
+    if ( details != NULL )
+    {
+        wec_encoder_add(context->encoder, "server", wbuffer->server, -1);
+        if ( wec_nick_get_host(details) != NULL )
+            wec_encoder_add(context->encoder, "buddy-host", wec_nick_get_host(details), -1);
+        if ( wec_nick_get_account(details) != NULL )
+            wec_encoder_add(context->encoder, "buddy-account", wec_nick_get_account(details), -1);
+        wec_encoder_add(context->encoder, "buddy-away", wec_nick_is_away(details) ? "true" : "false", -1);
+        if ( channel != NULL )
+            wec_encoder_add(context->encoder, "buddy-op", wec_nicks_is_op(wbuffer->nicks, details, channel) ? "true" : "false", -1);
+    }
+    if ( keyword != NULL )
+        wec_encoder_add(context->encoder, "keyword", keyword, -1);
+    wec_encoder_add_text(context->encoder, "message", message, message_length, _wec_config_integer(message, max_size), _wec_config_integer(message, max_length));
+    _wec_send_event(context);
+
+    return WEC_STATS_LINE_SENT;
+}
+#undef _wec_print_reject
+
+/*
+ * Recording of the print stream, see record.c for the format
+ * Data is written by a timer, or as soon as possible above the threshold
+ */
+#define WEC_RECORD_FLUSH_INTERVAL 1000
+#define WEC_RECORD_FLUSH_THRESHOLD ( 64 * 1024 )
+
+static gint
+_wec_record_write_callback(gconstpointer user_data, gpointer data, gint fd)
+{
+    WecContext *context = (WecContext *) user_data;
+
+    if ( ( wec_recorder_flush(context->recorder) < 0 ) || ( wec_recorder_get_pending(context->recorder) == 0 ) )
+    {
+        weechat_unhook(context->record_write_hook);
+        context->record_write_hook = NULL;
+    }
+
+    return WEECHAT_RC_OK;
+}
+
+static gint
+_wec_record_timer_callback(gconstpointer user_data, gpointer data, gint remaining_calls)
+{
+    WecContext *context = (WecContext *) user_data;
+
+    if ( ( context->record_write_hook == NULL ) && ( wec_recorder_get_pending(context->recorder) > 0 ) )
+        context->record_write_hook = weechat_hook_fd(wec_recorder_get_fd(context->recorder), 0, 1, 0, _wec_record_write_callback, context, NULL);
+
+    return WEECHAT_RC_OK;
+}
+
+static void
+_wec_record_stop(WecContext *context)
+{
+    if ( context->recorder == NULL )
+        return;
+
+    if ( context->record_write_hook != NULL )
+        weechat_unhook(context->record_write_hook);
+    context->record_write_hook = NULL;
+    weechat_unhook(context->record_timer);
+    context->record_timer = NULL;
+
+    wec_recorder_free(context->recorder);
+    context->recorder = NULL;
+}
+
+static void
+_wec_record_start(WecContext *context, const gchar *file)
+{
+    _wec_record_stop(context);
+
+    gchar *path = weechat_string_eval_path_home(file, NULL, NULL, NULL);
+    context->recorder = wec_recorder_new(path);
+    if ( context->recorder != NULL )
+    {
+        context->record_timer = weechat_hook_timer(WEC_RECORD_FLUSH_INTERVAL, 0, 0, _wec_record_timer_callback, context, NULL);
+        g_debug("Recording to %s", path);
+    }
+    free(path);
+}
+
+static void
+_wec_record_line(WecContext *context, struct t_gui_buffer *buffer, time_t date, gint tags_count, const gchar **tags, gint displayed, gint highlight, const gchar *prefix, const gchar *message)
+{
+    WecRecorder *recorder = context->recorder;
+
+    if ( ! wec_recorder_has_buffer(recorder, buffer) )
+    {
+        const gchar *plugin = weechat_buffer_get_string(buffer, "plugin");
+        const gchar *type = weechat_buffer_get_string(buffer, "localvar_type");
+        const gchar *server = weechat_buffer_get_string(buffer, "localvar_server");
+        const gchar *channel = weechat_buffer_get_string(buffer, "localvar_channel");
+        gchar *name = g_strdup_printf("%s:%s:%s:%s", ( plugin != NULL ) ? plugin : "", ( type != NULL ) ? type : "", ( server != NULL ) ? server : "", ( channel != NULL ) ? channel : "");
+        wec_recorder_set_buffer(recorder, buffer, name);
+        g_free(name);
+    }
+
+    WecRecordLine line = {
+        .time = g_get_real_time(),
+        .date = date,
+        .displayed = displayed,
+        .highlight = highlight,
+        .prefix = prefix,
+        .tags_count = tags_count,
+        .tags = tags,
+        .message = message,
+    };
+    wec_recorder_line(recorder, buffer, &line);
+
+    if ( ( context->record_write_hook == NULL ) && ( wec_recorder_get_pending(recorder) > WEC_RECORD_FLUSH_THRESHOLD ) )
+        context->record_write_hook = weechat_hook_fd(wec_recorder_get_fd(recorder), 0, 1, 0, _wec_record_write_callback, context, NULL);
+}
+
+static gint
+_wec_print_callback(gconstpointer user_data, gpointer data, struct t_gui_buffer *buffer, time_t date, gint tags_count, const gchar **tags, gint displayed, gint highlight, const gchar *prefix, const gchar *message)
+{
+    WecContext *context = (WecContext *) user_data;
+    WecStats *stats = &context->stats;
+
+    if ( G_UNLIKELY(context->recorder != NULL) && ( buffer != NULL ) )
+        _wec_record_line(context, buffer, date, tags_count, tags, displayed, highlight, prefix, message);
+
+    /* Only time a sample of the lines, reading the clock costs more than the rest */
+    guint64 seen = stats->lines[WEC_STATS_LINE_SEEN]++;
+    WecStatsLine line;
+    WEC_PROBE1(print__entry, buffer);
+    if ( ( seen & ( ( 1 << WEC_STATS_PRINT_SAMPLING ) - 1 ) ) != 0 )
+        line = _wec_print_line(context, buffer, date, tags_count, tags, displayed, highlight, message);
+    else
+    {
+        gint64 start = wec_stats_now();
+        line = _wec_print_line(context, buffer, date, tags_count, tags, displayed, highlight, message);
+        wec_stats_time(stats, WEC_STATS_TIMING_PRINT, start);
+    }
+    ++stats->lines[line];
+    wec_trace_add(context->trace, WEC_TRACE_STAGE_LINE, line, 0, buffer);
+    WEC_PROBE2(print__return, buffer, line);
+
+    return WEECHAT_RC_OK;
+}
+
+
+/*
+ * Only ask WeeChat for the lines we may turn into events,
+ * all of them when recording
+ */
+static gchar *
+_wec_print_hook_tags(WecContext *context)
+{
+    if ( context->recorder != NULL )
+        return g_strdup("*");
+
+#define _wec_event_enabled(kind) ( ! context->config.events.filters[kind].disabled )
+    GString *tags = g_string_new(NULL);
+    gboolean keywords = _wec_event_enabled(WEC_EVENT_KEYWORD) && ( context->keywords != NULL ) && ( ! wec_keywords_is_empty(context->keywords) );
+    if ( _wec_event_enabled(WEC_EVENT_HIGHLIGHT) || _wec_event_enabled(WEC_EVENT_CHAT) || _wec_event_enabled(WEC_EVENT_IM) || keywords )
+        g_string_append(tags, ",irc_privmsg");
+    if ( _wec_event_enabled(WEC_EVENT_HIGHLIGHT) || _wec_event_enabled(WEC_EVENT_NOTICE) )
+        g_string_append(tags, ",irc_notice");
+    if ( _wec_event_enabled(WEC_EVENT_NOTIFY) )
+        g_string_append(tags, ",irc_notify_join,irc_notify_quit,irc_notify_back,irc_notify_away,irc_notify_still_away");
+    if ( _wec_event_enabled(WEC_EVENT_JOIN) )
+        g_string_append(tags, ",irc_join");
+    if ( _wec_event_enabled(WEC_EVENT_LEAVE) )
+        g_string_append(tags, ",irc_part,irc_kick");
+    if ( _wec_event_enabled(WEC_EVENT_QUIT) )
+        g_string_append(tags, ",irc_quit");
+#undef _wec_event_enabled
+
+    if ( tags->len > 0 )
+        g_string_erase(tags, 0, 1);
+    return g_string_free(tags, FALSE);
+}
+
+static void
+_wec_print_hook_update(WecContext *context)
+{
+    gchar *tags = _wec_print_hook_tags(context);
+    if ( g_strcmp0(tags, context->print_hook_tags) == 0 )
+    {
+        g_free(tags);
+        return;
+    }
+
+    /*
+     * Hook the new set before removing the old one
+     * We strip colors ourselves, only for lines we send
+     */
+    struct t_hook *hook = NULL;
+    if ( strcmp(tags, "*") == 0 )
+        hook = weechat_hook_print(NULL, NULL, NULL, 0, _wec_print_callback, context, NULL);
+    else if ( *tags != '\0' )
+        hook = weechat_hook_print(NULL, tags, NULL, 0, _wec_print_callback, context, NULL);
+
+    if ( context->print_hook != NULL )
+        weechat_unhook(context->print_hook);
+    context->print_hook = hook;
+
+    g_debug("Print hook tags: %s", ( *tags != '\0' ) ? tags : "(none)");
+    g_free(context->print_hook_tags);
+    context->print_hook_tags = tags;
+}
+
+/*
+ * Drops what we know about a buffer, sending what it still had pending
+ */
+static void
+_wec_buffer_forget(WecContext *context, struct t_gui_buffer *buffer)
+{
+    g_hash_table_remove(context->buffers, buffer);
+    _wec_flood_forget_buffer(context, buffer);
+
+    WecPresenceWindow *window = g_hash_table_lookup(context->presence, buffer);
+    if ( window != NULL )
+    {
+        _wec_presence_window_flush(window);
+        g_hash_table_remove(context->presence, buffer);
+    }
+
+    WecPlaybackWindow *playback = g_hash_table_lookup(context->playback, buffer);
+    if ( playback != NULL )
+    {
+        _wec_playback_window_flush(playback);
+        g_hash_table_remove(context->playback, buffer);
+    }
+}
+
+gint
+_wec_buffer_closing_callback(gconstpointer user_data, gpointer data, const gchar *signal, const gchar *type_data, gpointer signal_data)
+{
+    WecContext *context = (WecContext *) user_data;
+
+    if ( context->buffer == signal_data )
+        context->buffer = NULL;
+    if ( context->current_buffer == signal_data )
+        context->current_buffer = NULL;
+
+    if ( context->recorder != NULL )
+        wec_recorder_forget_buffer(context->recorder, signal_data);
+    _wec_buffer_forget(context, signal_data);
+
+    return WEECHAT_RC_OK;
+}
+
+static gint
+_wec_buffer_changed_callback(gconstpointer user_data, gpointer data, const gchar *signal, const gchar *type_data, gpointer signal_data)
+{
+    WecContext *context = (WecContext *) user_data;
+
+    /* Will be re-fetched on next print */
+    g_hash_table_remove(context->buffers, signal_data);
+    if ( context->recorder != NULL )
+        wec_recorder_forget_buffer(context->recorder, signal_data);
+
+    return WEECHAT_RC_OK;
 }
 
-static void
-_wec_disconnect(WecContext *context)
+static gint
+_wec_isupport_callback(gconstpointer user_data, gpointer data, const gchar *signal, const gchar *type_data, gpointer signal_data)
 {
-    context->want_connected = FALSE;
-
-    if ( context->connect_hook != NULL )
-        weechat_unhook(context->connect_hook);
+    WecContext *context = (WecContext *) user_data;
 
-    gint error = 0;
-    if ( eventc_light_connection_is_connected(context->client, &error) )
+    /* A server announced its casemapping, buffers will pick it up again */
+    if ( strstr(signal_data, "CASEMAPPING=") != NULL )
     {
-        weechat_unhook(context->fd_hook);
-        eventc_light_connection_close(context->client);
-    }
+        g_hash_table_remove_all(context->buffers);
 
-    context->reconnect_count = 0;
-    context->connect_hook = NULL;
-    context->fd = 0;
-    context->fd_hook = NULL;
-}
+        gchar *server = g_strndup(signal, strcspn(signal, ","));
+        WecNicks *nicks = g_hash_table_lookup(context->nicks, server);
+        if ( nicks != NULL )
+            wec_nicks_set_casemapping(nicks, _wec_server_casemapping(server));
+        g_free(server);
+    }
 
-#define _wec_define_section(name) G_STMT_START { \
-        context->config.name.section = weechat_config_new_section(context->config.file, #name, 0, 0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL); \
-    } G_STMT_END
-#define _wec_define_boolean(sname, name, member, default_value, description) G_STMT_START { \
-        context->config.sname.member = weechat_config_new_option(context->config.file, context->config.sname.section, name, "boolean", description, NULL, 0, 0, default_value, NULL, 0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL); \
-    } G_STMT_END
-#define _wec_define_string(sname, name, member, default_value, description) G_STMT_START { \
-        context->config.sname.member = weechat_config_new_option(context->config.file, context->config.sname.section, #name, "string", description, NULL, 0, 0, default_value, NULL, 0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL); \
-    } G_STMT_END
-#define _wec_define_filter(sname, name, member, default_value, description) G_STMT_START { \
-        context->config.sname.member.option = weechat_config_new_option(context->config.file, context->config.sname.section, name, "string", description, NULL, 0, 0, default_value, NULL, 0, _wec_filter_check, &context->config.sname.member, NULL, _wec_filter_update, &context->config.sname.member, NULL, NULL, NULL, NULL); \
-        context->config.sname.member.names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL); \
-    } G_STMT_END
-#define _wec_define_filter_simple(sname, name, default_value, description) _wec_define_filter(sname, #name, name, default_value, description)
-#define _wec_process_filter(sname, member) G_STMT_START { \
-        _wec_filter_update(&context->config.sname.member, NULL, context->config.sname.member.option); \
-    } G_STMT_END
-#define _wec_clean_filter(sname, member) G_STMT_START { \
-        g_hash_table_unref(context->config.sname.member.names); \
-    } G_STMT_END
+    /* Which modes are prefixes, and which take an argument */
+    if ( ( strstr(signal_data, "PREFIX=") != NULL ) || ( strstr(signal_data, "CHANMODES=") != NULL ) )
+    {
+        gchar *server = g_strndup(signal, strcspn(signal, ","));
+        WecNicks *nicks = g_hash_table_lookup(context->nicks, server);
+        if ( nicks != NULL )
+            _wec_server_modes(server, nicks);
+        g_free(server);
+    }
 
-#define _wec_event_ignore(name) _wec_filter_ignore(&context->config.events.name, buffer_name)
-static inline gboolean
-_wec_filter_ignore(WecEventFilter *filter, const gchar *name)
-{
-    if ( name == NULL )
-        return TRUE;
-    return ( filter->whitelist != g_hash_table_contains(filter->names, name) );
+    return WEECHAT_RC_OK;
 }
 
 static gint
-_wec_filter_check(gconstpointer user_data, gpointer data, struct t_config_option *option, const gchar *value)
+_wec_buffer_switch_callback(gconstpointer user_data, gpointer data, const gchar *signal, const gchar *type_data, gpointer signal_data)
 {
-    WecEventFilter *filter = (WecEventFilter *) user_data;
-
-    g_return_val_if_fail(filter->option == option, WEECHAT_RC_ERROR);
+    WecContext *context = (WecContext *) user_data;
 
-    if ( g_utf8_get_char(value) != '+' )
-        return 1;
+    context->current_buffer = weechat_current_buffer();
 
-    value = g_utf8_next_char(value);
-    gboolean want_end = TRUE;
-    if ( g_utf8_get_char(value) == ' ' )
-    {
-        want_end = FALSE;
-        value = g_utf8_next_char(value);
-    }
-    if ( g_utf8_get_char(value) == '\0' )
-        return want_end ? 1 : 0;
-    return 1;
+    return WEECHAT_RC_OK;
 }
 
-static void
-_wec_filter_update(gconstpointer user_data, gpointer data, struct t_config_option *option)
+/*
+ * Synthetic load, to measure a live setup end to end
+ *
+ * Records are injected at a fixed rate, from a WeeChat timer, through the
+ * same classification and send path as printed lines. They come from two
+ * fake IRC buffers, so event and nick filters apply to them as usual
+ * (the server is "eventc-bench"), but the flood limiter does not.
+ */
+#define WEC_BENCH_INTERVAL 10
+/* Time left to the queues once we stop injecting, before the report */
+#define WEC_BENCH_GRACE 1000
+#define WEC_BENCH_DEFAULT_MIX "chat=6,highlight=1,im=1,join=1,quit=1"
+#define WEC_BENCH_NICKS 32
+
+typedef enum {
+    WEC_BENCH_BUFFER_CHANNEL,
+    WEC_BENCH_BUFFER_PRIVATE,
+    _WEC_BENCH_BUFFER_SIZE
+} WecBenchBuffer;
+
+typedef struct {
+    const gchar *name;
+    WecBenchBuffer buffer;
+    gboolean highlight;
+    const gchar *tags[2];
+} WecBenchKind;
+
+static const WecBenchKind _wec_bench_kinds[] = {
+    { "highlight", WEC_BENCH_BUFFER_CHANNEL, TRUE, { "irc_privmsg", NULL } },
+    { "chat", WEC_BENCH_BUFFER_CHANNEL, FALSE, { "irc_privmsg", NULL } },
+    { "im", WEC_BENCH_BUFFER_PRIVATE, FALSE, { "irc_privmsg", NULL } },
+    { "notice", WEC_BENCH_BUFFER_PRIVATE, FALSE, { "irc_notice", NULL } },
+    { "action", WEC_BENCH_BUFFER_CHANNEL, FALSE, { "irc_privmsg", "irc_action" } },
+    { "join", WEC_BENCH_BUFFER_CHANNEL, FALSE, { "irc_join", NULL } },
+    { "leave", WEC_BENCH_BUFFER_CHANNEL, FALSE, { "irc_part", NULL } },
+    { "quit", WEC_BENCH_BUFFER_CHANNEL, FALSE, { "irc_quit", NULL } },
+};
+
+typedef struct _WecBench {
+    struct t_hook *timer;
+    guint rate;
+    gint64 start;
+    gint64 end;
+    gboolean injecting;
+    guint64 injected;
+    /* Kind indexes, each repeated as many times as its weight */
+    GArray *schedule;
+    /* Their addresses stand for the fake buffers */
+    gchar buffers[_WEC_BENCH_BUFFER_SIZE];
+    guint64 lines[_WEC_STATS_LINE_SIZE];
+    guint64 drops;
+    guint64 latency[WEC_STATS_HISTOGRAM_SIZE];
+} WecBench;
+
+#define _wec_bench_buffer(self, i) ( (struct t_gui_buffer *) &(self)->buffers[i] )
+
+static GArray *
+_wec_bench_parse_mix(const gchar *mix)
 {
-    WecEventFilter *filter = (WecEventFilter *) user_data;
+    GArray *schedule = g_array_new(FALSE, FALSE, sizeof(guint8));
+    gchar **entries = g_strsplit(mix, ",", -1);
+    gchar **entry;
 
-    g_return_if_fail(filter->option == option);
+    for ( entry = entries ; *entry != NULL ; ++entry )
+    {
+        gchar *weight = strchr(*entry, '=');
+        guint64 count = 1;
+        if ( weight != NULL )
+        {
+            *weight++ = '\0';
+            gchar *end;
+            count = g_ascii_strtoull(weight, &end, 10);
+            if ( ( *end != '\0' ) || ( count > 100 ) )
+            {
+                g_warning("Bench: wrong weight for %s: %s", *entry, weight);
+                goto fail;
+            }
+        }
 
-    const gchar *value = weechat_config_string(filter->option);
+        guint8 kind;
+        for ( kind = 0 ; kind < G_N_ELEMENTS(_wec_bench_kinds) ; ++kind )
+        {
+            if ( strcmp(*entry, _wec_bench_kinds[kind].name) == 0 )
+                break;
+        }
+        if ( kind == G_N_ELEMENTS(_wec_bench_kinds) )
+        {
+            g_warning("Bench: unknown kind %s", *entry);
+            goto fail;
+        }
 
-    g_hash_table_remove_all(filter->names);
+        while ( count-- > 0 )
+            g_array_append_val(schedule, kind);
+    }
+    g_strfreev(entries);
 
-    filter->whitelist = ( g_utf8_get_char(value) == '+' );
-    if ( filter->whitelist )
+    if ( schedule->len == 0 )
     {
-        value = g_utf8_next_char(value);
-        if ( g_utf8_get_char(value) == '\0' )
-            return;
-        value = g_utf8_next_char(value);
+        g_warning("Bench: empty mix");
+        g_array_unref(schedule);
+        return NULL;
     }
 
-    gchar **list, **n;
-    list = g_strsplit(value, " ", -1);
-    for ( n = list ; *n != NULL ; ++n )
+    return schedule;
+
+fail:
+    g_strfreev(entries);
+    g_array_unref(schedule);
+    return NULL;
+}
+
+/*
+ * Our buffers go away with the others when a server announces
+ * its casemapping, so we check them before each batch
+ */
+static void
+_wec_bench_buffers_ensure(WecContext *context, WecBench *self)
+{
+    guint i;
+    for ( i = 0 ; i < _WEC_BENCH_BUFFER_SIZE ; ++i )
     {
-        if ( g_utf8_get_char(*n) == '\0' )
-            g_free(*n);
-        else
-            g_hash_table_add(filter->names, *n);
+        struct t_gui_buffer *buffer = _wec_bench_buffer(self, i);
+        if ( g_hash_table_lookup(context->buffers, buffer) != NULL )
+            continue;
+
+        WecBuffer *wbuffer = g_slice_new0(WecBuffer);
+        wbuffer->irc = TRUE;
+        wbuffer->bench = TRUE;
+        wbuffer->type = ( i == WEC_BENCH_BUFFER_CHANNEL ) ? WEC_BUFFER_TYPE_CHANNEL : WEC_BUFFER_TYPE_PRIVATE;
+        wbuffer->server = g_strdup("eventc-bench");
+        wbuffer->name = g_strdup(( i == WEC_BENCH_BUFFER_CHANNEL ) ? "#bench" : "bench");
+        wbuffer->casemapping = WEC_CASEMAPPING_RFC1459;
+        _wec_buffer_update_filters(context, wbuffer);
+        g_hash_table_insert(context->buffers, buffer, wbuffer);
     }
-    g_free(list);
 }
 
 static void
-_wec_config_init(WecContext *context)
+_wec_bench_inject(WecContext *context, WecBench *self)
 {
-    context->config.file = weechat_config_new("eventc", NULL, NULL, NULL);
+    guint64 seq = self->injected++;
+    const WecBenchKind *kind = &_wec_bench_kinds[g_array_index(self->schedule, guint8, seq % self->schedule->len)];
+    gchar nick[sizeof("nick_bench") + 2];
+    gchar message[64];
+    const gchar *tags[4];
+    gint tags_count = 0;
+
+    g_snprintf(nick, sizeof(nick), "nick_bench%02u", (guint) ( seq % WEC_BENCH_NICKS ));
+    tags[tags_count++] = kind->tags[0];
+    if ( kind->tags[1] != NULL )
+        tags[tags_count++] = kind->tags[1];
+    tags[tags_count++] = nick;
+    tags[tags_count] = NULL;
+
+    /* Wall clock, so the far end can compute its own latency */
+    g_snprintf(message, sizeof(message), "eventc bench %" G_GUINT64_FORMAT " sent=%" G_GINT64_FORMAT, seq, g_get_real_time());
+
+    ++self->lines[_wec_print_line(context, _wec_bench_buffer(self, kind->buffer), time(NULL), tags_count, tags, 1, kind->highlight, message)];
+}
 
-    _wec_define_section(events);
-    _wec_define_filter_simple(events, highlight, "", "Highlight");
-    _wec_define_filter_simple(events, chat, "+", "Channel messages");
-    _wec_define_filter_simple(events, im, "", "Private messages");
-    _wec_define_filter_simple(events, notice, "", "Notices");
-    _wec_define_filter_simple(events, action, "+", "Action messages (/me)");
-    _wec_define_filter_simple(events, notify, "*", "Presence notifications");
-    _wec_define_filter_simple(events, join, "+", "Channel join");
-    _wec_define_filter_simple(events, leave, "+", "Channel leave");
-    _wec_define_filter_simple(events, quit, "+", "Channel quit");
+static void
+_wec_bench_format_duration(gchar *buffer, gsize size, guint64 ns)
+{
+    if ( ns == 0 )
+        g_snprintf(buffer, size, "-");
+    else if ( ns >= 10 * 1000 * 1000 )
+        g_snprintf(buffer, size, "<%" G_GUINT64_FORMAT "ms", ns / ( 1000 * 1000 ));
+    else if ( ns >= 10 * 1000 )
+        g_snprintf(buffer, size, "<%" G_GUINT64_FORMAT "us", ns / 1000);
+    else
+        g_snprintf(buffer, size, "<%" G_GUINT64_FORMAT "ns", ns);
+}
 
-    _wec_define_section(restrictions);
-    _wec_define_boolean(restrictions, "ignore-current-buffer", ignore_current_buffer, "on", "Ignore messages from currently displayed buffer");
-    _wec_define_filter(restrictions, "nick-filter", nick_filter, "", "A (space-separated) list of nicknames to completely ignore");
+static void
+_wec_bench_report(WecContext *context, WecBench *self)
+{
+    gint64 elapsed = MIN(g_get_monotonic_time(), self->end) - self->start;
+    gdouble seconds = MAX(elapsed, 1) / (gdouble) G_USEC_PER_SEC;
+    guint i;
 
-    switch ( weechat_config_read(context->config.file) )
-    {
-    case WEECHAT_CONFIG_READ_OK:
-    break;
-    case WEECHAT_CONFIG_READ_MEMORY_ERROR:
-    break;
-    case WEECHAT_CONFIG_READ_FILE_NOT_FOUND:
-        weechat_config_write(context->config.file);
-    break;
-    }
+    _wec_delivery_sync(context);
 
-    _wec_process_filter(events, highlight);
-    _wec_process_filter(events, chat);
-    _wec_process_filter(events, im);
-    _wec_process_filter(events, notice);
-    _wec_process_filter(events, action);
-    _wec_process_filter(events, notify);
-    _wec_process_filter(events, join);
-    _wec_process_filter(events, leave);
-    _wec_process_filter(events, quit);
-    _wec_process_filter(restrictions, nick_filter);
+    guint64 drops = context->stats.drops[WEC_STATS_DROP_QUEUE] + context->stats.drops[WEC_STATS_DROP_SPOOL] - self->drops;
+    guint64 latency[WEC_STATS_HISTOGRAM_SIZE];
+    for ( i = 0 ; i < WEC_STATS_HISTOGRAM_SIZE ; ++i )
+        latency[i] = context->stats.histograms[WEC_STATS_TIMING_QUEUE][i] - self->latency[i];
+
+    gchar p50[32], p99[32];
+    _wec_bench_format_duration(p50, sizeof(p50), wec_stats_histogram_percentile(latency, 50));
+    _wec_bench_format_duration(p99, sizeof(p99), wec_stats_histogram_percentile(latency, 99));
+
+    guint64 sent = self->lines[WEC_STATS_LINE_SENT];
+    guint64 filtered = self->lines[WEC_STATS_LINE_EVENT_FILTER] + self->lines[WEC_STATS_LINE_NICK_FILTER];
+    const gchar *prefix = weechat_prefix("action");
+
+    weechat_printf(context->buffer, "%s"PACKAGE_NAME ": bench: %" G_GUINT64_FORMAT " records in %.1fs (%.1f/s), %" G_GUINT64_FORMAT " events sent (%.1f/s)", prefix, self->injected, seconds, self->injected / seconds, sent, sent / seconds);
+    weechat_printf(context->buffer, "%s"PACKAGE_NAME ": bench: merged=%" G_GUINT64_FORMAT " filtered=%" G_GUINT64_FORMAT " rate-limited=%" G_GUINT64_FORMAT " dropped=%" G_GUINT64_FORMAT ", queue latency p50%s p99%s", prefix, self->lines[WEC_STATS_LINE_MERGED], filtered, self->lines[WEC_STATS_LINE_RATE_LIMITED], drops, p50, p99);
+    guint64 folded = self->lines[WEC_STATS_LINE_MERGED] + self->lines[WEC_STATS_LINE_RATE_LIMITED];
+    if ( folded > 0 )
+        weechat_printf(context->buffer, "%s"PACKAGE_NAME ": bench: %" G_GUINT64_FORMAT " records (%.1f%%) were folded instead of sent, the rates and latencies above only cover the others", prefix, folded, folded * 100. / MAX(self->injected, 1));
 }
 
 static void
-_wec_config_uninit(WecContext *context)
+_wec_bench_stop(WecContext *context, gboolean report)
 {
-    _wec_clean_filter(events, highlight);
-    _wec_clean_filter(events, chat);
-    _wec_clean_filter(events, im);
-    _wec_clean_filter(events, notice);
-    _wec_clean_filter(events, action);
-    _wec_clean_filter(events, notify);
-    _wec_clean_filter(events, join);
-    _wec_clean_filter(events, leave);
-    _wec_clean_filter(events, quit);
-    _wec_clean_filter(restrictions, nick_filter);
-}
+    WecBench *self = context->bench;
+    guint i;
 
-static gchar *
-_wec_split_message(const gchar *s)
-{
-    gchar *c1, *c2;
-    c1 = g_utf8_strchr(s, -1, '"');
-    if ( c1 == NULL )
-        return NULL;
-    ++c1;
+    if ( self == NULL )
+        return;
 
-    c2 = g_utf8_strchr(c1, -1, '"');
-    if ( c2 == NULL )
-        return NULL;
+    weechat_unhook(self->timer);
+    for ( i = 0 ; i < _WEC_BENCH_BUFFER_SIZE ; ++i )
+        _wec_buffer_forget(context, _wec_bench_buffer(self, i));
+    if ( report )
+        _wec_bench_report(context, self);
 
-    return g_strndup(c1, c2 - c1);
+    g_array_unref(self->schedule);
+    g_slice_free(WecBench, self);
+    context->bench = NULL;
 }
 
 static gint
-_wec_print_callback(gconstpointer user_data, gpointer data, struct t_gui_buffer *buffer, time_t date, gint tags_count, const gchar **tags, gint displayed, gint highlight, const gchar *prefix, const gchar *message)
+_wec_bench_timer_callback(gconstpointer user_data, gpointer data, gint remaining_calls)
 {
     WecContext *context = (WecContext *) user_data;
+    WecBench *self = context->bench;
+    gint64 now = g_get_monotonic_time();
 
-    if ( ( ! displayed ) || ( buffer == NULL ) )
+    if ( ! self->injecting )
+    {
+        if ( now >= ( self->end + WEC_BENCH_GRACE * 1000 ) )
+            _wec_bench_stop(context, TRUE);
         return WEECHAT_RC_OK;
+    }
 
-    const gchar *plugin = weechat_buffer_get_string(buffer, "plugin");
-    if ( g_strcmp0(plugin, "irc") != 0 )
-        return WEECHAT_RC_OK;
+    /* We catch up on the timer being late, the rate is over the whole run */
+    guint64 due = (guint64) ( MIN(now, self->end) - self->start ) * self->rate / G_USEC_PER_SEC;
 
-    if ( _wec_config_boolean(restrictions, ignore_current_buffer) && ( buffer == weechat_current_buffer() ) )
-        return WEECHAT_RC_OK;
+    _wec_bench_buffers_ensure(context, self);
+    while ( self->injected < due )
+        _wec_bench_inject(context, self);
 
-    gint error = 0;
-    if ( ! eventc_light_connection_is_connected(context->client, &error) )
-        return WEECHAT_RC_OK;
+    if ( now >= self->end )
+    {
+        guint i;
+        self->injecting = FALSE;
+        /* Pending presence summaries go out during the grace time */
+        for ( i = 0 ; i < _WEC_BENCH_BUFFER_SIZE ; ++i )
+            _wec_buffer_forget(context, _wec_bench_buffer(self, i));
+    }
 
-    const gchar *category = NULL;
-    const gchar *name = NULL;
+    return WEECHAT_RC_OK;
+}
 
-    const gchar *channel = NULL;
-    const gchar *buffer_name = NULL;
+static gboolean
+_wec_bench_start(WecContext *context, const gchar *rate, const gchar *duration, const gchar *mix)
+{
+    guint64 r, d;
+    gchar *end;
 
-    const gchar *buffer_type = weechat_buffer_get_string(buffer, "localvar_type");
-    if ( g_strcmp0(buffer_type, "channel") == 0 )
+    if ( context->bench != NULL )
     {
-        category = "chat";
-        channel = weechat_buffer_get_string(buffer, "localvar_channel");
-        buffer_name = channel;
+        g_warning("Bench already running, stop it first");
+        return FALSE;
     }
-    else if ( g_strcmp0(buffer_type, "private") == 0 )
+
+    r = g_ascii_strtoull(rate, &end, 10);
+    if ( ( *end != '\0' ) || ( r == 0 ) || ( r > 1000000 ) )
     {
-        category = "im";
-        buffer_name = weechat_buffer_get_string(buffer, "localvar_channel");
+        g_warning("Bench: wrong rate (events per second): %s", rate);
+        return FALSE;
     }
-
-    const gchar *nick = NULL;
-    gchar *msg = NULL;
-
-    gint i;
-    for ( i = 0 ; i < tags_count  ; ++i )
+    d = g_ascii_strtoull(duration, &end, 10);
+    if ( ( *end != '\0' ) || ( d == 0 ) || ( d > 3600 ) )
     {
-        const gchar *tag = tags[i];
-        if ( g_str_has_prefix(tag, "log") || g_str_has_prefix(tag, "no_") )
-            continue;
-
-        if ( ( g_strcmp0(tag, "away_info") == 0 ) || ( g_strcmp0(tag, "notify_none") == 0 ) )
-            goto cleanup;
-
-        if ( g_str_has_prefix(tag, "irc_") )
-        {
-            tag += strlen("irc_");
-
-            if ( g_strcmp0(tag, "privmsg") == 0 )
-            {
-                if ( highlight )
-                {
-                    if ( _wec_event_ignore(highlight) )
-                        break;
-                    name = "highlight";
-                    continue;
-                }
-                else if ( channel != NULL )
-                {
-                    if ( _wec_event_ignore(chat) )
-                        break;
-                }
-                else if ( _wec_event_ignore(im) )
-                    break;
-
-                name = "received";
-            }
-            else if ( g_strcmp0(tag, "notice") == 0 )
-            {
-                category = "im";
-                if ( highlight )
-                {
-                    if ( _wec_event_ignore(highlight) )
-                        break;
-                    name = "highlight";
-                    continue;
-                }
-                else if ( _wec_event_ignore(notice) )
-                    break;
-
-                name = "received";
-            }
-            else if ( g_str_has_prefix(tag, "notify_") )
-            {
-                if ( _wec_event_ignore(notify) )
-                    break;
-
-                tag += strlen("notify_");
-
-                category = "presence";
-                if ( g_strcmp0(tag, "join") == 0 )
-                    name = "signed-on";
-                else if ( g_strcmp0(tag, "quit") == 0 )
-                    name = "signed-off";
-                else if ( g_strcmp0(tag, "back") == 0 )
-                    name = "back";
-                else if ( g_strcmp0(tag, "away") == 0 )
-                {
-                    name = "away";
-                    msg = _wec_split_message(message);
-                }
-                else if ( g_strcmp0(tag, "still_away") == 0 )
-                {
-                    name = "message";
-                    msg = _wec_split_message(message);
-                }
-            }
-            else if ( g_strcmp0(tag, "join") == 0 )
-            {
-                if ( _wec_event_ignore(join) )
-                    break;
-
-                category = "presence";
-                name = "join";
-            }
-            else if ( g_strcmp0(tag, "leave") == 0 )
-            {
-                if ( _wec_event_ignore(leave) )
-                    break;
+        g_warning("Bench: wrong duration (seconds): %s", duration);
+        return FALSE;
+    }
 
-                category = "presence";
-                name = "leave";
-            }
-            else if ( g_strcmp0(tag, "quit") == 0 )
-            {
-                if ( _wec_event_ignore(quit) )
-                    break;
+    GArray *schedule = _wec_bench_parse_mix(( mix != NULL ) ? mix : WEC_BENCH_DEFAULT_MIX);
+    if ( schedule == NULL )
+        return FALSE;
 
-                category = "presence";
-                name = "signed-off";
-            }
-        }
-        else if ( g_str_has_prefix(tag, "nick_") )
-            nick = tag + strlen("nick_");
-    }
+    WecBench *self = g_slice_new0(WecBench);
+    self->rate = r;
+    self->schedule = schedule;
 
-    if ( ( category == NULL ) || ( name == NULL ) )
-        goto cleanup;
+    /* Only what happens from now on counts */
+    _wec_delivery_sync(context);
+    self->drops = context->stats.drops[WEC_STATS_DROP_QUEUE] + context->stats.drops[WEC_STATS_DROP_SPOOL];
+    memcpy(self->latency, context->stats.histograms[WEC_STATS_TIMING_QUEUE], sizeof(self->latency));
 
-    if ( _wec_filter_ignore(&context->config.restrictions.nick_filter, nick) )
-        goto cleanup;
+    self->injecting = TRUE;
+    self->start = g_get_monotonic_time();
+    self->end = self->start + (gint64) d * G_USEC_PER_SEC;
+    self->timer = weechat_hook_timer(WEC_BENCH_INTERVAL, 0, 0, _wec_bench_timer_callback, context, NULL);
+    context->bench = self;
 
-    EventdEvent *event;
+    g_debug("Bench: %" G_GUINT64_FORMAT " records/s for %" G_GUINT64_FORMAT "s", r, d);
+    return TRUE;
+}
 
-    event = eventd_event_new(category, name);
+static void
+_wec_stats_print_counter(const gchar *group, const gchar *name, guint64 value, gpointer user_data)
+{
+    GString *line = user_data;
+    gsize group_length = strlen(group);
 
-    if ( nick != NULL )
-        eventd_event_add_data_string(event, g_strdup("buddy-name"), g_strdup(nick));
+    if ( ( strncmp(line->str, group, group_length) != 0 ) || ( line->str[group_length] != ':' ) )
+    {
+        if ( line->len > 0 )
+            weechat_printf(_wec_context.buffer, "  %s", line->str);
+        g_string_printf(line, "%s:", group);
+    }
+    g_string_append_printf(line, " %s=%" G_GUINT64_FORMAT, name, value);
+}
 
-    if ( channel != NULL )
-        eventd_event_add_data_string(event, g_strdup("channel"), g_strdup(channel));
+static void
+_wec_stats_print(WecContext *context)
+{
+    GString *line = g_string_new(NULL);
+    gint64 since = ( g_get_real_time() - context->stats.since ) / G_USEC_PER_SEC;
 
-    eventd_event_add_data_string(event, g_strdup("message"), ( msg != NULL ) ? msg : g_strdup(message));
-    msg = NULL;
+    weechat_printf(context->buffer, "%s"PACKAGE_NAME ": statistics for the last %" G_GINT64_FORMAT "s (print-ns sampled 1/%u)", weechat_prefix("action"), since, 1 << WEC_STATS_PRINT_SAMPLING);
+    wec_stats_foreach(&context->stats, _wec_stats_print_counter, line);
+    if ( line->len > 0 )
+        weechat_printf(context->buffer, "  %s", line->str);
 
-    eventc_light_connection_send_event(context->client, event);
-    eventd_event_unref(event);
+    g_string_free(line, TRUE);
+}
 
-cleanup:
-    g_free(msg);
-    return WEECHAT_RC_OK;
+static void
+_wec_stats_infolist_add(const gchar *group, const gchar *name, guint64 value, gpointer user_data)
+{
+    struct t_infolist *infolist = user_data;
+    struct t_infolist_item *item = weechat_infolist_new_item(infolist);
+    if ( item == NULL )
+        return;
+
+    weechat_infolist_new_var_string(item, "group", group);
+    weechat_infolist_new_var_string(item, "name", name);
+    /* Infolists only have int, saturate */
+    weechat_infolist_new_var_integer(item, "value", (gint) MIN(value, (guint64) G_MAXINT));
 }
 
-gint
-_wec_buffer_closing_callback(gconstpointer user_data, gpointer data, const gchar *signal, const gchar *type_data, gpointer signal_data)
+static struct t_infolist *
+_wec_stats_infolist(gconstpointer user_data, gpointer data, const gchar *infolist_name, gpointer obj_pointer, const gchar *arguments)
 {
     WecContext *context = (WecContext *) user_data;
+    struct t_infolist *infolist = weechat_infolist_new();
+    if ( infolist == NULL )
+        return NULL;
 
-    if ( context->buffer == signal_data )
-        context->buffer = NULL;
+    _wec_delivery_sync(context);
+    wec_stats_foreach(&context->stats, _wec_stats_infolist_add, infolist);
 
-    return WEECHAT_RC_OK;
+    return infolist;
 }
 
 gint
@@ -504,28 +3724,120 @@ _wec_command(gconstpointer user_data, gpointer data, struct t_gui_buffer *buffer
 
     if ( g_strcmp0(argv[1], "connect") == 0 )
     {
+        gboolean active = _wec_delivery_stop(context);
         _wec_disconnect(context);
         _wec_connect(context);
+        if ( active )
+            _wec_delivery_start(context);
     }
     else if ( g_strcmp0(argv[1], "disconnect") == 0 )
+    {
+        gboolean active = _wec_delivery_stop(context);
         _wec_disconnect(context);
+        if ( active )
+            _wec_delivery_start(context);
+    }
     else if ( g_strcmp0(argv[1], "status") == 0 )
     {
         const gchar *prefix = weechat_prefix("action");
-        const gchar *status = "Disconnected";
-        const gchar *extra_status = "";
-        gint error = 0;
-        if ( context->connect_hook != NULL )
-            status = "Connection failed, trying to reconnect";
-        else if ( eventc_light_connection_is_connected(context->client, &error) )
-            status = "Connected";
-        else if ( error != 0 )
+        guint i;
+        for ( i = 0 ; i < context->endpoints->len ; ++i )
+        {
+            WecEndpoint *endpoint = g_ptr_array_index(context->endpoints, i);
+            const gchar *address = ( endpoint->address != NULL ) ? wec_address_to_string(endpoint->address) : endpoint->name;
+            WecEndpointStatus current;
+            gchar *status = NULL;
+            _wec_delivery_get_status(context, endpoint, &current);
+            switch ( current.state )
+            {
+            case WEC_CONNECTION_DISABLED:
+                if ( current.error != 0 )
+                    status = g_strdup_printf("Error on %s: %s", address, g_strerror(current.error));
+                else
+                    status = g_strdup_printf("Disconnected from %s", address);
+            break;
+            case WEC_CONNECTION_BACKOFF:
+            {
+                gint64 delay = MAX(current.next_retry - g_get_real_time(), 0) / 1000;
+                if ( current.error != 0 )
+                    status = g_strdup_printf("Connection to %s failed (%s), retrying in %" G_GINT64_FORMAT ".%01" G_GINT64_FORMAT "s (attempt %u)", address, g_strerror(current.error), delay / 1000, ( delay % 1000 ) / 100, current.retries + 1);
+                else
+                    status = g_strdup_printf("Connection to %s closed, retrying in %" G_GINT64_FORMAT ".%01" G_GINT64_FORMAT "s (attempt %u)", address, delay / 1000, ( delay % 1000 ) / 100, current.retries + 1);
+            }
+            break;
+            case WEC_CONNECTION_CONNECTING:
+                status = g_strdup_printf("Connecting to %s", address);
+            break;
+            case WEC_CONNECTION_CONNECTED:
+                status = g_strdup_printf("Connected to %s", address);
+            break;
+            }
+
+            static const gchar * const priorities[_WEC_QUEUE_PRIORITY_SIZE] = {
+                [WEC_QUEUE_PRIORITY_HIGH] = "high",
+                [WEC_QUEUE_PRIORITY_NOTICE] = "notice",
+                [WEC_QUEUE_PRIORITY_CHAT] = "chat",
+                [WEC_QUEUE_PRIORITY_PRESENCE] = "presence",
+            };
+            GString *shed = g_string_new(NULL);
+            WecQueuePriority priority;
+            for ( priority = 0 ; priority < _WEC_QUEUE_PRIORITY_SIZE ; ++priority )
+            {
+                if ( current.shed[priority] > 0 )
+                    g_string_append_printf(shed, " %s=%" G_GUINT64_FORMAT, priorities[priority], current.shed[priority]);
+            }
+
+            /* We prevent some spam if we have a debug buffer */
+            if ( shed->len > 0 )
+                weechat_printf(context->buffer, "%s"PACKAGE_NAME ": %s, shed:%s", prefix, status, shed->str);
+            else
+                weechat_printf(context->buffer, "%s"PACKAGE_NAME ": %s", prefix, status);
+            g_string_free(shed, TRUE);
+            g_free(status);
+        }
+    }
+    else if ( g_strcmp0(argv[1], "stats") == 0 )
+    {
+        _wec_delivery_sync(context);
+        if ( ( argc > 2 ) && ( g_strcmp0(argv[2], "reset") == 0 ) )
+            wec_stats_reset(&context->stats);
+        else
+            _wec_stats_print(context);
+    }
+    else if ( g_strcmp0(argv[1], "record") == 0 )
+    {
+        if ( ( argc > 3 ) && ( g_strcmp0(argv[2], "start") == 0 ) )
+            _wec_record_start(context, argv_eol[3]);
+        else if ( ( argc > 2 ) && ( g_strcmp0(argv[2], "stop") == 0 ) )
+            _wec_record_stop(context);
+        else
+            return WEECHAT_RC_ERROR;
+        _wec_print_hook_update(context);
+    }
+    else if ( g_strcmp0(argv[1], "bench") == 0 )
+    {
+        if ( ( argc > 2 ) && ( g_strcmp0(argv[2], "stop") == 0 ) )
+            _wec_bench_stop(context, TRUE);
+        else if ( ( argc < 4 ) || ( ! _wec_bench_start(context, argv[2], argv[3], ( argc > 4 ) ? argv[4] : NULL) ) )
+            return WEECHAT_RC_ERROR;
+    }
+    else if ( g_strcmp0(argv[1], "trace") == 0 )
+    {
+        guint64 n = WEC_TRACE_DUMP_DEFAULT;
+        gchar *end;
+
+        if ( ( argc < 3 ) || ( g_strcmp0(argv[2], "dump") != 0 ) )
+            return WEECHAT_RC_ERROR;
+        if ( argc > 3 )
         {
-            status = "Error: ";
-            extra_status = g_strerror(error);
+            n = g_ascii_strtoull(argv[3], &end, 10);
+            if ( ( *end != '\0' ) || ( n == 0 ) || ( n > WEC_TRACE_SIZE ) )
+            {
+                g_warning("Trace: wrong number of records: %s", argv[3]);
+                return WEECHAT_RC_ERROR;
+            }
         }
-        /* We prevent some spam if we have a debug buffer */
-        weechat_printf(context->buffer, "%s"PACKAGE_NAME ": %s%s", prefix, status, extra_status);
+        _wec_trace_dump(context, wec_trace_get_position(context->trace), n);
     }
     else if ( g_strcmp0(argv[1], "debug") == 0 )
     {
@@ -546,11 +3858,36 @@ _wec_command(gconstpointer user_data, gpointer data, struct t_gui_buffer *buffer
     return WEECHAT_RC_OK;
 }
 
+/*
+ * These only go to the debug buffer, without it we drop them
+ * before doing anything else (the trace is there for the hot path)
+ *
+ * Only the main thread may look at the debug buffer, the delivery
+ * thread hands everything over and the main thread decides
+ */
+#define WEC_LOG_LEVEL_DEBUG_BUFFER ( G_LOG_LEVEL_MESSAGE | G_LOG_LEVEL_INFO | G_LOG_LEVEL_DEBUG )
+
+static gboolean
+_wec_log_drop(WecContext *context, GLogLevelFlags log_level)
+{
+    if ( ( log_level & WEC_LOG_LEVEL_DEBUG_BUFFER ) == 0 )
+        return FALSE;
+    if ( ( context->delivery.main_thread != NULL ) && ( g_thread_self() != context->delivery.main_thread ) )
+        return FALSE;
+    return ( context->buffer == NULL );
+}
+
 static void
 _wec_log_handler(const gchar *log_domain, GLogLevelFlags log_level, const gchar *message, gpointer user_data)
 {
     WecContext *context = (WecContext *) user_data;
 
+    if ( _wec_log_drop(context, log_level) )
+        return;
+
+    if ( _wec_delivery_log(context, log_domain, log_level, message) )
+        return;
+
     struct t_gui_buffer *buffer = NULL;
 
     const gchar *prefix = weechat_prefix("action");
@@ -579,6 +3916,24 @@ _wec_log_writer(GLogLevelFlags log_level, const GLogField *fields, gsize n_field
 {
     WecContext *context = (WecContext *) user_data;
 
+    if ( _wec_log_drop(context, log_level) )
+        return G_LOG_WRITER_HANDLED;
+
+    const gchar *log_domain = NULL;
+    const gchar *message = NULL;
+    gsize i;
+    for ( i = 0 ; i < n_fields ; ++i )
+    {
+        if ( g_strcmp0(fields[i].key, "MESSAGE") == 0 )
+            message = fields[i].value;
+        else if ( g_strcmp0(fields[i].key, "GLIB_DOMAIN") == 0 )
+            log_domain = fields[i].value;
+    }
+    g_return_val_if_fail(message != NULL, G_LOG_WRITER_UNHANDLED);
+
+    if ( _wec_delivery_log(context, log_domain, log_level, message) )
+        return G_LOG_WRITER_HANDLED;
+
     struct t_gui_buffer *buffer = NULL;
     const gchar *prefix = weechat_prefix("action");
     switch ( log_level & G_LOG_LEVEL_MASK )
@@ -597,18 +3952,6 @@ _wec_log_writer(GLogLevelFlags log_level, const GLogField *fields, gsize n_field
         break;
     }
 
-    const gchar *log_domain = NULL;
-    const gchar *message = NULL;
-    gsize i;
-    for ( i = 0 ; i < n_fields ; ++i )
-    {
-        if ( g_strcmp0(fields[i].key, "MESSAGE") == 0 )
-            message = fields[i].value;
-        else if ( g_strcmp0(fields[i].key, "GLIB_DOMAIN") == 0 )
-            log_domain = fields[i].value;
-    }
-    g_return_val_if_fail(message != NULL, G_LOG_WRITER_UNHANDLED);
-
     weechat_printf(buffer, "%s[%s] %s", prefix, log_domain, message);
     return G_LOG_WRITER_HANDLED;
 }
@@ -625,17 +3968,42 @@ weechat_plugin_init(struct t_weechat_plugin *plugin, gint argc, gchar *argv[])
     g_log_set_writer_func(_wec_log_writer, context, NULL);
 #endif /* GLIB_CHECK_VERSION(2, 50, 0) */
 
-    _wec_config_init(context);
-
-    context->client = eventc_light_connection_new(NULL);
+    context->buffers = g_hash_table_new_full(NULL, NULL, NULL, _wec_buffer_free);
+    context->presence = g_hash_table_new_full(NULL, NULL, NULL, _wec_presence_window_free);
+    context->playback = g_hash_table_new_full(NULL, NULL, NULL, _wec_playback_window_free);
+    context->flood = g_hash_table_new_full(_wec_flood_key_hash, _wec_flood_key_equal, NULL, _wec_flood_bucket_free);
+    g_queue_init(&context->flood_lru);
+    context->nicks = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) wec_nicks_free);
+    context->keyword_sets = g_ptr_array_new_with_free_func((GDestroyNotify) wec_matcher_free);
+    context->scratch = g_string_new(NULL);
+    context->current_buffer = weechat_current_buffer();
+    context->trace = wec_trace_new(WEC_TRACE_SIZE);
+
+    context->protocol = eventd_protocol_new(&_wec_protocol_callbacks, NULL, NULL);
+    context->encoder = wec_encoder_new(context->protocol);
+    wec_stats_init(&context->stats);
+    wec_stats_init(&context->delivery.stats);
+    wec_stats_init(&context->delivery.pending);
+    g_queue_init(&context->delivery.logs);
+    context->delivery.main_thread = g_thread_self();
 
-    eventc_light_connection_set_disconnected_callback(_wec_context.client, _wec_disconnected_callback, context, NULL);
+    _wec_config_init(context);
 
     _wec_connect(context);
+    _wec_delivery_start(context);
 
-    context->print_hook = weechat_hook_print(NULL, NULL, NULL, 1, _wec_print_callback, context, NULL);
+    _wec_print_hook_update(context);
     context->buffer_closing_hook = weechat_hook_signal("buffer_closing", _wec_buffer_closing_callback, context, NULL);
-    context->command_hook = weechat_hook_command("eventc", "Control eventc", "connect | disconnect | status | debug", "", "connect || disconnect || status || debug", _wec_command, context, NULL);
+    context->buffer_changed_hooks[0] = weechat_hook_signal("buffer_localvar_added", _wec_buffer_changed_callback, context, NULL);
+    context->buffer_changed_hooks[1] = weechat_hook_signal("buffer_localvar_changed", _wec_buffer_changed_callback, context, NULL);
+    context->buffer_changed_hooks[2] = weechat_hook_signal("buffer_localvar_removed", _wec_buffer_changed_callback, context, NULL);
+    context->buffer_changed_hooks[3] = weechat_hook_signal("buffer_renamed", _wec_buffer_changed_callback, context, NULL);
+    context->buffer_switch_hooks[0] = weechat_hook_signal("buffer_switch", _wec_buffer_switch_callback, context, NULL);
+    context->buffer_switch_hooks[1] = weechat_hook_signal("window_switch", _wec_buffer_switch_callback, context, NULL);
+    context->isupport_hook = weechat_hook_signal("*,irc_in2_005", _wec_isupport_callback, context, NULL);
+    _wec_nicks_hook(context);
+    context->command_hook = weechat_hook_command("eventc", "Control eventc", "connect | disconnect | status | stats [reset] | record start <file> | record stop | bench <rate> <duration> [<kind>=<weight>,...] | bench stop | trace dump [<records>] | debug", "", "connect || disconnect || status || stats reset || record start|stop || bench stop || trace dump || debug", _wec_command, context, NULL);
+    context->infolist_hook = weechat_hook_infolist("eventc_stats", "eventc statistics counters (group, name, value)", "", "", _wec_stats_infolist, context, NULL);
 
     return WEECHAT_RC_OK;
 }
@@ -645,11 +4013,32 @@ weechat_plugin_end(struct t_weechat_plugin *plugin)
 {
     WecContext *context = &_wec_context;
 
+    _wec_bench_stop(context, FALSE);
+    _wec_record_stop(context);
+    _wec_delivery_stop(context);
+    _wec_spool_persist(context);
     _wec_disconnect(context);
 
-    eventc_light_connection_unref(context->client);
+    g_ptr_array_unref(context->endpoints);
+    wec_stats_uninit(&context->delivery.pending);
+    wec_stats_uninit(&context->delivery.stats);
+    wec_stats_uninit(&context->stats);
+    wec_encoder_free(context->encoder);
+    eventd_protocol_unref(context->protocol);
 
     _wec_config_uninit(context);
 
+    g_hash_table_unref(context->flood);
+    g_hash_table_unref(context->nicks);
+    g_hash_table_unref(context->playback);
+    g_hash_table_unref(context->presence);
+    g_hash_table_unref(context->buffers);
+    if ( context->keywords != NULL )
+        wec_keywords_free(context->keywords);
+    g_ptr_array_unref(context->keyword_sets);
+    g_string_free(context->scratch, TRUE);
+    wec_trace_free(context->trace);
+    g_free(context->print_hook_tags);
+
     return WEECHAT_RC_OK;
 }
@@ -0,0 +1,44 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __WEECHAT_EVENTC_PROBES_H__
+#define __WEECHAT_EVENTC_PROBES_H__
+
+/*
+ * Static probes for perf and bpftrace, see the bpftrace directory
+ *
+ * An unattached probe is a single nop, but its arguments
+ * are still computed, so only pass what is already at hand
+ */
+#ifdef ENABLE_USDT
+#include <sys/sdt.h>
+
+#define WEC_PROBE1(name, a1) DTRACE_PROBE1(eventc, name, a1)
+#define WEC_PROBE2(name, a1, a2) DTRACE_PROBE2(eventc, name, a1, a2)
+#define WEC_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(eventc, name, a1, a2, a3)
+#else /* ! ENABLE_USDT */
+#define WEC_PROBE1(name, a1) G_STMT_START { } G_STMT_END
+#define WEC_PROBE2(name, a1, a2) G_STMT_START { } G_STMT_END
+#define WEC_PROBE3(name, a1, a2, a3) G_STMT_START { } G_STMT_END
+#endif /* ! ENABLE_USDT */
+
+#endif /* __WEECHAT_EVENTC_PROBES_H__ */
@@ -0,0 +1,479 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <glib.h>
+
+#include "queue.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif /* ! MSG_NOSIGNAL */
+
+/* Upper bound of messages coalesced in a single write */
+#define WEC_QUEUE_MAX_IOV 64
+
+struct _WecMessage {
+    /* Atomic, the delivery thread may drop a reference while we take another */
+    gint refcount;
+    WecQueuePriority priority;
+    /* Monotonic, when it was created */
+    gint64 time;
+    /* Monotonic, when it entered its current queue */
+    gint64 queued;
+    gsize size;
+    gchar *data;
+};
+
+/*
+ * One FIFO per priority, the first non-empty one is written first
+ *
+ * A message we started writing leaves its lane for current,
+ * so nothing can get ahead of it
+ */
+struct _WecQueue {
+    GQueue lanes[_WEC_QUEUE_PRIORITY_SIZE];
+    WecMessage *current;
+    gsize offset;
+    gsize size;
+    guint64 dropped;
+    guint64 shed[_WEC_QUEUE_PRIORITY_SIZE];
+};
+
+WecMessage *
+wec_message_new(gchar *data, gsize size)
+{
+    WecMessage *self;
+
+    self = g_slice_new(WecMessage);
+    self->refcount = 1;
+    self->priority = WEC_QUEUE_PRIORITY_CHAT;
+    self->time = self->queued = g_get_monotonic_time();
+    self->data = data;
+    self->size = size;
+
+    return self;
+}
+
+/*
+ * Copies data in the same block as the message, one allocation per message
+ */
+WecMessage *
+wec_message_new_copy(const gchar *data, gsize size)
+{
+    WecMessage *self;
+
+    self = g_malloc(sizeof(WecMessage) + size);
+    self->refcount = 1;
+    self->priority = WEC_QUEUE_PRIORITY_CHAT;
+    self->time = self->queued = g_get_monotonic_time();
+    self->data = (gchar *) ( self + 1 );
+    self->size = size;
+    memcpy(self->data, data, size);
+
+    return self;
+}
+
+WecMessage *
+wec_message_ref(WecMessage *self)
+{
+    g_atomic_int_inc(&self->refcount);
+    return self;
+}
+
+void
+wec_message_unref(WecMessage *self)
+{
+    if ( ! g_atomic_int_dec_and_test(&self->refcount) )
+        return;
+
+    if ( self->data == (gchar *) ( self + 1 ) )
+    {
+        g_free(self);
+        return;
+    }
+
+    g_free(self->data);
+    g_slice_free(WecMessage, self);
+}
+
+const gchar *
+wec_message_get_data(const WecMessage *self)
+{
+    return self->data;
+}
+
+gsize
+wec_message_get_size(const WecMessage *self)
+{
+    return self->size;
+}
+
+/*
+ * Only before the message is shared with another thread
+ */
+void
+wec_message_set_priority(WecMessage *self, WecQueuePriority priority)
+{
+    g_return_if_fail(priority < _WEC_QUEUE_PRIORITY_SIZE);
+
+    self->priority = priority;
+}
+
+WecQueuePriority
+wec_message_get_priority(const WecMessage *self)
+{
+    return self->priority;
+}
+
+/*
+ * Monotonic time of creation, in microseconds
+ */
+gint64
+wec_message_get_time(const WecMessage *self)
+{
+    return self->time;
+}
+
+/*
+ * Only before the message is shared with another thread
+ */
+void
+wec_message_set_time(WecMessage *self, gint64 time)
+{
+    self->time = time;
+}
+
+WecQueue *
+wec_queue_new(void)
+{
+    WecQueue *self;
+    guint i;
+
+    self = g_slice_new0(WecQueue);
+    for ( i = 0 ; i < _WEC_QUEUE_PRIORITY_SIZE ; ++i )
+        g_queue_init(&self->lanes[i]);
+
+    return self;
+}
+
+void
+wec_queue_free(WecQueue *self)
+{
+    wec_queue_clear(self);
+
+    g_slice_free(WecQueue, self);
+}
+
+static void
+_wec_queue_drop(WecQueue *self, WecMessage *message)
+{
+    self->size -= message->size;
+    ++self->dropped;
+    ++self->shed[message->priority];
+    wec_message_unref(message);
+}
+
+/*
+ * Returns the lowest priority with queued messages, or -1
+ */
+static gint
+_wec_queue_get_lowest(const WecQueue *self)
+{
+    gint i;
+    for ( i = _WEC_QUEUE_PRIORITY_SIZE - 1 ; i >= 0 ; --i )
+    {
+        if ( self->lanes[i].length > 0 )
+            return i;
+    }
+    return -1;
+}
+
+/*
+ * Removes the next message to write from its lane
+ */
+static WecMessage *
+_wec_queue_pop_lanes(WecQueue *self)
+{
+    guint i;
+    for ( i = 0 ; i < _WEC_QUEUE_PRIORITY_SIZE ; ++i )
+    {
+        if ( ! g_queue_is_empty(&self->lanes[i]) )
+            return g_queue_pop_head(&self->lanes[i]);
+    }
+    return NULL;
+}
+
+/*
+ * Takes ownership of message
+ *
+ * When full, we drop the oldest message of the lowest priority,
+ * or the new one if everything queued is more important
+ *
+ * Returns FALSE if the new message was dropped
+ * A max_size of 0 means no limit
+ */
+gboolean
+wec_queue_push(WecQueue *self, WecMessage *message, gsize max_size, WecQueueDropPolicy policy)
+{
+    gint priority = message->priority;
+
+    while ( ( max_size > 0 ) && ( ( self->size + message->size ) > max_size ) )
+    {
+        /* We must never cut a message we started writing, it is out of the lanes */
+        gint lowest = _wec_queue_get_lowest(self);
+
+        if ( ( lowest < priority ) || ( ( lowest == priority ) && ( policy == WEC_QUEUE_DROP_NEWEST ) ) )
+        {
+            ++self->dropped;
+            ++self->shed[priority];
+            wec_message_unref(message);
+            return FALSE;
+        }
+
+        _wec_queue_drop(self, g_queue_pop_head(&self->lanes[lowest]));
+    }
+
+    message->queued = g_get_monotonic_time();
+    g_queue_push_tail(&self->lanes[priority], message);
+    self->size += message->size;
+
+    return TRUE;
+}
+
+/*
+ * Load shedding, before the queue is actually full
+ *
+ * Drops everything but high priority messages that waited more than
+ * max_age (in microseconds) in this queue, so a message coming back from
+ * the spool gets a fresh age, then the lowest priorities first, oldest
+ * first, until the queue is back under max_size
+ * A max_size or max_age of 0 disables that part
+ *
+ * Returns the number of messages dropped
+ */
+guint
+wec_queue_shed(WecQueue *self, gsize max_size, gint64 max_age)
+{
+    guint shed = 0;
+    guint i;
+
+    if ( max_age > 0 )
+    {
+        gint64 limit = g_get_monotonic_time() - max_age;
+        for ( i = WEC_QUEUE_PRIORITY_HIGH + 1 ; i < _WEC_QUEUE_PRIORITY_SIZE ; ++i )
+        {
+            WecMessage *message;
+            while ( ( ( message = g_queue_peek_head(&self->lanes[i]) ) != NULL ) && ( message->queued < limit ) )
+            {
+                _wec_queue_drop(self, g_queue_pop_head(&self->lanes[i]));
+                ++shed;
+            }
+        }
+    }
+
+    if ( max_size > 0 )
+    {
+        for ( i = _WEC_QUEUE_PRIORITY_SIZE - 1 ; ( i > WEC_QUEUE_PRIORITY_HIGH ) && ( self->size > max_size ) ; --i )
+        {
+            while ( ( self->size > max_size ) && ( ! g_queue_is_empty(&self->lanes[i]) ) )
+            {
+                _wec_queue_drop(self, g_queue_pop_head(&self->lanes[i]));
+                ++shed;
+            }
+        }
+    }
+
+    return shed;
+}
+
+/*
+ * Gives back the next message, as a whole even if we started writing it
+ */
+WecMessage *
+wec_queue_pop(WecQueue *self)
+{
+    WecMessage *message;
+
+    message = self->current;
+    if ( message == NULL )
+        message = _wec_queue_pop_lanes(self);
+    if ( message == NULL )
+        return NULL;
+
+    self->current = NULL;
+    self->offset = 0;
+    self->size -= message->size;
+
+    return message;
+}
+
+/*
+ * Write as much as the socket accepts, coalescing queued messages
+ * in priority order
+ * func, if not NULL, is called for each message completely written
+ *
+ * Returns the number of bytes written, or -1 on error with errno set
+ */
+gssize
+wec_queue_flush(WecQueue *self, gint fd, WecQueueSentFunc func, gpointer user_data)
+{
+    gssize written = 0;
+
+    while ( ! wec_queue_is_empty(self) )
+    {
+        struct iovec iov[WEC_QUEUE_MAX_IOV];
+        gsize n = 0, total = 0;
+        guint i;
+        GList *link;
+
+        if ( self->current != NULL )
+        {
+            iov[n].iov_base = self->current->data + self->offset;
+            iov[n].iov_len = self->current->size - self->offset;
+            total += iov[n].iov_len;
+            ++n;
+        }
+        for ( i = 0 ; i < _WEC_QUEUE_PRIORITY_SIZE ; ++i )
+        {
+            for ( link = self->lanes[i].head ; ( link != NULL ) && ( n < WEC_QUEUE_MAX_IOV ) ; link = g_list_next(link) )
+            {
+                WecMessage *message = link->data;
+
+                iov[n].iov_base = message->data;
+                iov[n].iov_len = message->size;
+                total += iov[n].iov_len;
+                ++n;
+            }
+        }
+
+        struct msghdr msg = {
+            .msg_iov = iov,
+            .msg_iovlen = n,
+        };
+        gssize r;
+
+        r = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if ( r < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            if ( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) )
+                break;
+            return -1;
+        }
+        written += r;
+
+        /* Same order as above */
+        gsize left = r;
+        while ( left > 0 )
+        {
+            if ( self->current == NULL )
+                self->current = _wec_queue_pop_lanes(self);
+
+            gsize remaining = self->current->size - self->offset;
+            if ( remaining > left )
+            {
+                self->offset += left;
+                break;
+            }
+
+            left -= remaining;
+            self->offset = 0;
+            self->size -= self->current->size;
+            if ( func != NULL )
+                func(self->current, user_data);
+            wec_message_unref(self->current);
+            self->current = NULL;
+        }
+
+        if ( (gsize) r < total )
+            break;
+    }
+
+    return written;
+}
+
+/*
+ * Called when the connection is lost: a half-written message
+ * cannot be completed on a new connection
+ */
+void
+wec_queue_discard_partial(WecQueue *self)
+{
+    if ( self->current == NULL )
+        return;
+
+    _wec_queue_drop(self, self->current);
+    self->current = NULL;
+    self->offset = 0;
+}
+
+void
+wec_queue_clear(WecQueue *self)
+{
+    WecMessage *message;
+    while ( ( message = wec_queue_pop(self) ) != NULL )
+        wec_message_unref(message);
+}
+
+gboolean
+wec_queue_is_empty(const WecQueue *self)
+{
+    return ( ( self->current == NULL ) && ( _wec_queue_get_lowest(self) < 0 ) );
+}
+
+guint
+wec_queue_get_length(const WecQueue *self)
+{
+    guint length = ( self->current != NULL ) ? 1 : 0;
+    guint i;
+    for ( i = 0 ; i < _WEC_QUEUE_PRIORITY_SIZE ; ++i )
+        length += self->lanes[i].length;
+    return length;
+}
+
+gsize
+wec_queue_get_size(const WecQueue *self)
+{
+    return self->size;
+}
+
+guint64
+wec_queue_get_dropped(const WecQueue *self)
+{
+    return self->dropped;
+}
+
+guint64
+wec_queue_get_shed(const WecQueue *self, WecQueuePriority priority)
+{
+    g_return_val_if_fail(priority < _WEC_QUEUE_PRIORITY_SIZE, 0);
+
+    return self->shed[priority];
+}
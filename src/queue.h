@@ -0,0 +1,72 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __WEECHAT_EVENTC_QUEUE_H__
+#define __WEECHAT_EVENTC_QUEUE_H__
+
+typedef struct _WecMessage WecMessage;
+typedef struct _WecQueue WecQueue;
+
+typedef enum {
+    WEC_QUEUE_DROP_OLDEST,
+    WEC_QUEUE_DROP_NEWEST,
+} WecQueueDropPolicy;
+
+/* Lanes, the first ones go out first and are shed last */
+typedef enum {
+    WEC_QUEUE_PRIORITY_HIGH,
+    WEC_QUEUE_PRIORITY_NOTICE,
+    WEC_QUEUE_PRIORITY_CHAT,
+    WEC_QUEUE_PRIORITY_PRESENCE,
+    _WEC_QUEUE_PRIORITY_SIZE
+} WecQueuePriority;
+
+typedef void (*WecQueueSentFunc)(const WecMessage *message, gpointer user_data);
+
+WecMessage *wec_message_new(gchar *data, gsize size);
+WecMessage *wec_message_new_copy(const gchar *data, gsize size);
+WecMessage *wec_message_ref(WecMessage *message);
+void wec_message_unref(WecMessage *message);
+const gchar *wec_message_get_data(const WecMessage *message);
+gsize wec_message_get_size(const WecMessage *message);
+void wec_message_set_priority(WecMessage *message, WecQueuePriority priority);
+WecQueuePriority wec_message_get_priority(const WecMessage *message);
+gint64 wec_message_get_time(const WecMessage *message);
+void wec_message_set_time(WecMessage *message, gint64 time);
+
+WecQueue *wec_queue_new(void);
+void wec_queue_free(WecQueue *queue);
+
+gboolean wec_queue_push(WecQueue *queue, WecMessage *message, gsize max_size, WecQueueDropPolicy policy);
+guint wec_queue_shed(WecQueue *queue, gsize max_size, gint64 max_age);
+WecMessage *wec_queue_pop(WecQueue *queue);
+gssize wec_queue_flush(WecQueue *queue, gint fd, WecQueueSentFunc func, gpointer user_data);
+void wec_queue_discard_partial(WecQueue *queue);
+void wec_queue_clear(WecQueue *queue);
+
+gboolean wec_queue_is_empty(const WecQueue *queue);
+guint wec_queue_get_length(const WecQueue *queue);
+gsize wec_queue_get_size(const WecQueue *queue);
+guint64 wec_queue_get_dropped(const WecQueue *queue);
+guint64 wec_queue_get_shed(const WecQueue *queue, WecQueuePriority priority);
+
+#endif /* __WEECHAT_EVENTC_QUEUE_H__ */
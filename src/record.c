@@ -0,0 +1,439 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "record.h"
+
+/*
+ * Trace format, integers are LEB128 varints:
+ * header: "WECREC02"
+ * string: 0x01 id length bytes
+ *     Each tag, prefix and buffer name is written once, then referenced
+ *     by id, ids are given in order from 0
+ * line:   0x02 time-delta(µs) buffer-id flags date prefix-id tags-count
+ *         tag-id... message-length message
+ *     The first time-delta is from the epoch, date is how old the line
+ *     was (in seconds) plus one, 0 if it had no date
+ *
+ * "WECREC01" traces have relative times only and no date
+ */
+
+#define WEC_RECORD_MAGIC "WECREC02"
+#define WEC_RECORD_MAGIC_V1 "WECREC01"
+#define WEC_RECORD_MAGIC_SIZE (sizeof(WEC_RECORD_MAGIC) - 1)
+
+enum {
+    WEC_RECORD_STRING = 0x01,
+    WEC_RECORD_LINE = 0x02,
+};
+
+enum {
+    WEC_RECORD_FLAG_DISPLAYED = 1 << 0,
+    WEC_RECORD_FLAG_HIGHLIGHT = 1 << 1,
+};
+
+struct _WecRecorder {
+    gchar *path;
+    gint fd;
+    GByteArray *data;
+    gsize offset;
+    GHashTable *strings;
+    GHashTable *buffers;
+    gint64 time;
+    gboolean failed;
+};
+
+struct _WecRecordReader {
+    GMappedFile *file;
+    const guchar *data;
+    const guchar *end;
+    GPtrArray *strings;
+    GPtrArray *tags;
+    GString *message;
+    gint64 time;
+    gboolean has_date;
+};
+
+static void
+_wec_record_append_varint(GByteArray *data, guint64 value)
+{
+    guint8 buf[10];
+    guint size = 0;
+
+    do
+    {
+        buf[size] = value & 0x7f;
+        value >>= 7;
+        if ( value != 0 )
+            buf[size] |= 0x80;
+        ++size;
+    } while ( value != 0 );
+
+    g_byte_array_append(data, buf, size);
+}
+
+static gboolean
+_wec_record_read_varint(WecRecordReader *self, guint64 *value)
+{
+    guint shift = 0;
+
+    *value = 0;
+    while ( ( self->data < self->end ) && ( shift < 64 ) )
+    {
+        guint8 b = *self->data++;
+        *value |= (guint64) ( b & 0x7f ) << shift;
+        if ( ( b & 0x80 ) == 0 )
+            return TRUE;
+        shift += 7;
+    }
+    return FALSE;
+}
+
+static guint
+_wec_recorder_intern(WecRecorder *self, const gchar *string)
+{
+    gpointer id;
+
+    if ( string == NULL )
+        string = "";
+
+    if ( g_hash_table_lookup_extended(self->strings, string, NULL, &id) )
+        return GPOINTER_TO_UINT(id);
+
+    guint new_id = g_hash_table_size(self->strings);
+    gsize length = strlen(string);
+    guint8 type = WEC_RECORD_STRING;
+
+    g_byte_array_append(self->data, &type, 1);
+    _wec_record_append_varint(self->data, new_id);
+    _wec_record_append_varint(self->data, length);
+    g_byte_array_append(self->data, (const guint8 *) string, length);
+
+    g_hash_table_insert(self->strings, g_strdup(string), GUINT_TO_POINTER(new_id));
+
+    return new_id;
+}
+
+WecRecorder *
+wec_recorder_new(const gchar *path)
+{
+    gint fd;
+
+    fd = g_open(path, O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK | O_CLOEXEC, 0600);
+    if ( fd < 0 )
+    {
+        g_warning("Could not open trace file '%s': %s", path, g_strerror(errno));
+        return NULL;
+    }
+
+    WecRecorder *self;
+
+    self = g_slice_new0(WecRecorder);
+    self->path = g_strdup(path);
+    self->fd = fd;
+    self->data = g_byte_array_sized_new(65536);
+    self->strings = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    self->buffers = g_hash_table_new(NULL, NULL);
+
+    g_byte_array_append(self->data, (const guint8 *) WEC_RECORD_MAGIC, WEC_RECORD_MAGIC_SIZE);
+
+    return self;
+}
+
+void
+wec_recorder_free(WecRecorder *self)
+{
+    /* Last chance, write what is left even if it blocks */
+    gint flags = fcntl(self->fd, F_GETFL);
+    if ( flags >= 0 )
+        fcntl(self->fd, F_SETFL, flags & ~O_NONBLOCK);
+    while ( ( wec_recorder_get_pending(self) > 0 ) && ( wec_recorder_flush(self) > 0 ) );
+
+    close(self->fd);
+
+    g_hash_table_unref(self->buffers);
+    g_hash_table_unref(self->strings);
+    g_byte_array_unref(self->data);
+    g_free(self->path);
+
+    g_slice_free(WecRecorder, self);
+}
+
+gboolean
+wec_recorder_has_buffer(const WecRecorder *self, gconstpointer buffer)
+{
+    return g_hash_table_contains(self->buffers, buffer);
+}
+
+void
+wec_recorder_set_buffer(WecRecorder *self, gconstpointer buffer, const gchar *name)
+{
+    g_hash_table_insert(self->buffers, (gpointer) buffer, GUINT_TO_POINTER(_wec_recorder_intern(self, name)));
+}
+
+void
+wec_recorder_forget_buffer(WecRecorder *self, gconstpointer buffer)
+{
+    g_hash_table_remove(self->buffers, buffer);
+}
+
+void
+wec_recorder_line(WecRecorder *self, gconstpointer buffer, const WecRecordLine *line)
+{
+    if ( self->failed )
+        return;
+
+    /* Strings first, they must come before the line using them */
+    guint buffer_id = GPOINTER_TO_UINT(g_hash_table_lookup(self->buffers, buffer));
+    guint prefix_id = _wec_recorder_intern(self, line->prefix);
+    gint i;
+    for ( i = 0 ; i < line->tags_count ; ++i )
+        _wec_recorder_intern(self, line->tags[i]);
+
+    guint8 type = WEC_RECORD_LINE;
+    guint8 flags = 0;
+    if ( line->displayed )
+        flags |= WEC_RECORD_FLAG_DISPLAYED;
+    if ( line->highlight )
+        flags |= WEC_RECORD_FLAG_HIGHLIGHT;
+
+    g_byte_array_append(self->data, &type, 1);
+    _wec_record_append_varint(self->data, MAX(line->time - self->time, 0));
+    _wec_record_append_varint(self->data, buffer_id);
+    g_byte_array_append(self->data, &flags, 1);
+    _wec_record_append_varint(self->data, ( line->date > 0 ) ? MAX(line->time / G_USEC_PER_SEC - line->date, 0) + 1 : 0);
+    _wec_record_append_varint(self->data, prefix_id);
+    _wec_record_append_varint(self->data, line->tags_count);
+    for ( i = 0 ; i < line->tags_count ; ++i )
+        _wec_record_append_varint(self->data, GPOINTER_TO_UINT(g_hash_table_lookup(self->strings, line->tags[i])));
+
+    gsize length = ( line->message != NULL ) ? strlen(line->message) : 0;
+    _wec_record_append_varint(self->data, length);
+    g_byte_array_append(self->data, (const guint8 *) line->message, length);
+
+    self->time = line->time;
+}
+
+gint
+wec_recorder_get_fd(const WecRecorder *self)
+{
+    return self->fd;
+}
+
+gsize
+wec_recorder_get_pending(const WecRecorder *self)
+{
+    return self->data->len - self->offset;
+}
+
+/*
+ * Returns the number of bytes written, 0 if it would block, -1 on error
+ */
+gssize
+wec_recorder_flush(WecRecorder *self)
+{
+    if ( self->failed )
+        return -1;
+
+    gssize r = write(self->fd, self->data->data + self->offset, self->data->len - self->offset);
+    if ( r < 0 )
+    {
+        if ( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) || ( errno == EINTR ) )
+            return 0;
+
+        g_warning("Could not write to trace file '%s': %s", self->path, g_strerror(errno));
+        self->failed = TRUE;
+        g_byte_array_set_size(self->data, 0);
+        self->offset = 0;
+        return -1;
+    }
+
+    self->offset += r;
+    if ( self->offset == self->data->len )
+    {
+        g_byte_array_set_size(self->data, 0);
+        self->offset = 0;
+    }
+
+    return r;
+}
+
+gboolean
+wec_record_is_trace(const gchar *path)
+{
+    gchar magic[WEC_RECORD_MAGIC_SIZE];
+    gboolean r = FALSE;
+
+    gint fd = g_open(path, O_RDONLY | O_CLOEXEC, 0);
+    if ( fd < 0 )
+        return FALSE;
+    if ( read(fd, magic, WEC_RECORD_MAGIC_SIZE) == WEC_RECORD_MAGIC_SIZE )
+        r = ( memcmp(magic, WEC_RECORD_MAGIC, WEC_RECORD_MAGIC_SIZE) == 0 ) || ( memcmp(magic, WEC_RECORD_MAGIC_V1, WEC_RECORD_MAGIC_SIZE) == 0 );
+    close(fd);
+
+    return r;
+}
+
+WecRecordReader *
+wec_record_reader_new(const gchar *path)
+{
+    GError *error = NULL;
+    GMappedFile *file;
+
+    file = g_mapped_file_new(path, FALSE, &error);
+    if ( file == NULL )
+    {
+        g_warning("Could not read trace file '%s': %s", path, error->message);
+        g_error_free(error);
+        return NULL;
+    }
+
+    const guchar *data = (const guchar *) g_mapped_file_get_contents(file);
+    gsize length = g_mapped_file_get_length(file);
+    if ( ( length < WEC_RECORD_MAGIC_SIZE ) || ( ( memcmp(data, WEC_RECORD_MAGIC, WEC_RECORD_MAGIC_SIZE) != 0 ) && ( memcmp(data, WEC_RECORD_MAGIC_V1, WEC_RECORD_MAGIC_SIZE) != 0 ) ) )
+    {
+        g_warning("Not a trace file: '%s'", path);
+        g_mapped_file_unref(file);
+        return NULL;
+    }
+
+    WecRecordReader *self;
+
+    self = g_slice_new0(WecRecordReader);
+    self->file = file;
+    self->data = data + WEC_RECORD_MAGIC_SIZE;
+    self->end = data + length;
+    self->strings = g_ptr_array_new_with_free_func(g_free);
+    self->tags = g_ptr_array_new();
+    self->message = g_string_new(NULL);
+    self->has_date = ( memcmp(data, WEC_RECORD_MAGIC, WEC_RECORD_MAGIC_SIZE) == 0 );
+
+    return self;
+}
+
+void
+wec_record_reader_free(WecRecordReader *self)
+{
+    g_string_free(self->message, TRUE);
+    g_ptr_array_unref(self->tags);
+    g_ptr_array_unref(self->strings);
+    g_mapped_file_unref(self->file);
+
+    g_slice_free(WecRecordReader, self);
+}
+
+static const gchar *
+_wec_record_reader_string(WecRecordReader *self, guint64 id)
+{
+    if ( id >= self->strings->len )
+        return NULL;
+    return g_ptr_array_index(self->strings, id);
+}
+
+/*
+ * Returned strings are valid until the next call
+ */
+gboolean
+wec_record_reader_next(WecRecordReader *self, WecRecordLine *line)
+{
+    guint64 id, length, value;
+
+    while ( self->data < self->end )
+    {
+        switch ( *self->data++ )
+        {
+        case WEC_RECORD_STRING:
+            if ( ( ! _wec_record_read_varint(self, &id) ) || ( id != self->strings->len ) )
+                goto invalid;
+            if ( ( ! _wec_record_read_varint(self, &length) ) || ( length > (guint64) ( self->end - self->data ) ) )
+                goto invalid;
+            g_ptr_array_add(self->strings, g_strndup((const gchar *) self->data, length));
+            self->data += length;
+        break;
+        case WEC_RECORD_LINE:
+            if ( ! _wec_record_read_varint(self, &value) )
+                goto invalid;
+            self->time += value;
+            line->time = self->time;
+
+            if ( ( ! _wec_record_read_varint(self, &id) ) || ( ( line->buffer = _wec_record_reader_string(self, id) ) == NULL ) )
+                goto invalid;
+
+            if ( self->data >= self->end )
+                goto invalid;
+            line->displayed = ( ( *self->data & WEC_RECORD_FLAG_DISPLAYED ) != 0 );
+            line->highlight = ( ( *self->data & WEC_RECORD_FLAG_HIGHLIGHT ) != 0 );
+            ++self->data;
+
+            line->date = 0;
+            if ( self->has_date )
+            {
+                if ( ! _wec_record_read_varint(self, &value) )
+                    goto invalid;
+                if ( value > 0 )
+                    line->date = line->time / G_USEC_PER_SEC - (gint64) ( value - 1 );
+            }
+
+            if ( ( ! _wec_record_read_varint(self, &id) ) || ( ( line->prefix = _wec_record_reader_string(self, id) ) == NULL ) )
+                goto invalid;
+
+            if ( ( ! _wec_record_read_varint(self, &length) ) || ( length > G_MAXINT ) )
+                goto invalid;
+            g_ptr_array_set_size(self->tags, 0);
+            for ( ; length > 0 ; --length )
+            {
+                const gchar *tag;
+                if ( ( ! _wec_record_read_varint(self, &id) ) || ( ( tag = _wec_record_reader_string(self, id) ) == NULL ) )
+                    goto invalid;
+                g_ptr_array_add(self->tags, (gpointer) tag);
+            }
+            line->tags_count = self->tags->len;
+            line->tags = (const gchar **) self->tags->pdata;
+
+            if ( ( ! _wec_record_read_varint(self, &length) ) || ( length > (guint64) ( self->end - self->data ) ) )
+                goto invalid;
+            g_string_truncate(self->message, 0);
+            g_string_append_len(self->message, (const gchar *) self->data, length);
+            self->data += length;
+            line->message = self->message->str;
+
+            return TRUE;
+        default:
+            goto invalid;
+        }
+    }
+
+    return FALSE;
+
+invalid:
+    g_warning("Truncated or invalid trace file");
+    self->data = self->end;
+    return FALSE;
+}
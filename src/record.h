@@ -0,0 +1,61 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __WEECHAT_EVENTC_RECORD_H__
+#define __WEECHAT_EVENTC_RECORD_H__
+
+typedef struct _WecRecorder WecRecorder;
+typedef struct _WecRecordReader WecRecordReader;
+
+typedef struct {
+    /* Real time of capture, in microseconds */
+    gint64 time;
+    /* The line own date, in seconds, 0 if none */
+    gint64 date;
+    const gchar *buffer;
+    gboolean displayed;
+    gboolean highlight;
+    const gchar *prefix;
+    gint tags_count;
+    const gchar **tags;
+    const gchar *message;
+} WecRecordLine;
+
+WecRecorder *wec_recorder_new(const gchar *path);
+void wec_recorder_free(WecRecorder *recorder);
+
+gboolean wec_recorder_has_buffer(const WecRecorder *recorder, gconstpointer buffer);
+void wec_recorder_set_buffer(WecRecorder *recorder, gconstpointer buffer, const gchar *name);
+void wec_recorder_forget_buffer(WecRecorder *recorder, gconstpointer buffer);
+void wec_recorder_line(WecRecorder *recorder, gconstpointer buffer, const WecRecordLine *line);
+
+gint wec_recorder_get_fd(const WecRecorder *recorder);
+gsize wec_recorder_get_pending(const WecRecorder *recorder);
+gssize wec_recorder_flush(WecRecorder *recorder);
+
+WecRecordReader *wec_record_reader_new(const gchar *path);
+void wec_record_reader_free(WecRecordReader *reader);
+gboolean wec_record_reader_next(WecRecordReader *reader, WecRecordLine *line);
+
+gboolean wec_record_is_trace(const gchar *path);
+
+#endif /* __WEECHAT_EVENTC_RECORD_H__ */
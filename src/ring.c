@@ -0,0 +1,121 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include "ring.h"
+
+/*
+ * Single-producer single-consumer ring of pointers
+ *
+ * The producer only writes tail and the consumer only writes head,
+ * both are free-running and wrap around, so tail - head is the length.
+ * They live on different cache lines, so each side only bounces
+ * the other's line when it looks at it.
+ */
+#define WEC_RING_CACHE_LINE 64
+
+struct _WecRing {
+    guint mask;
+    gint head;
+    gchar head_padding[WEC_RING_CACHE_LINE - sizeof(gint)];
+    gint tail;
+    gchar tail_padding[WEC_RING_CACHE_LINE - sizeof(gint)];
+    gpointer items[];
+};
+
+/*
+ * size is rounded up to a power of two
+ */
+WecRing *
+wec_ring_new(guint size)
+{
+    WecRing *self;
+    guint length = 1 << g_bit_storage(MAX(size, 2) - 1);
+
+    self = g_malloc0(sizeof(WecRing) + length * sizeof(gpointer));
+    self->mask = length - 1;
+
+    return self;
+}
+
+/*
+ * The ring must be empty, we do not know what the items are
+ */
+void
+wec_ring_free(WecRing *self)
+{
+    g_return_if_fail(wec_ring_is_empty(self));
+
+    g_free(self);
+}
+
+/*
+ * Producer side
+ *
+ * Returns FALSE if the ring is full
+ */
+gboolean
+wec_ring_push(WecRing *self, gpointer data)
+{
+    guint tail = (guint) g_atomic_int_get(&self->tail);
+    guint head = (guint) g_atomic_int_get(&self->head);
+
+    if ( ( tail - head ) > self->mask )
+        return FALSE;
+
+    self->items[tail & self->mask] = data;
+    /* Publishes the item, a full barrier */
+    g_atomic_int_set(&self->tail, (gint) ( tail + 1 ));
+
+    return TRUE;
+}
+
+/*
+ * Consumer side
+ *
+ * Returns NULL if the ring is empty
+ */
+gpointer
+wec_ring_pop(WecRing *self)
+{
+    guint head = (guint) g_atomic_int_get(&self->head);
+    guint tail = (guint) g_atomic_int_get(&self->tail);
+    gpointer data;
+
+    if ( head == tail )
+        return NULL;
+
+    data = self->items[head & self->mask];
+    /* Hands the slot back to the producer */
+    g_atomic_int_set(&self->head, (gint) ( head + 1 ));
+
+    return data;
+}
+
+gboolean
+wec_ring_is_empty(WecRing *self)
+{
+    return ( g_atomic_int_get(&self->head) == g_atomic_int_get(&self->tail) );
+}
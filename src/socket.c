@@ -0,0 +1,240 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <glib.h>
+#include <glib-unix.h>
+
+#include "socket.h"
+
+/* What eventd listens on by default */
+#define WEC_EVP_UNIX_SOCKET "evp"
+#define WEC_EVP_DEFAULT_PORT "7100"
+
+struct _WecAddress {
+    gchar *string;
+    struct sockaddr_storage addr;
+    socklen_t length;
+};
+
+static gboolean
+_wec_address_unix(WecAddress *self, const gchar *path, gboolean abstract)
+{
+    struct sockaddr_un *addr = (struct sockaddr_un *) &self->addr;
+    gsize length = strlen(path);
+    gsize offset = abstract ? 1 : 0;
+
+    if ( ( length + offset ) >= sizeof(addr->sun_path) )
+    {
+        g_warning("Socket path is too long: %s", path);
+        return FALSE;
+    }
+
+    addr->sun_family = AF_UNIX;
+    memcpy(addr->sun_path + offset, path, length + 1);
+    if ( abstract )
+    {
+        /* The name is not nul-terminated, the length tells where it ends */
+        addr->sun_path[0] = '\0';
+        self->length = G_STRUCT_OFFSET(struct sockaddr_un, sun_path) + offset + length;
+    }
+    else
+        self->length = sizeof(struct sockaddr_un);
+
+    return TRUE;
+}
+
+static gboolean
+_wec_address_inet(WecAddress *self, const gchar *address)
+{
+    gchar *host, *port;
+    gboolean ret = FALSE;
+
+    if ( address[0] == '[' )
+    {
+        /* [IPv6]:port */
+        const gchar *end = strchr(address, ']');
+        if ( end == NULL )
+        {
+            g_warning("Invalid address: %s", address);
+            return FALSE;
+        }
+        host = g_strndup(address + 1, end - address - 1);
+        port = g_strdup(( end[1] == ':' ) ? ( end + 2 ) : WEC_EVP_DEFAULT_PORT);
+    }
+    else
+    {
+        const gchar *colon = strrchr(address, ':');
+        if ( colon != NULL )
+        {
+            host = g_strndup(address, colon - address);
+            port = g_strdup(colon + 1);
+        }
+        else
+        {
+            host = g_strdup(address);
+            port = g_strdup(WEC_EVP_DEFAULT_PORT);
+        }
+    }
+
+    /*
+     * This may block for a host name, but we only do it when
+     * the address is configured, never on (re)connection
+     */
+    struct addrinfo hints = {
+        .ai_socktype = SOCK_STREAM,
+        .ai_flags = AI_ADDRCONFIG,
+    };
+    struct addrinfo *result;
+    gint error;
+    error = getaddrinfo(host, port, &hints, &result);
+    if ( error != 0 )
+        g_warning("Could not resolve %s: %s", address, gai_strerror(error));
+    else
+    {
+        memcpy(&self->addr, result->ai_addr, result->ai_addrlen);
+        self->length = result->ai_addrlen;
+        freeaddrinfo(result);
+        ret = TRUE;
+    }
+
+    g_free(port);
+    g_free(host);
+
+    return ret;
+}
+
+/*
+ * Supported addresses:
+ *  - NULL or "": eventd default UNIX socket
+ *  - /path/to/socket: a UNIX socket
+ *  - @name: an abstract UNIX socket (Linux only)
+ *  - host[:port] or [IPv6][:port]: TCP
+ */
+WecAddress *
+wec_address_new(const gchar *address)
+{
+    WecAddress *self;
+    gboolean ok;
+
+    self = g_slice_new0(WecAddress);
+
+    if ( ( address == NULL ) || ( *address == '\0' ) )
+    {
+        self->string = g_build_filename(g_get_user_runtime_dir(), "eventd", WEC_EVP_UNIX_SOCKET, NULL);
+        ok = _wec_address_unix(self, self->string, FALSE);
+    }
+    else
+    {
+        self->string = g_strdup(address);
+        if ( address[0] == '/' )
+            ok = _wec_address_unix(self, address, FALSE);
+        else if ( address[0] == '@' )
+            ok = _wec_address_unix(self, address + 1, TRUE);
+        else
+            ok = _wec_address_inet(self, address);
+    }
+
+    if ( ! ok )
+    {
+        wec_address_free(self);
+        return NULL;
+    }
+
+    return self;
+}
+
+void
+wec_address_free(WecAddress *self)
+{
+    g_free(self->string);
+
+    g_slice_free(WecAddress, self);
+}
+
+const gchar *
+wec_address_to_string(const WecAddress *self)
+{
+    return self->string;
+}
+
+/*
+ * Start a non-blocking connection
+ *
+ * Returns 0 if connected right away, -EINPROGRESS if the socket
+ * will be writable once the connection is done, or -errno
+ */
+gint
+wec_socket_connect(const WecAddress *address, gint *fd)
+{
+    gint s, error;
+
+    s = socket(address->addr.ss_family, SOCK_STREAM, 0);
+    if ( s < 0 )
+        return -errno;
+
+    if ( ( ! g_unix_set_fd_nonblocking(s, TRUE, NULL) ) || ( fcntl(s, F_SETFD, FD_CLOEXEC) < 0 ) )
+    {
+        error = errno;
+        close(s);
+        return -error;
+    }
+
+    if ( connect(s, (const struct sockaddr *) &address->addr, address->length) < 0 )
+    {
+        error = errno;
+        if ( error != EINPROGRESS )
+        {
+            close(s);
+            return -error;
+        }
+    }
+    else
+        error = 0;
+
+    *fd = s;
+    return -error;
+}
+
+/*
+ * Once the socket is writable, tells whether the connection succeeded
+ */
+gint
+wec_socket_connect_finish(gint fd)
+{
+    gint error = 0;
+    socklen_t length = sizeof(error);
+
+    if ( getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0 )
+        return -errno;
+
+    return -error;
+}
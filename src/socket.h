@@ -0,0 +1,35 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __WEECHAT_EVENTC_SOCKET_H__
+#define __WEECHAT_EVENTC_SOCKET_H__
+
+typedef struct _WecAddress WecAddress;
+
+WecAddress *wec_address_new(const gchar *address);
+void wec_address_free(WecAddress *address);
+const gchar *wec_address_to_string(const WecAddress *address);
+
+gint wec_socket_connect(const WecAddress *address, gint *fd);
+gint wec_socket_connect_finish(gint fd);
+
+#endif /* __WEECHAT_EVENTC_SOCKET_H__ */
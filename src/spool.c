@@ -0,0 +1,396 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "queue.h"
+#include "spool.h"
+
+/*
+ * Events waiting for eventd to come back
+ *
+ * Without a directory, they are kept in memory.
+ * With a directory, they are appended to a file made of two segments:
+ * when the current one is full, it replaces the old one, so the file
+ * behaves like a ring of the most recent events.
+ * Replay renames a segment away and reads it back through a mapping,
+ * so writers never touch a file being read.
+ *
+ * A segment is a magic followed by records: a header then the data
+ * A segment with another magic is thrown away
+ */
+
+#define WEC_SPOOL_MAGIC "WECSPL02"
+#define WEC_SPOOL_MAGIC_SIZE (sizeof(WEC_SPOOL_MAGIC) - 1)
+
+typedef struct {
+    guint32 size;
+    guint32 priority;
+    /* Real time of creation, the monotonic clock does not survive a restart */
+    gint64 time;
+} WecSpoolRecord;
+
+struct _WecSpool {
+    WecQueue *memory;
+    gchar *path;
+    gchar *old_path;
+    gchar *replay_path;
+    gint fd;
+    gsize size;
+    gboolean has_old;
+    gboolean has_replay;
+    GMappedFile *replay;
+    gsize replay_offset;
+    guint64 dropped;
+};
+
+WecSpool *
+wec_spool_new(void)
+{
+    WecSpool *self;
+
+    self = g_slice_new0(WecSpool);
+    self->memory = wec_queue_new();
+    self->fd = -1;
+
+    return self;
+}
+
+static void
+_wec_spool_close(WecSpool *self)
+{
+    if ( self->fd >= 0 )
+        close(self->fd);
+    self->fd = -1;
+
+    if ( self->replay != NULL )
+        g_mapped_file_unref(self->replay);
+    self->replay = NULL;
+    self->replay_offset = 0;
+
+    g_free(self->replay_path);
+    g_free(self->old_path);
+    g_free(self->path);
+    self->replay_path = self->old_path = self->path = NULL;
+    self->size = 0;
+    self->has_old = self->has_replay = FALSE;
+}
+
+void
+wec_spool_free(WecSpool *self)
+{
+    _wec_spool_close(self);
+    wec_queue_free(self->memory);
+
+    g_slice_free(WecSpool, self);
+}
+
+static gboolean
+_wec_spool_open(WecSpool *self)
+{
+    if ( self->fd >= 0 )
+        return TRUE;
+
+    self->fd = g_open(self->path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if ( self->fd < 0 )
+    {
+        g_warning("Could not open spool file '%s': %s", self->path, g_strerror(errno));
+        return FALSE;
+    }
+
+    struct stat st;
+    gchar magic[WEC_SPOOL_MAGIC_SIZE];
+    if ( ( fstat(self->fd, &st) < 0 ) || ( pread(self->fd, magic, WEC_SPOOL_MAGIC_SIZE, 0) != (gssize) WEC_SPOOL_MAGIC_SIZE ) || ( memcmp(magic, WEC_SPOOL_MAGIC, WEC_SPOOL_MAGIC_SIZE) != 0 ) )
+    {
+        if ( ( ftruncate(self->fd, 0) < 0 ) || ( write(self->fd, WEC_SPOOL_MAGIC, WEC_SPOOL_MAGIC_SIZE) != WEC_SPOOL_MAGIC_SIZE ) )
+        {
+            g_warning("Could not initialize spool file '%s': %s", self->path, g_strerror(errno));
+            close(self->fd);
+            self->fd = -1;
+            return FALSE;
+        }
+        self->size = WEC_SPOOL_MAGIC_SIZE;
+    }
+    else
+        self->size = st.st_size;
+
+    return TRUE;
+}
+
+/*
+ * Number of records in a segment, walking the size headers
+ */
+static guint64
+_wec_spool_count(const gchar *path)
+{
+    gint fd = g_open(path, O_RDONLY | O_CLOEXEC, 0);
+    if ( fd < 0 )
+        return 0;
+
+    guint64 count = 0;
+    gchar magic[WEC_SPOOL_MAGIC_SIZE];
+    if ( ( pread(fd, magic, WEC_SPOOL_MAGIC_SIZE, 0) != (gssize) WEC_SPOOL_MAGIC_SIZE ) || ( memcmp(magic, WEC_SPOOL_MAGIC, WEC_SPOOL_MAGIC_SIZE) != 0 ) )
+    {
+        close(fd);
+        return 0;
+    }
+
+    off_t offset = WEC_SPOOL_MAGIC_SIZE;
+    WecSpoolRecord record;
+    while ( pread(fd, &record, sizeof(record), offset) == sizeof(record) )
+    {
+        offset += sizeof(record) + record.size;
+        ++count;
+    }
+    close(fd);
+
+    return count;
+}
+
+static gboolean
+_wec_spool_write(WecSpool *self, WecMessage *message, gsize max_size)
+{
+    gsize size = wec_message_get_size(message);
+    WecSpoolRecord record = {
+        .size = size,
+        .priority = wec_message_get_priority(message),
+        .time = g_get_real_time() - ( g_get_monotonic_time() - wec_message_get_time(message) ),
+    };
+    gsize segment_size = max_size / 2;
+
+    if ( ( segment_size > 0 ) && ( ( WEC_SPOOL_MAGIC_SIZE + sizeof(record) + size ) > segment_size ) )
+        return FALSE;
+
+    if ( ! _wec_spool_open(self) )
+        return FALSE;
+
+    if ( ( segment_size > 0 ) && ( ( self->size + sizeof(record) + size ) > segment_size ) )
+    {
+        close(self->fd);
+        self->fd = -1;
+        /* The old segment was never replayed, its events are lost */
+        if ( self->has_old )
+            self->dropped += _wec_spool_count(self->old_path);
+        if ( g_rename(self->path, self->old_path) < 0 )
+            g_warning("Could not rotate spool file '%s': %s", self->path, g_strerror(errno));
+        else
+            self->has_old = TRUE;
+        if ( ! _wec_spool_open(self) )
+            return FALSE;
+    }
+
+    struct iovec iov[2] = {
+        { .iov_base = &record, .iov_len = sizeof(record) },
+        { .iov_base = (gpointer) wec_message_get_data(message), .iov_len = size },
+    };
+    gssize r;
+    do
+        r = writev(self->fd, iov, G_N_ELEMENTS(iov));
+    while ( ( r < 0 ) && ( errno == EINTR ) );
+
+    if ( r != (gssize) ( sizeof(record) + size ) )
+    {
+        g_warning("Could not write to spool file '%s': %s", self->path, ( r < 0 ) ? g_strerror(errno) : "short write");
+        /* Drop the half-written record, if any */
+        if ( ftruncate(self->fd, self->size) < 0 )
+            self->size += MAX(r, 0);
+        return FALSE;
+    }
+
+    self->size += r;
+    return TRUE;
+}
+
+void
+wec_spool_set_directory(WecSpool *self, const gchar *directory, gsize max_size)
+{
+    _wec_spool_close(self);
+
+    if ( directory == NULL )
+        return;
+
+    if ( g_mkdir_with_parents(directory, 0700) < 0 )
+    {
+        g_warning("Could not create spool directory '%s': %s", directory, g_strerror(errno));
+        return;
+    }
+
+    self->path = g_build_filename(directory, "spool", NULL);
+    self->old_path = g_build_filename(directory, "spool.old", NULL);
+    self->replay_path = g_build_filename(directory, "spool.replay", NULL);
+    self->has_old = g_file_test(self->old_path, G_FILE_TEST_EXISTS);
+    self->has_replay = g_file_test(self->replay_path, G_FILE_TEST_EXISTS);
+
+    if ( ! _wec_spool_open(self) )
+    {
+        _wec_spool_close(self);
+        return;
+    }
+
+    /* Move what we had in memory to the file */
+    WecMessage *message;
+    while ( ( message = wec_queue_pop(self->memory) ) != NULL )
+        wec_spool_push(self, message, max_size);
+}
+
+/*
+ * Takes ownership of message
+ */
+void
+wec_spool_push(WecSpool *self, WecMessage *message, gsize max_size)
+{
+    if ( self->path == NULL )
+    {
+        guint64 dropped = wec_queue_get_dropped(self->memory);
+        wec_queue_push(self->memory, message, max_size, WEC_QUEUE_DROP_OLDEST);
+        self->dropped += wec_queue_get_dropped(self->memory) - dropped;
+        return;
+    }
+
+    if ( ! _wec_spool_write(self, message, max_size) )
+        ++self->dropped;
+    wec_message_unref(message);
+}
+
+static gboolean
+_wec_spool_start_replay(WecSpool *self)
+{
+    if ( self->path == NULL )
+        return FALSE;
+
+    if ( self->has_replay )
+        self->has_replay = FALSE;
+    else if ( self->has_old )
+    {
+        self->has_old = FALSE;
+        if ( g_rename(self->old_path, self->replay_path) < 0 )
+            return FALSE;
+    }
+    else if ( self->size > WEC_SPOOL_MAGIC_SIZE )
+    {
+        close(self->fd);
+        self->fd = -1;
+        self->size = 0;
+        if ( g_rename(self->path, self->replay_path) < 0 )
+            return FALSE;
+    }
+    else
+        return FALSE;
+
+    GError *error = NULL;
+    self->replay = g_mapped_file_new(self->replay_path, FALSE, &error);
+    if ( self->replay == NULL )
+    {
+        g_warning("Could not read spool file '%s': %s", self->replay_path, error->message);
+        g_error_free(error);
+        g_unlink(self->replay_path);
+        return FALSE;
+    }
+
+    const gchar *data = g_mapped_file_get_contents(self->replay);
+    gsize length = g_mapped_file_get_length(self->replay);
+    if ( ( length < WEC_SPOOL_MAGIC_SIZE ) || ( memcmp(data, WEC_SPOOL_MAGIC, WEC_SPOOL_MAGIC_SIZE) != 0 ) )
+        self->replay_offset = length;
+    else
+        self->replay_offset = WEC_SPOOL_MAGIC_SIZE;
+
+    return TRUE;
+}
+
+static WecMessage *
+_wec_spool_read(WecSpool *self)
+{
+    const gchar *data = g_mapped_file_get_contents(self->replay);
+    gsize length = g_mapped_file_get_length(self->replay);
+    WecSpoolRecord record;
+
+    if ( ( self->replay_offset + sizeof(record) ) > length )
+        return NULL;
+    memcpy(&record, data + self->replay_offset, sizeof(record));
+
+    if ( ( self->replay_offset + sizeof(record) + record.size ) > length )
+        return NULL;
+    self->replay_offset += sizeof(record);
+
+    gchar *copy = g_malloc(record.size + 1);
+    memcpy(copy, data + self->replay_offset, record.size);
+    copy[record.size] = '\0';
+    self->replay_offset += record.size;
+
+    WecMessage *message = wec_message_new(copy, record.size);
+    if ( record.priority < _WEC_QUEUE_PRIORITY_SIZE )
+        wec_message_set_priority(message, record.priority);
+    /* Back to the monotonic clock, never in the future */
+    wec_message_set_time(message, g_get_monotonic_time() - MAX(g_get_real_time() - record.time, 0));
+
+    return message;
+}
+
+/*
+ * Oldest message first: replayed files, then memory
+ */
+WecMessage *
+wec_spool_pop(WecSpool *self)
+{
+    WecMessage *message;
+
+    while ( ( self->replay != NULL ) || _wec_spool_start_replay(self) )
+    {
+        message = _wec_spool_read(self);
+        if ( message != NULL )
+            return message;
+
+        /* Done (or truncated), on to the next segment */
+        g_mapped_file_unref(self->replay);
+        self->replay = NULL;
+        self->replay_offset = 0;
+        g_unlink(self->replay_path);
+    }
+
+    return wec_queue_pop(self->memory);
+}
+
+gboolean
+wec_spool_is_empty(const WecSpool *self)
+{
+    if ( ! wec_queue_is_empty(self->memory) )
+        return FALSE;
+    if ( self->path == NULL )
+        return TRUE;
+    return ( ( self->replay == NULL ) && ( ! self->has_replay ) && ( ! self->has_old ) && ( self->size <= WEC_SPOOL_MAGIC_SIZE ) );
+}
+
+guint64
+wec_spool_get_dropped(const WecSpool *self)
+{
+    return self->dropped;
+}
@@ -0,0 +1,41 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __WEECHAT_EVENTC_SPOOL_H__
+#define __WEECHAT_EVENTC_SPOOL_H__
+
+#include "queue.h"
+
+typedef struct _WecSpool WecSpool;
+
+WecSpool *wec_spool_new(void);
+void wec_spool_free(WecSpool *spool);
+
+void wec_spool_set_directory(WecSpool *spool, const gchar *directory, gsize max_size);
+
+void wec_spool_push(WecSpool *spool, WecMessage *message, gsize max_size);
+WecMessage *wec_spool_pop(WecSpool *spool);
+
+gboolean wec_spool_is_empty(const WecSpool *spool);
+guint64 wec_spool_get_dropped(const WecSpool *spool);
+
+#endif /* __WEECHAT_EVENTC_SPOOL_H__ */
@@ -0,0 +1,229 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <glib.h>
+
+#include "stats.h"
+
+static const gchar * const _wec_stats_line_names[_WEC_STATS_LINE_SIZE] = {
+    [WEC_STATS_LINE_SEEN] = "seen",
+    [WEC_STATS_LINE_HIDDEN] = "hidden",
+    [WEC_STATS_LINE_TAG] = "rejected-tag",
+    [WEC_STATS_LINE_PLUGIN] = "rejected-plugin",
+    [WEC_STATS_LINE_CURRENT_BUFFER] = "rejected-current-buffer",
+    [WEC_STATS_LINE_EVENT_FILTER] = "rejected-event-filter",
+    [WEC_STATS_LINE_NICK_FILTER] = "rejected-nick-filter",
+    [WEC_STATS_LINE_MERGED] = "merged",
+    [WEC_STATS_LINE_PLAYBACK] = "playback",
+    [WEC_STATS_LINE_RATE_LIMITED] = "rate-limited",
+    [WEC_STATS_LINE_SENT] = "sent",
+};
+
+static const gchar * const _wec_stats_connection_names[_WEC_STATS_CONNECTION_SIZE] = {
+    [WEC_STATS_CONNECTION_ATTEMPTS] = "attempts",
+    [WEC_STATS_CONNECTION_ESTABLISHED] = "established",
+    [WEC_STATS_CONNECTION_FAILED] = "failed",
+    [WEC_STATS_CONNECTION_LOST] = "lost",
+};
+
+static const gchar * const _wec_stats_drop_names[_WEC_STATS_DROP_SIZE] = {
+    [WEC_STATS_DROP_SPOOLED] = "spooled",
+    [WEC_STATS_DROP_SPOOL] = "dropped-spool",
+    [WEC_STATS_DROP_QUEUE] = "dropped-queue",
+};
+
+static const gchar * const _wec_stats_timing_names[_WEC_STATS_TIMING_SIZE] = {
+    [WEC_STATS_TIMING_PRINT] = "print-ns",
+    [WEC_STATS_TIMING_SEND] = "send-ns",
+    [WEC_STATS_TIMING_FLUSH] = "flush-ns",
+    [WEC_STATS_TIMING_QUEUE] = "queue-ns",
+};
+
+void
+wec_stats_init(WecStats *self)
+{
+    memset(self, 0, sizeof(WecStats));
+    self->events = g_array_new(FALSE, FALSE, sizeof(WecStatsEvent));
+    self->since = g_get_real_time();
+}
+
+void
+wec_stats_uninit(WecStats *self)
+{
+    g_array_unref(self->events);
+}
+
+void
+wec_stats_reset(WecStats *self)
+{
+    GArray *events = self->events;
+
+    memset(self, 0, sizeof(WecStats));
+    self->events = events;
+    g_array_set_size(self->events, 0);
+    self->since = g_get_real_time();
+}
+
+/*
+ * Adds the counters of other to self and clears them in other,
+ * for stats kept by another thread (events are not moved)
+ */
+void
+wec_stats_merge(WecStats *self, WecStats *other)
+{
+    guint i, j;
+
+    for ( i = 0 ; i < _WEC_STATS_LINE_SIZE ; ++i )
+        self->lines[i] += other->lines[i];
+    for ( i = 0 ; i < _WEC_STATS_CONNECTION_SIZE ; ++i )
+        self->connection[i] += other->connection[i];
+    for ( i = 0 ; i < _WEC_STATS_DROP_SIZE ; ++i )
+        self->drops[i] += other->drops[i];
+    for ( i = 0 ; i < _WEC_STATS_TIMING_SIZE ; ++i )
+    {
+        for ( j = 0 ; j < WEC_STATS_HISTOGRAM_SIZE ; ++j )
+            self->histograms[i][j] += other->histograms[i][j];
+    }
+
+    memset(other->lines, 0, sizeof(other->lines));
+    memset(other->connection, 0, sizeof(other->connection));
+    memset(other->drops, 0, sizeof(other->drops));
+    memset(other->histograms, 0, sizeof(other->histograms));
+}
+
+/*
+ * category and name must be static strings, we compare pointers first
+ */
+void
+wec_stats_event(WecStats *self, const gchar *category, const gchar *name)
+{
+    guint i;
+    for ( i = 0 ; i < self->events->len ; ++i )
+    {
+        WecStatsEvent *event = &g_array_index(self->events, WecStatsEvent, i);
+        if ( ( event->name == name ) && ( event->category == category ) )
+        {
+            ++event->count;
+            return;
+        }
+    }
+    for ( i = 0 ; i < self->events->len ; ++i )
+    {
+        WecStatsEvent *event = &g_array_index(self->events, WecStatsEvent, i);
+        if ( ( strcmp(event->name, name) == 0 ) && ( strcmp(event->category, category) == 0 ) )
+        {
+            ++event->count;
+            return;
+        }
+    }
+
+    WecStatsEvent event = {
+        .category = category,
+        .name = name,
+        .count = 1,
+    };
+    g_array_append_val(self->events, event);
+}
+
+void
+wec_stats_foreach(const WecStats *self, WecStatsFunc func, gpointer user_data)
+{
+    gchar name[64];
+    guint i, j;
+
+    for ( i = 0 ; i < _WEC_STATS_LINE_SIZE ; ++i )
+        func("lines", _wec_stats_line_names[i], self->lines[i], user_data);
+
+    for ( i = 0 ; i < self->events->len ; ++i )
+    {
+        WecStatsEvent *event = &g_array_index(self->events, WecStatsEvent, i);
+        g_snprintf(name, sizeof(name), "%s.%s", event->category, event->name);
+        func("events", name, event->count, user_data);
+    }
+
+    for ( i = 0 ; i < _WEC_STATS_DROP_SIZE ; ++i )
+        func("queue", _wec_stats_drop_names[i], self->drops[i], user_data);
+
+    for ( i = 0 ; i < _WEC_STATS_CONNECTION_SIZE ; ++i )
+        func("connection", _wec_stats_connection_names[i], self->connection[i], user_data);
+
+    for ( i = 0 ; i < _WEC_STATS_TIMING_SIZE ; ++i )
+    {
+        for ( j = 0 ; j < WEC_STATS_HISTOGRAM_SIZE ; ++j )
+        {
+            if ( self->histograms[i][j] == 0 )
+                continue;
+            g_snprintf(name, sizeof(name), "<%" G_GUINT64_FORMAT, (guint64) 1 << j);
+            func(_wec_stats_timing_names[i], name, self->histograms[i][j], user_data);
+        }
+    }
+}
+
+/*
+ * Returns the upper bound (in nanoseconds) of the bucket holding
+ * the given percentile, or 0 if the histogram is empty
+ */
+guint64
+wec_stats_histogram_percentile(const guint64 *histogram, guint percentile)
+{
+    guint64 total = 0, seen = 0;
+    guint i;
+
+    for ( i = 0 ; i < WEC_STATS_HISTOGRAM_SIZE ; ++i )
+        total += histogram[i];
+    if ( total == 0 )
+        return 0;
+
+    guint64 rank = MAX(( total * percentile + 99 ) / 100, 1);
+    for ( i = 0 ; i < WEC_STATS_HISTOGRAM_SIZE ; ++i )
+    {
+        seen += histogram[i];
+        if ( seen >= rank )
+            break;
+    }
+
+    return (guint64) 1 << MIN(i, WEC_STATS_HISTOGRAM_SIZE - 1);
+}
+
+const gchar *
+wec_stats_line_get_name(WecStatsLine line)
+{
+    g_return_val_if_fail(line < _WEC_STATS_LINE_SIZE, NULL);
+    return _wec_stats_line_names[line];
+}
+
+const gchar *
+wec_stats_connection_get_name(WecStatsConnection connection)
+{
+    g_return_val_if_fail(connection < _WEC_STATS_CONNECTION_SIZE, NULL);
+    return _wec_stats_connection_names[connection];
+}
+
+const gchar *
+wec_stats_drop_get_name(WecStatsDrop drop)
+{
+    g_return_val_if_fail(drop < _WEC_STATS_DROP_SIZE, NULL);
+    return _wec_stats_drop_names[drop];
+}
@@ -0,0 +1,123 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __WEECHAT_EVENTC_STATS_H__
+#define __WEECHAT_EVENTC_STATS_H__
+
+#include <time.h>
+
+/*
+ * Counters are plain fields, bumped inline from the main thread,
+ * the delivery thread has its own set merged under a lock
+ */
+
+typedef enum {
+    WEC_STATS_LINE_SEEN,
+    WEC_STATS_LINE_HIDDEN,
+    WEC_STATS_LINE_TAG,
+    WEC_STATS_LINE_PLUGIN,
+    WEC_STATS_LINE_CURRENT_BUFFER,
+    WEC_STATS_LINE_EVENT_FILTER,
+    WEC_STATS_LINE_NICK_FILTER,
+    WEC_STATS_LINE_MERGED,
+    WEC_STATS_LINE_PLAYBACK,
+    WEC_STATS_LINE_RATE_LIMITED,
+    WEC_STATS_LINE_SENT,
+    _WEC_STATS_LINE_SIZE
+} WecStatsLine;
+
+typedef enum {
+    WEC_STATS_CONNECTION_ATTEMPTS,
+    WEC_STATS_CONNECTION_ESTABLISHED,
+    WEC_STATS_CONNECTION_FAILED,
+    WEC_STATS_CONNECTION_LOST,
+    _WEC_STATS_CONNECTION_SIZE
+} WecStatsConnection;
+
+typedef enum {
+    WEC_STATS_DROP_SPOOLED,
+    WEC_STATS_DROP_SPOOL,
+    WEC_STATS_DROP_QUEUE,
+    _WEC_STATS_DROP_SIZE
+} WecStatsDrop;
+
+typedef enum {
+    WEC_STATS_TIMING_PRINT,
+    WEC_STATS_TIMING_SEND,
+    WEC_STATS_TIMING_FLUSH,
+    WEC_STATS_TIMING_QUEUE,
+    _WEC_STATS_TIMING_SIZE
+} WecStatsTiming;
+
+/* Bucket n counts durations in [2^(n-1), 2^n) nanoseconds */
+#define WEC_STATS_HISTOGRAM_SIZE 40
+
+/* Print callback durations are sampled, one line in 2^n */
+#define WEC_STATS_PRINT_SAMPLING 4
+
+typedef struct {
+    const gchar *category;
+    const gchar *name;
+    guint64 count;
+} WecStatsEvent;
+
+typedef struct {
+    guint64 lines[_WEC_STATS_LINE_SIZE];
+    guint64 connection[_WEC_STATS_CONNECTION_SIZE];
+    guint64 drops[_WEC_STATS_DROP_SIZE];
+    guint64 histograms[_WEC_STATS_TIMING_SIZE][WEC_STATS_HISTOGRAM_SIZE];
+    GArray *events;
+    gint64 since;
+} WecStats;
+
+typedef void (*WecStatsFunc)(const gchar *group, const gchar *name, guint64 value, gpointer user_data);
+
+void wec_stats_init(WecStats *stats);
+void wec_stats_uninit(WecStats *stats);
+void wec_stats_reset(WecStats *stats);
+void wec_stats_merge(WecStats *stats, WecStats *other);
+
+void wec_stats_event(WecStats *stats, const gchar *category, const gchar *name);
+void wec_stats_foreach(const WecStats *stats, WecStatsFunc func, gpointer user_data);
+guint64 wec_stats_histogram_percentile(const guint64 *histogram, guint percentile);
+
+const gchar *wec_stats_line_get_name(WecStatsLine line);
+const gchar *wec_stats_connection_get_name(WecStatsConnection connection);
+const gchar *wec_stats_drop_get_name(WecStatsDrop drop);
+
+static inline gint64
+wec_stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (gint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline void
+wec_stats_time(WecStats *stats, WecStatsTiming timing, gint64 start)
+{
+    gint64 duration = wec_stats_now() - start;
+    guint bucket = ( duration > 0 ) ? g_bit_storage(duration) : 0;
+    ++stats->histograms[timing][MIN(bucket, WEC_STATS_HISTOGRAM_SIZE - 1)];
+}
+
+#endif /* __WEECHAT_EVENTC_STATS_H__ */
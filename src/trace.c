@@ -0,0 +1,144 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <time.h>
+#include <glib.h>
+
+#include "trace.h"
+
+/*
+ * Flight recorder: a fixed-size ring of records, overwriting the oldest
+ *
+ * Writers from any thread claim a position with one atomic add,
+ * then fill the slot in place, nothing is formatted nor allocated.
+ * Each slot carries the position it holds (plus one, 0 while being
+ * written), so a reader skips the slots overwritten under its feet.
+ */
+typedef struct {
+    gint position;
+    WecTraceRecord record;
+} WecTraceSlot;
+
+struct _WecTrace {
+    guint mask;
+    gint next;
+    WecTraceSlot slots[];
+};
+
+/*
+ * A few milliseconds of precision is enough to tell what happened when,
+ * and the coarse clock costs next to nothing
+ */
+static inline gint64
+_wec_trace_now(void)
+{
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else /* ! CLOCK_MONOTONIC_COARSE */
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif /* ! CLOCK_MONOTONIC_COARSE */
+    return (gint64) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * size is rounded up to a power of two
+ */
+WecTrace *
+wec_trace_new(guint size)
+{
+    WecTrace *self;
+    guint length = 1 << g_bit_storage(MAX(size, 2) - 1);
+
+    self = g_malloc0(sizeof(WecTrace) + length * sizeof(WecTraceSlot));
+    self->mask = length - 1;
+
+    return self;
+}
+
+void
+wec_trace_free(WecTrace *self)
+{
+    g_free(self);
+}
+
+/*
+ * Returns the position after the record, to dump up to it
+ */
+guint
+wec_trace_add(WecTrace *self, WecTraceStage stage, guint decision, guint reason, gconstpointer subject)
+{
+    guint position = (guint) g_atomic_int_add(&self->next, 1);
+    WecTraceSlot *slot = &self->slots[position & self->mask];
+
+    g_atomic_int_set(&slot->position, 0);
+    slot->record.time = _wec_trace_now();
+    slot->record.subject = subject;
+    slot->record.reason = reason;
+    slot->record.stage = stage;
+    slot->record.decision = decision;
+    /* Publishes the record, a full barrier */
+    g_atomic_int_set(&slot->position, (gint) ( position + 1 ));
+
+    return position + 1;
+}
+
+guint
+wec_trace_get_position(WecTrace *self)
+{
+    return (guint) g_atomic_int_get(&self->next);
+}
+
+/*
+ * Calls func on (at most) the n records before end, oldest first
+ *
+ * Returns the number of records seen
+ */
+guint
+wec_trace_foreach(WecTrace *self, guint end, guint n, WecTraceFunc func, gpointer user_data)
+{
+    guint position, count = 0;
+
+    /* Older slots are overwritten, records still being written are skipped */
+    n = MIN(n, self->mask + 1);
+    n = MIN(n, end);
+
+    for ( position = end - n ; position != end ; ++position )
+    {
+        WecTraceSlot *slot = &self->slots[position & self->mask];
+        WecTraceRecord record;
+
+        if ( g_atomic_int_get(&slot->position) != (gint) ( position + 1 ) )
+            continue;
+        record = slot->record;
+        /* A read-modify-write, so the copy cannot move after it */
+        if ( g_atomic_int_add(&slot->position, 0) != (gint) ( position + 1 ) )
+            continue;
+
+        func(&record, user_data);
+        ++count;
+    }
+
+    return count;
+}
@@ -0,0 +1,60 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __WEECHAT_EVENTC_TRACE_H__
+#define __WEECHAT_EVENTC_TRACE_H__
+
+/*
+ * What decision and reason mean depends on the stage
+ */
+typedef enum {
+    /* subject: the buffer, decision: WecStatsLine */
+    WEC_TRACE_STAGE_LINE,
+    /* subject: the endpoint, decision: WecStatsDrop, reason: the number of events */
+    WEC_TRACE_STAGE_QUEUE,
+    /* subject: the endpoint, decision: WecStatsConnection, reason: the errno */
+    WEC_TRACE_STAGE_CONNECTION,
+    _WEC_TRACE_STAGE_SIZE
+} WecTraceStage;
+
+typedef struct {
+    /* Monotonic, in microseconds */
+    gint64 time;
+    gconstpointer subject;
+    guint32 reason;
+    guint16 stage;
+    guint16 decision;
+} WecTraceRecord;
+
+typedef struct _WecTrace WecTrace;
+
+typedef void (*WecTraceFunc)(const WecTraceRecord *record, gpointer user_data);
+
+WecTrace *wec_trace_new(guint size);
+void wec_trace_free(WecTrace *trace);
+
+guint wec_trace_add(WecTrace *trace, WecTraceStage stage, guint decision, guint reason, gconstpointer subject);
+
+guint wec_trace_get_position(WecTrace *trace);
+guint wec_trace_foreach(WecTrace *trace, guint end, guint n, WecTraceFunc func, gpointer user_data);
+
+#endif /* __WEECHAT_EVENTC_TRACE_H__ */
@@ -0,0 +1,150 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <glib.h>
+
+#include "keywords.h"
+
+static const gchar *
+_wec_test_search(const WecKeywords *keywords, const gchar *text, guint64 sets)
+{
+    return wec_keywords_search(keywords, text, strlen(text), sets);
+}
+
+static void
+_wec_test_keywords_word_boundaries(void)
+{
+    WecKeywords *keywords = wec_keywords_new();
+    wec_keywords_add(keywords, "eventd", 0);
+    wec_keywords_add(keywords, "c++", 0);
+    wec_keywords_add(keywords, "#chan", 0);
+    wec_keywords_compile(keywords);
+
+    g_assert_cmpstr(_wec_test_search(keywords, "eventd", 1), ==, "eventd");
+    g_assert_cmpstr(_wec_test_search(keywords, "about eventd, again", 1), ==, "eventd");
+    g_assert_cmpstr(_wec_test_search(keywords, "(eventd)", 1), ==, "eventd");
+    g_assert_null(_wec_test_search(keywords, "eventdx", 1));
+    g_assert_null(_wec_test_search(keywords, "xeventd", 1));
+    g_assert_null(_wec_test_search(keywords, "my_eventd", 1));
+    g_assert_null(_wec_test_search(keywords, "eventd2", 1));
+    g_assert_null(_wec_test_search(keywords, "\xc3\xa9" "eventd", 1));
+
+    /* Only edges that are word characters need a boundary */
+    g_assert_cmpstr(_wec_test_search(keywords, "c++11", 1), ==, "c++");
+    g_assert_null(_wec_test_search(keywords, "abc++", 1));
+    g_assert_cmpstr(_wec_test_search(keywords, "join a#chan", 1), ==, "#chan");
+    g_assert_null(_wec_test_search(keywords, "#channel", 1));
+
+    /* The length is honoured, not the NUL */
+    g_assert_cmpstr(wec_keywords_search(keywords, "eventdx", 6, 1), ==, "eventd");
+    g_assert_null(wec_keywords_search(keywords, "eventd", 5, 1));
+
+    wec_keywords_free(keywords);
+}
+
+static void
+_wec_test_keywords_case_folding(void)
+{
+    WecKeywords *keywords = wec_keywords_new();
+    wec_keywords_add(keywords, "EventD", 0);
+    wec_keywords_add(keywords, "\xc3\xa9t\xc3\xa9", 0);
+    wec_keywords_compile(keywords);
+
+    g_assert_cmpstr(_wec_test_search(keywords, "eventd", 1), ==, "EventD");
+    g_assert_cmpstr(_wec_test_search(keywords, "EVENTD", 1), ==, "EventD");
+    g_assert_cmpstr(_wec_test_search(keywords, "eVeNtD", 1), ==, "EventD");
+
+    /* ASCII only */
+    g_assert_cmpstr(_wec_test_search(keywords, "l'\xc3\xa9t\xc3\xa9", 1), ==, "\xc3\xa9t\xc3\xa9");
+    g_assert_null(_wec_test_search(keywords, "l'\xc3\x89T\xc3\x89", 1));
+
+    wec_keywords_free(keywords);
+}
+
+static void
+_wec_test_keywords_shared(void)
+{
+    WecKeywords *keywords = wec_keywords_new();
+    wec_keywords_add(keywords, "bug", 0);
+    wec_keywords_add(keywords, "crash", 1);
+    wec_keywords_add(keywords, "BUG", 2);
+    wec_keywords_compile(keywords);
+
+    g_assert_cmpstr(_wec_test_search(keywords, "a bug", 1 << 0), ==, "bug");
+    g_assert_cmpstr(_wec_test_search(keywords, "a bug", 1 << 2), ==, "bug");
+    g_assert_cmpstr(_wec_test_search(keywords, "a bug", ( 1 << 0 ) | ( 1 << 2 )), ==, "bug");
+    g_assert_null(_wec_test_search(keywords, "a bug", 1 << 1));
+    g_assert_null(_wec_test_search(keywords, "a bug", 0));
+
+    wec_keywords_free(keywords);
+}
+
+static void
+_wec_test_keywords_order(void)
+{
+    WecKeywords *keywords = wec_keywords_new();
+    wec_keywords_add(keywords, "zeta", 0);
+    wec_keywords_add(keywords, "alpha", 1);
+    wec_keywords_add(keywords, "new", 0);
+    wec_keywords_add(keywords, "new york", 0);
+    wec_keywords_compile(keywords);
+
+    /* First in text, not first added */
+    g_assert_cmpstr(_wec_test_search(keywords, "alpha zeta", 3), ==, "alpha");
+    g_assert_cmpstr(_wec_test_search(keywords, "zeta alpha", 3), ==, "zeta");
+    g_assert_cmpstr(_wec_test_search(keywords, "alpha zeta", 1), ==, "zeta");
+
+    /* A keyword ending first wins over a longer one */
+    g_assert_cmpstr(_wec_test_search(keywords, "new york", 1), ==, "new");
+
+    wec_keywords_free(keywords);
+}
+
+static void
+_wec_test_keywords_empty(void)
+{
+    WecKeywords *keywords = wec_keywords_new();
+    wec_keywords_add(keywords, "", 0);
+    wec_keywords_compile(keywords);
+
+    g_assert_true(wec_keywords_is_empty(keywords));
+    g_assert_null(_wec_test_search(keywords, "anything", 1));
+
+    wec_keywords_free(keywords);
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/keywords/word-boundaries", _wec_test_keywords_word_boundaries);
+    g_test_add_func("/keywords/case-folding", _wec_test_keywords_case_folding);
+    g_test_add_func("/keywords/shared", _wec_test_keywords_shared);
+    g_test_add_func("/keywords/order", _wec_test_keywords_order);
+    g_test_add_func("/keywords/empty", _wec_test_keywords_empty);
+
+    return g_test_run();
+}
@@ -0,0 +1,122 @@
+/*
+ * weechat-eventc - Weechat plugin client for eventd
+ *
+ * Copyright © 2011-2015 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of weechat-eventc.
+ *
+ * weechat-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * weechat-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with weechat-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "queue.h"
+#include "spool.h"
+
+/* Short enough to wait for it, in microseconds */
+#define WEC_TEST_SHED_AGE 10000
+
+static WecMessage *
+_wec_test_message(const gchar *data, WecQueuePriority priority)
+{
+    WecMessage *message = wec_message_new_copy(data, strlen(data));
+    wec_message_set_priority(message, priority);
+    return message;
+}
+
+static void
+_wec_test_spool_replay_age(void)
+{
+    WecSpool *spool = wec_spool_new();
+    WecQueue *queue = wec_queue_new();
+    WecMessage *message;
+
+    wec_spool_push(spool, _wec_test_message("chat", WEC_QUEUE_PRIORITY_CHAT), 0);
+    wec_spool_push(spool, _wec_test_message("notice", WEC_QUEUE_PRIORITY_NOTICE), 0);
+    wec_spool_push(spool, _wec_test_message("presence", WEC_QUEUE_PRIORITY_PRESENCE), 0);
+
+    /* The outage */
+    g_usleep(2 * WEC_TEST_SHED_AGE);
+
+    while ( ( message = wec_spool_pop(spool) ) != NULL )
+        wec_queue_push(queue, message, 0, WEC_QUEUE_DROP_OLDEST);
+
+    g_assert_cmpuint(wec_queue_shed(queue, 0, WEC_TEST_SHED_AGE), ==, 0);
+    g_assert_cmpuint(wec_queue_get_length(queue), ==, 3);
+
+    /* Once replayed, they age like any other */
+    g_usleep(2 * WEC_TEST_SHED_AGE);
+    g_assert_cmpuint(wec_queue_shed(queue, 0, WEC_TEST_SHED_AGE), ==, 3);
+    g_assert_cmpuint(wec_queue_get_shed(queue, WEC_QUEUE_PRIORITY_CHAT), ==, 1);
+
+    wec_queue_free(queue);
+    wec_spool_free(spool);
+}
+
+static void
+_wec_test_spool_file_priority(void)
+{
+    gchar *directory = g_dir_make_tmp("eventc-spool-XXXXXX", NULL);
+    g_assert_nonnull(directory);
+
+    WecSpool *spool = wec_spool_new();
+    wec_spool_set_directory(spool, directory, 0);
+
+    WecMessage *high = _wec_test_message("highlight", WEC_QUEUE_PRIORITY_HIGH);
+    gint64 time = wec_message_get_time(high);
+    wec_spool_push(spool, high, 0);
+    wec_spool_push(spool, _wec_test_message("presence", WEC_QUEUE_PRIORITY_PRESENCE), 0);
+
+    g_usleep(2 * WEC_TEST_SHED_AGE);
+
+    WecMessage *message = wec_spool_pop(spool);
+    g_assert_nonnull(message);
+    g_assert_cmpint(wec_message_get_size(message), ==, strlen("highlight"));
+    g_assert_cmpint(memcmp(wec_message_get_data(message), "highlight", strlen("highlight")), ==, 0);
+    g_assert_cmpint(wec_message_get_priority(message), ==, WEC_QUEUE_PRIORITY_HIGH);
+    /* Through the real clock and back, a little slack */
+    g_assert_cmpint(ABS(wec_message_get_time(message) - time), <, WEC_TEST_SHED_AGE);
+    wec_message_unref(message);
+
+    message = wec_spool_pop(spool);
+    g_assert_nonnull(message);
+    g_assert_cmpint(wec_message_get_priority(message), ==, WEC_QUEUE_PRIORITY_PRESENCE);
+    wec_message_unref(message);
+
+    g_assert_null(wec_spool_pop(spool));
+    g_assert_cmpuint(wec_spool_get_dropped(spool), ==, 0);
+    wec_spool_free(spool);
+
+    gchar *path = g_build_filename(directory, "spool", NULL);
+    g_unlink(path);
+    g_free(path);
+    g_rmdir(directory);
+    g_free(directory);
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/spool/replay-age", _wec_test_spool_replay_age);
+    g_test_add_func("/spool/file-priority", _wec_test_spool_file_priority);
+
+    return g_test_run();
+}